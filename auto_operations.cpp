@@ -0,0 +1,313 @@
+#include "auto_operations.hpp"
+#include "program_cache.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+
+static double timeMultiply(const Operations& op, const Matrix& lhs, const Matrix& rhs)
+{
+    using namespace std::chrono;
+
+    steady_clock::time_point start = steady_clock::now();
+    Matrix result = op.multiply(lhs, rhs);
+    steady_clock::time_point end = steady_clock::now();
+
+    return duration_cast<duration<double> >(end - start).count();
+}
+
+AutoOperations::AutoOperations(const std::string& tableFile)
+    : m_tableFile(tableFile)
+{
+    // Every variant builds its own program, one that fails on this device is left out.
+    static const char* const NAMES[] = { "gpu", "transposed", "dot", "float4", "tiled", "block4x4", "block8x4" };
+    for (size_t i = 0; i < sizeof(NAMES) / sizeof(NAMES[0]); i++)
+    {
+        GpuOperations* ops = NULL;
+        try
+        {
+            switch (i)
+            {
+                case 0: ops = new GpuOperations(); break;
+                case 1: ops = new TransposedGpuOperations(); break;
+                case 2: ops = new DotGpuOperations(); break;
+                case 3: ops = new Float4GpuOperations(); break;
+                case 4: ops = new TiledGpuOperations(); break;
+                case 5: ops = new BlockedGpuOperations(4); break;
+                case 6: ops = new BlockedGpuOperations(8); break;
+            }
+        }
+        catch (const char*)
+        {
+            continue;
+        }
+
+        m_candidates.push_back(Candidate(NAMES[i], ops));
+    }
+
+    if (m_candidates.empty())
+    {
+        throw "no gpu variant";
+    }
+
+    // Tabs and newlines separate the table fields.
+    m_device = m_candidates[0].second->deviceName();
+    std::replace(m_device.begin(), m_device.end(), '\t', ' ');
+    std::replace(m_device.begin(), m_device.end(), '\n', ' ');
+
+    loadTable();
+}
+
+AutoOperations::~AutoOperations(void)
+{
+    for (size_t i = 0; i < m_candidates.size(); i++)
+    {
+        delete m_candidates[i].second;
+    }
+}
+
+std::string AutoOperations::defaultTableFile(void)
+{
+    const std::string directory = defaultCacheDirectory();
+    return directory.empty() ? "" : directory + "/tuning.txt";
+}
+
+Matrix AutoOperations::multiply(const Matrix& lhs, const Matrix& rhs) const
+{
+    const std::string shape = key(lhs.width(), lhs.height(), rhs.width());
+
+    std::map<std::string, Choice>::iterator it = m_table.find(shape);
+    GpuOperations* ops = it != m_table.end() ? candidate(it->second.variant) : NULL;
+    if (ops == NULL)
+    {
+        // New shape, or the table names a variant this build does not have.
+        Choice best = tune(lhs, rhs);
+        m_table[shape] = best;
+        storeChoice(lhs.width(), lhs.height(), rhs.width(), best);
+
+        it = m_table.find(shape);
+        ops = candidate(best.variant);
+    }
+
+    ops->setLocalWorkSize(it->second.localWorkSize[0], it->second.localWorkSize[1]);
+    return ops->multiply(lhs, rhs);
+}
+
+void AutoOperations::multiplyInto(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView& result) const
+{
+    std::map<std::string, Choice>::iterator it = m_table.find(key(lhs.width(), lhs.height(), rhs.width()));
+    GpuOperations* ops = it != m_table.end() ? candidate(it->second.variant) : NULL;
+    if (ops == NULL)
+    {
+        Operations::multiplyInto(lhs, rhs, result);
+        return;
+    }
+
+    ops->setLocalWorkSize(it->second.localWorkSize[0], it->second.localWorkSize[1]);
+    ops->multiplyInto(lhs, rhs, result);
+}
+
+void AutoOperations::gemm(bool transA, bool transB, float alpha, const ConstMatrixView& a, const ConstMatrixView& b,
+                          float beta, MatrixView& c, const Epilogue& epilogue) const
+{
+    // The variant tuned for the product shape, gemm() itself is not tuned.
+    const int m = transA ? a.width() : a.height();
+    const int k = transA ? a.height() : a.width();
+    const int n = transB ? b.height() : b.width();
+
+    std::map<std::string, Choice>::iterator it = m_table.find(key(k, m, n));
+    GpuOperations* ops = it != m_table.end() ? candidate(it->second.variant) : NULL;
+    if (ops == NULL)
+    {
+        m_candidates[0].second->gemm(transA, transB, alpha, a, b, beta, c, epilogue);
+        return;
+    }
+
+    ops->setLocalWorkSize(it->second.localWorkSize[0], it->second.localWorkSize[1]);
+    ops->gemm(transA, transB, alpha, a, b, beta, c, epilogue);
+}
+
+bool AutoOperations::choice(int lhsWidth, int lhsHeight, int rhsWidth, Choice* result) const
+{
+    std::map<std::string, Choice>::const_iterator it = m_table.find(key(lhsWidth, lhsHeight, rhsWidth));
+    if (it == m_table.end())
+    {
+        return false;
+    }
+
+    *result = it->second;
+    return true;
+}
+
+void AutoOperations::setSpecialization(bool enabled)
+{
+    for (size_t i = 0; i < m_candidates.size(); i++)
+    {
+        m_candidates[i].second->setSpecialization(enabled);
+    }
+}
+
+std::string AutoOperations::key(int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    char shape[64];
+    snprintf(shape, sizeof(shape), "%d %d %d\t", lhsHeight, rhsWidth, lhsWidth);
+    return shape + m_device;
+}
+
+GpuOperations* AutoOperations::candidate(const std::string& variant) const
+{
+    for (size_t i = 0; i < m_candidates.size(); i++)
+    {
+        if (m_candidates[i].first == variant)
+        {
+            return m_candidates[i].second;
+        }
+    }
+
+    return NULL;
+}
+
+AutoOperations::Choice AutoOperations::tune(const Matrix& lhs, const Matrix& rhs) const
+{
+    // 0 x 0 lets the runtime pick, the rest are the usual 2D shapes.
+    static const size_t LOCAL_SIZES[][2] = {
+        { 0, 0 }, { 4, 4 }, { 8, 8 }, { 16, 8 }, { 16, 16 }, { 32, 4 }, { 32, 8 }, { 32, 32 }, { 64, 1 }
+    };
+    static const int TIMED_RUNS = 3;
+
+    Choice best;
+    best.seconds = -1.0;
+    best.localWorkSize[0] = best.localWorkSize[1] = 0;
+
+    for (size_t i = 0; i < m_candidates.size(); i++)
+    {
+        GpuOperations* ops = m_candidates[i].second;
+
+        for (size_t j = 0; j < sizeof(LOCAL_SIZES) / sizeof(LOCAL_SIZES[0]); j++)
+        {
+            const size_t x = LOCAL_SIZES[j][0];
+            const size_t y = LOCAL_SIZES[j][1];
+
+            try
+            {
+                if (!ops->acceptsLocalWorkSize(x, y, lhs.width(), lhs.height(), rhs.width()))
+                {
+                    continue;
+                }
+                ops->setLocalWorkSize(x, y);
+
+                // The first run creates kernels and buffers. Candidates far behind
+                // the best one so far are not worth the timed runs.
+                double seconds = timeMultiply(*ops, lhs, rhs);
+                if (best.seconds < 0.0 || seconds < 4.0 * best.seconds)
+                {
+                    for (int run = 0; run < TIMED_RUNS; run++)
+                    {
+                        seconds = std::min(seconds, timeMultiply(*ops, lhs, rhs));
+                    }
+                }
+
+                if (best.seconds < 0.0 || seconds < best.seconds)
+                {
+                    best.variant = m_candidates[i].first;
+                    best.localWorkSize[0] = x;
+                    best.localWorkSize[1] = y;
+                    best.seconds = seconds;
+                }
+            }
+            catch (const char*)
+            {
+                // This variant can not run the shape with this work-group size.
+            }
+        }
+
+        ops->setLocalWorkSize(0, 0);
+    }
+
+    if (best.seconds < 0.0)
+    {
+        throw "autotune fail";
+    }
+
+    return best;
+}
+
+// Table format, one choice per line (later lines win):
+//   M N K variant local_x local_y seconds<TAB>device
+
+void AutoOperations::loadTable(void)
+{
+    if (m_tableFile.empty())
+    {
+        return;
+    }
+
+    FILE* fp = fopen(m_tableFile.c_str(), "r");
+    if (!fp)
+    {
+        return;
+    }
+
+    char line[1024];
+    while (fgets(line, sizeof(line), fp))
+    {
+        int m, n, k;
+        char variant[64];
+        unsigned long localX, localY;
+        double seconds;
+        const char* device = strchr(line, '\t');
+        if (device == NULL
+            || sscanf(line, "%d %d %d %63s %lu %lu %lf", &m, &n, &k, variant, &localX, &localY, &seconds) != 7)
+        {
+            continue;
+        }
+
+        std::string deviceName(device + 1);
+        deviceName.erase(deviceName.find_last_not_of("\r\n") + 1);
+        if (deviceName != m_device)
+        {
+            continue;
+        }
+
+        Choice entry;
+        entry.variant = variant;
+        entry.localWorkSize[0] = localX;
+        entry.localWorkSize[1] = localY;
+        entry.seconds = seconds;
+        m_table[key(k, m, n)] = entry;
+    }
+
+    fclose(fp);
+}
+
+void AutoOperations::storeChoice(int lhsWidth, int lhsHeight, int rhsWidth, const Choice& choice) const
+{
+    if (m_tableFile.empty())
+    {
+        return;
+    }
+
+    const size_t slash = m_tableFile.rfind('/');
+    if (slash != std::string::npos && slash > 0 && !makeDirectories(m_tableFile.substr(0, slash)))
+    {
+        return;
+    }
+
+    // A single appended line, so concurrent runs do not clobber each other's entries.
+    FILE* fp = fopen(m_tableFile.c_str(), "a");
+    if (!fp)
+    {
+        return;
+    }
+
+    fprintf(fp, "%d %d %d %s %lu %lu %.9g\t%s\n",
+            lhsHeight, rhsWidth, lhsWidth,
+            choice.variant.c_str(),
+            (unsigned long)choice.localWorkSize[0],
+            (unsigned long)choice.localWorkSize[1],
+            choice.seconds,
+            m_device.c_str());
+    fclose(fp);
+}
@@ -0,0 +1,68 @@
+#ifndef _AUTO_OPERATIONS_HPP
+#define _AUTO_OPERATIONS_HPP
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "operations.hpp"
+
+// Dispatches every multiply to the fastest GPU variant and work-group size
+// for its (M, N, K) on the selected device.
+//
+// The first multiply of a shape not in the tuning table times every candidate
+// (variant x local size) on the actual inputs and records the winner. Winners
+// are appended to the table file, so later runs start already tuned. The
+// default file is tuning.txt in the program cache directory.
+class AutoOperations : public Operations
+{
+public:
+    struct Choice
+    {
+        std::string variant;
+        size_t localWorkSize[2];
+        double seconds;
+    };
+
+    // An empty tableFile keeps the table in memory only.
+    explicit AutoOperations(const std::string& tableFile = defaultTableFile());
+    virtual ~AutoOperations(void);
+
+    virtual Matrix multiply(const Matrix& lhs, const Matrix& rhs) const;
+    // A shape not tuned yet is tuned on copies of the views first.
+    virtual void multiplyInto(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView& result) const;
+    // Runs on the variant tuned for the (M, N, K) of the product, the first
+    // candidate for a shape not tuned yet; gemm() itself does not tune.
+    virtual void gemm(bool transA, bool transB, float alpha, const ConstMatrixView& a, const ConstMatrixView& b,
+                      float beta, MatrixView& c, const Epilogue& epilogue = Epilogue()) const;
+
+    // Tuned choice for the shape, false if it has not been tuned yet.
+    bool choice(int lhsWidth, int lhsHeight, int rhsWidth, Choice* result) const;
+
+    void setSpecialization(bool enabled);
+
+    const std::string& device(void) const { return m_device; }
+
+    static std::string defaultTableFile(void);
+
+private:
+    AutoOperations(const AutoOperations&);
+    AutoOperations& operator=(const AutoOperations&);
+
+    typedef std::pair<std::string, GpuOperations*> Candidate;
+
+    std::string key(int lhsWidth, int lhsHeight, int rhsWidth) const;
+    GpuOperations* candidate(const std::string& variant) const;
+    Choice tune(const Matrix& lhs, const Matrix& rhs) const;
+
+    void loadTable(void);
+    void storeChoice(int lhsWidth, int lhsHeight, int rhsWidth, const Choice& choice) const;
+
+    std::vector<Candidate> m_candidates;
+    std::string m_device;
+    std::string m_tableFile;
+    mutable std::map<std::string, Choice> m_table;
+};
+
+#endif // _AUTO_OPERATIONS_HPP
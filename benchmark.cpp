@@ -0,0 +1,628 @@
+#include "auto_operations.hpp"
+#include "gemm.hpp"
+#include "matrix.hpp"
+#include "operations.hpp"
+#include "precision.hpp"
+#include "profiler.hpp"
+#include "random.hpp"
+#include "verify.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Benchmark of the multiply engines, kept apart from the experiments in main.cpp.
+//
+// Every variant is created anew for every shape. Creating it and its first
+// multiply() are timed together as the cold start: device selection, context,
+// program build (or program cache lookup, run with OPENCL_MATRIX_MUL_CACHE=
+// for a real build), allocation, transfers and compute. After the warmup runs
+// every timed run is one multiplyInto() into a preallocated result, the steady
+// state. Throughput is computed from the median: 2MNK FLOP and the bytes of A,
+// B and C moved once.
+//
+// --verify checks the cold and the last steady state result with Freivalds'
+// test (see verify.hpp), O(n^2) per round and outside the timings, cheap
+// enough to leave on. --verify=full compares with a CPU reference product
+// instead, the error is then relative to max |C| and reported in ULPs too.
+//
+// Results go to stdout and optionally to JSON and CSV files. A CSV file of an
+// earlier run (another commit) can be given as a baseline, medians slower by
+// more than the threshold are reported and make the exit status 2.
+//
+// --trace records every GPU command and host build/allocation of the run into
+// a Chrome trace (chrome://tracing, Perfetto) and prints the time per phase.
+// Profiling queues add some overhead, compare timings of traced runs only with
+// each other.
+
+// C is m x n, the depth is k.
+struct Shape
+{
+    int m;
+    int n;
+    int k;
+};
+
+struct Result
+{
+    std::string variant;
+    Shape shape;
+    // Empty unless the variant failed (no device, build error, wrong result, ...).
+    std::string error;
+    double cold;
+    double min;
+    double median;
+    double p95;
+    double mean;
+    double gflops;
+    double gbps;
+    int runs;
+};
+
+enum VerifyMode
+{
+    VERIFY_NONE,
+    VERIFY_FREIVALDS,
+    VERIFY_FULL
+};
+
+struct Options
+{
+    Options(void)
+        : warmup(2)
+        , runs(10)
+        , verify(VERIFY_NONE)
+        , verifyRounds(2)
+        , tolerance(1e-5)
+        , threshold(10.0)
+    {}
+
+    std::vector<std::string> variants;
+    std::vector<Shape> shapes;
+    int warmup;
+    int runs;
+    VerifyMode verify;
+    int verifyRounds;
+    // Largest accepted error, relative to the term magnitude of an element for
+    // Freivalds' test, to max |C| of the CPU reference for a full check.
+    double tolerance;
+    std::string jsonFile;
+    std::string csvFile;
+    std::string baselineFile;
+    // Percent a median may grow over the baseline.
+    double threshold;
+    // Free text stored with the results, a commit id for example.
+    std::string label;
+    std::string traceFile;
+};
+
+static const char* VARIANTS[] = {
+    "cpu", "parallel", "gpu", "transposed", "dot", "float4", "constant",
+    "tiled", "block4x4", "block8x4", "fp16", "bf16", "auto",
+};
+
+// constant does not compute the product and auto tunes on its first call,
+// they only run when asked for.
+static const char* DEFAULT_VARIANTS = "cpu,gpu,transposed,dot,float4,tiled,block4x4,block8x4";
+// Square, rectangular and odd (not multiple of 4) shapes.
+static const char* DEFAULT_SHAPES = "256,512,1024,1023,1024x512x2048,4096x256x512,513x257x1031";
+
+static const size_t VARIANT_COUNT = sizeof(VARIANTS) / sizeof(VARIANTS[0]);
+
+static Operations* createVariant(const std::string& name)
+{
+    const size_t index = std::find(VARIANTS, VARIANTS + VARIANT_COUNT, name) - VARIANTS;
+    switch (index)
+    {
+        case 0: return new CpuOperations();
+        case 1: return new ParallelCpuOperations();
+        case 2: return new GpuOperations();
+        case 3: return new TransposedGpuOperations();
+        case 4: return new DotGpuOperations();
+        case 5: return new Float4GpuOperations();
+        case 6: return new ConstantGpuOperations();
+        case 7: return new TiledGpuOperations();
+        case 8: return new BlockedGpuOperations(4);
+        case 9: return new BlockedGpuOperations(8);
+        case 10: return new MixedPrecisionGpuOperations(STORAGE_FP16);
+        case 11: return new MixedPrecisionGpuOperations(STORAGE_BF16);
+        case 12: return new AutoOperations();
+        default: return NULL;
+    }
+}
+
+static std::vector<std::string> split(const std::string& text, char separator)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= text.size())
+    {
+        size_t end = text.find(separator, start);
+        if (end == std::string::npos)
+        {
+            end = text.size();
+        }
+        if (end > start)
+        {
+            items.push_back(text.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+
+    return items;
+}
+
+// "N" for N x N x N or "MxNxK".
+static bool parseShape(const std::string& text, Shape* shape)
+{
+    char rest;
+    if (sscanf(text.c_str(), "%dx%dx%d%c", &shape->m, &shape->n, &shape->k, &rest) == 3)
+    {
+        return shape->m > 0 && shape->n > 0 && shape->k > 0;
+    }
+    if (sscanf(text.c_str(), "%d%c", &shape->m, &rest) == 1)
+    {
+        shape->n = shape->m;
+        shape->k = shape->m;
+        return shape->m > 0;
+    }
+
+    return false;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    using namespace std::chrono;
+    return duration_cast<duration<double> >(steady_clock::now() - start).count();
+}
+
+// The q quantile (nearest rank) of sorted times.
+static double quantile(const std::vector<double>& sorted, double q)
+{
+    size_t rank = (size_t)ceil(q * sorted.size());
+    return sorted[std::max((size_t)1, std::min(rank, sorted.size())) - 1];
+}
+
+// The error of a result as the options ask, reference is NULL unless --verify=full.
+static std::string verifyResult(const Matrix& lhs, const Matrix& rhs, const Matrix& result, const Matrix* reference,
+                                const Options& options)
+{
+    char message[96] = "";
+    if (options.verify == VERIFY_FREIVALDS)
+    {
+        const double error = freivaldsError<float>(lhs, rhs, result, options.verifyRounds);
+        if (!(error <= options.tolerance))
+        {
+            snprintf(message, sizeof(message), "mismatch (Freivalds error %.3e)", error);
+        }
+    }
+    else if (reference != NULL)
+    {
+        const double error = maxRelativeError<float>(result, *reference);
+        if (!(error <= options.tolerance))
+        {
+            snprintf(message, sizeof(message), "mismatch (error %.3e, %llu ulp)",
+                     error, (unsigned long long)maxUlpDistance<float>(result, *reference));
+        }
+    }
+
+    return message;
+}
+
+// reference is NULL unless --verify=full.
+static Result runVariant(const std::string& name, const Shape& shape, const Matrix& lhs, const Matrix& rhs,
+                         const Matrix* reference, const Options& options)
+{
+    using namespace std::chrono;
+
+    Result result;
+    result.variant = name;
+    result.shape = shape;
+    result.cold = result.min = result.median = result.p95 = result.mean = 0.0;
+    result.gflops = result.gbps = 0.0;
+    result.runs = 0;
+
+    try
+    {
+        steady_clock::time_point start = steady_clock::now();
+        std::unique_ptr<Operations> op(createVariant(name));
+        const Matrix first = op->multiply(lhs, rhs);
+        result.cold = secondsSince(start);
+
+        Matrix product = Matrix::uninitialized(shape.n, shape.m);
+        MatrixView view = product.view();
+        for (int i = 0; i < options.warmup; i++)
+        {
+            op->multiplyInto(lhs, rhs, view);
+        }
+
+        std::vector<double> times(options.runs);
+        for (int i = 0; i < options.runs; i++)
+        {
+            start = steady_clock::now();
+            op->multiplyInto(lhs, rhs, view);
+            times[i] = secondsSince(start);
+        }
+
+        std::sort(times.begin(), times.end());
+        result.runs = options.runs;
+        result.min = times.front();
+        result.median = quantile(times, 0.5);
+        result.p95 = quantile(times, 0.95);
+        double sum = 0.0;
+        for (size_t i = 0; i < times.size(); i++)
+        {
+            sum += times[i];
+        }
+        result.mean = sum / times.size();
+
+        const double flops = 2.0 * shape.m * shape.n * shape.k;
+        const double bytes = sizeof(float) * ((double)shape.m * shape.k + (double)shape.k * shape.n + (double)shape.m * shape.n);
+        result.gflops = flops / result.median * 1e-9;
+        result.gbps = bytes / result.median * 1e-9;
+
+        result.error = verifyResult(lhs, rhs, first, reference, options);
+        if (result.error.empty())
+        {
+            result.error = verifyResult(lhs, rhs, product, reference, options);
+        }
+    }
+    catch (const char* error)
+    {
+        result.error = error;
+    }
+    catch (const std::exception& error)
+    {
+        // std::bad_alloc from a matrix allocation and the like.
+        result.error = error.what();
+    }
+
+    return result;
+}
+
+static std::string jsonString(const std::string& text)
+{
+    std::string quoted = "\"";
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        if (text[i] == '"' || text[i] == '\\')
+        {
+            quoted += '\\';
+        }
+        quoted += text[i];
+    }
+
+    return quoted + "\"";
+}
+
+static bool writeJson(const std::string& filename, const std::vector<Result>& results, const Options& options)
+{
+    FILE* file = fopen(filename.c_str(), "w");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"label\": %s,\n", jsonString(options.label).c_str());
+    fprintf(file, "  \"cpu_kernel\": %s,\n", jsonString(sgemmKernelName()).c_str());
+    fprintf(file, "  \"warmup\": %d,\n", options.warmup);
+    fprintf(file, "  \"runs\": %d,\n", options.runs);
+    fprintf(file, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+        fprintf(file, "    { \"variant\": %s, \"m\": %d, \"n\": %d, \"k\": %d, "
+                      "\"cold_s\": %.9f, \"min_s\": %.9f, \"median_s\": %.9f, \"p95_s\": %.9f, \"mean_s\": %.9f, "
+                      "\"gflops\": %.3f, \"gbps\": %.3f, \"error\": %s }%s\n",
+                jsonString(r.variant).c_str(), r.shape.m, r.shape.n, r.shape.k,
+                r.cold, r.min, r.median, r.p95, r.mean, r.gflops, r.gbps,
+                r.error.empty() ? "null" : jsonString(r.error).c_str(),
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    return fclose(file) == 0;
+}
+
+// An RFC 4180 field: quoted, with embedded quotes doubled, so commas and
+// quotes in an error message keep the columns in place.
+static std::string csvString(const std::string& text)
+{
+    std::string quoted = "\"";
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        if (text[i] == '"')
+        {
+            quoted += '"';
+        }
+        quoted += text[i];
+    }
+
+    return quoted + "\"";
+}
+
+static const char* CSV_HEADER = "variant,m,n,k,cold_s,min_s,median_s,p95_s,mean_s,gflops,gbps,error";
+
+static bool writeCsv(const std::string& filename, const std::vector<Result>& results)
+{
+    FILE* file = fopen(filename.c_str(), "w");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    fprintf(file, "%s\n", CSV_HEADER);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+        fprintf(file, "%s,%d,%d,%d,%.9f,%.9f,%.9f,%.9f,%.9f,%.3f,%.3f,%s\n",
+                r.variant.c_str(), r.shape.m, r.shape.n, r.shape.k,
+                r.cold, r.min, r.median, r.p95, r.mean, r.gflops, r.gbps,
+                r.error.empty() ? "" : csvString(r.error).c_str());
+    }
+
+    return fclose(file) == 0;
+}
+
+static std::string resultKey(const std::string& variant, int m, int n, int k)
+{
+    char key[128];
+    snprintf(key, sizeof(key), "%s %dx%dx%d", variant.c_str(), m, n, k);
+    return key;
+}
+
+// Medians of the successful runs in a CSV file written by writeCsv().
+static bool readBaseline(const std::string& filename, std::map<std::string, double>* medians)
+{
+    FILE* file = fopen(filename.c_str(), "r");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char variant[64];
+        int m, n, k;
+        double cold, min, median, p95, mean, gflops, gbps;
+        int end = 0;
+        if (sscanf(line, "%63[^,],%d,%d,%d,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%n",
+                   variant, &m, &n, &k, &cold, &min, &median, &p95, &mean, &gflops, &gbps, &end) == 11
+            && (line[end] == '\n' || line[end] == '\0'))
+        {
+            (*medians)[resultKey(variant, m, n, k)] = median;
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+static void usage(const char* program)
+{
+    printf("Usage: %s [--variants=<name,...>|all] [--shapes=<N|MxNxK,...>] [--warmup=<runs>] [--runs=<runs>]\n"
+           "          [--verify[=full]] [--verify-rounds=<rounds>] [--tolerance=<relative error>]\n"
+           "          [--json=<file>] [--csv=<file>] [--baseline=<csv file>] [--threshold=<percent>] [--label=<text>]\n"
+           "          [--trace=<chrome trace file>]\n", program);
+    printf("Variants:");
+    for (size_t i = 0; i < VARIANT_COUNT; i++)
+    {
+        printf(" %s", VARIANTS[i]);
+    }
+    printf("\nDefaults: --variants=%s --shapes=%s --warmup=2 --runs=10\n", DEFAULT_VARIANTS, DEFAULT_SHAPES);
+}
+
+static bool parseOptions(int argc, char** argv, Options* options)
+{
+    std::string variants = DEFAULT_VARIANTS;
+    std::string shapes = DEFAULT_SHAPES;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        if (strncmp("--variants=", arg, 11) == 0)
+        {
+            variants = arg + 11;
+        }
+        else if (strncmp("--shapes=", arg, 9) == 0)
+        {
+            shapes = arg + 9;
+        }
+        else if (strncmp("--warmup=", arg, 9) == 0)
+        {
+            options->warmup = std::max(0, atoi(arg + 9));
+        }
+        else if (strncmp("--runs=", arg, 7) == 0)
+        {
+            options->runs = std::max(1, atoi(arg + 7));
+        }
+        else if (strcmp("--verify", arg) == 0)
+        {
+            options->verify = VERIFY_FREIVALDS;
+        }
+        else if (strcmp("--verify=full", arg) == 0)
+        {
+            options->verify = VERIFY_FULL;
+        }
+        else if (strncmp("--verify-rounds=", arg, 16) == 0)
+        {
+            options->verifyRounds = std::max(1, atoi(arg + 16));
+        }
+        else if (strncmp("--tolerance=", arg, 12) == 0)
+        {
+            options->tolerance = atof(arg + 12);
+        }
+        else if (strncmp("--json=", arg, 7) == 0)
+        {
+            options->jsonFile = arg + 7;
+        }
+        else if (strncmp("--csv=", arg, 6) == 0)
+        {
+            options->csvFile = arg + 6;
+        }
+        else if (strncmp("--baseline=", arg, 11) == 0)
+        {
+            options->baselineFile = arg + 11;
+        }
+        else if (strncmp("--threshold=", arg, 12) == 0)
+        {
+            options->threshold = atof(arg + 12);
+        }
+        else if (strncmp("--label=", arg, 8) == 0)
+        {
+            options->label = arg + 8;
+        }
+        else if (strncmp("--trace=", arg, 8) == 0)
+        {
+            options->traceFile = arg + 8;
+        }
+        else
+        {
+            printf("Unknown option: %s\n", arg);
+            return false;
+        }
+    }
+
+    if (variants == "all")
+    {
+        options->variants.assign(VARIANTS, VARIANTS + VARIANT_COUNT);
+    }
+    else
+    {
+        options->variants = split(variants, ',');
+    }
+
+    for (size_t i = 0; i < options->variants.size(); i++)
+    {
+        if (std::find(VARIANTS, VARIANTS + VARIANT_COUNT, options->variants[i]) == VARIANTS + VARIANT_COUNT)
+        {
+            printf("Unknown variant: %s\n", options->variants[i].c_str());
+            return false;
+        }
+    }
+
+    const std::vector<std::string> shapeItems = split(shapes, ',');
+    for (size_t i = 0; i < shapeItems.size(); i++)
+    {
+        Shape shape;
+        if (!parseShape(shapeItems[i], &shape))
+        {
+            printf("Invalid shape: %s\n", shapeItems[i].c_str());
+            return false;
+        }
+        options->shapes.push_back(shape);
+    }
+
+    return !options->variants.empty() && !options->shapes.empty();
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, &options))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::map<std::string, double> baseline;
+    if (!options.baselineFile.empty() && !readBaseline(options.baselineFile, &baseline))
+    {
+        printf("Cannot read baseline %s\n", options.baselineFile.c_str());
+        return 1;
+    }
+
+    // Installed before any variant exists, engines pick it up on construction.
+    std::unique_ptr<Profiler> profiler;
+    if (!options.traceFile.empty())
+    {
+        profiler.reset(new Profiler());
+        Profiler::install(profiler.get());
+    }
+
+    bool failed = false;
+    std::vector<Result> results;
+    for (size_t s = 0; s < options.shapes.size(); s++)
+    {
+        const Shape& shape = options.shapes[s];
+        // Small integers: every summation order gives the exact product.
+        const Matrix lhs = randomMatrix(shape.k, shape.m, 2 * s + 1, RandomDistribution::integer(4));
+        const Matrix rhs = randomMatrix(shape.n, shape.k, 2 * s + 2, RandomDistribution::integer(4));
+
+        std::unique_ptr<Matrix> reference;
+        if (options.verify == VERIFY_FULL)
+        {
+            reference.reset(new Matrix(CpuOperations().multiply(lhs, rhs)));
+        }
+
+        for (size_t v = 0; v < options.variants.size(); v++)
+        {
+            const Result result = runVariant(options.variants[v], shape, lhs, rhs, reference.get(), options);
+            results.push_back(result);
+
+            printf("%-10s %5dx%5dx%5d  cold %10.6f  min %10.6f  median %10.6f  p95 %10.6f  %8.2f GFLOP/s  %7.2f GB/s",
+                    result.variant.c_str(), shape.m, shape.n, shape.k,
+                    result.cold, result.min, result.median, result.p95, result.gflops, result.gbps);
+            if (!result.error.empty())
+            {
+                printf("  [%s]", result.error.c_str());
+                failed = true;
+            }
+
+            std::map<std::string, double>::const_iterator previous = baseline.find(resultKey(result.variant, shape.m, shape.n, shape.k));
+            if (previous != baseline.end() && result.error.empty())
+            {
+                const double change = (result.median / previous->second - 1.0) * 100.0;
+                printf("  %+.1f%%", change);
+                if (change > options.threshold)
+                {
+                    printf(" REGRESSION");
+                    failed = true;
+                }
+            }
+            printf("\n");
+        }
+    }
+
+    if (!options.jsonFile.empty() && !writeJson(options.jsonFile, results, options))
+    {
+        printf("Cannot write %s\n", options.jsonFile.c_str());
+        return 1;
+    }
+    if (!options.csvFile.empty() && !writeCsv(options.csvFile, results))
+    {
+        printf("Cannot write %s\n", options.csvFile.c_str());
+        return 1;
+    }
+
+    if (profiler)
+    {
+        Profiler::install(NULL);
+
+        const std::map<std::string, double> totals = profiler->totals();
+        printf("Time per phase:\n");
+        for (std::map<std::string, double>::const_iterator it = totals.begin(); it != totals.end(); ++it)
+        {
+            printf("  %-32s %12.6f s\n", it->first.c_str(), it->second);
+        }
+
+        if (!profiler->writeChromeTrace(options.traceFile))
+        {
+            printf("Cannot write %s\n", options.traceFile.c_str());
+            return 1;
+        }
+    }
+
+    return failed ? 2 : 0;
+}
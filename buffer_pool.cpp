@@ -0,0 +1,201 @@
+#include "buffer_pool.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+static const size_t SLAB_SIZE = 32 * 1024 * 1024;
+static const size_t MIN_CLASS_SIZE = 4096;
+
+BufferPool::BufferPool(cl_context context, cl_device_id device)
+    : m_context(context)
+    , m_alignment(MIN_CLASS_SIZE)
+    , m_slabSize(SLAB_SIZE)
+    , m_useSlabs(true)
+    , m_slabOffset(0)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    // Sub-buffer origins have to be aligned to the device base address alignment (given in bits).
+    cl_uint alignBits = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(alignBits), &alignBits, NULL);
+    m_alignment = std::max(m_alignment, (size_t)alignBits / 8);
+
+    cl_ulong maxAllocSize = 0;
+    clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAllocSize), &maxAllocSize, NULL);
+    m_slabSize = std::min(m_slabSize, (size_t)maxAllocSize);
+    m_useSlabs = m_slabSize >= 8 * MIN_CLASS_SIZE;
+}
+
+BufferPool::~BufferPool(void)
+{
+    // Sub-buffers go before the slabs they were carved from.
+    for (std::map<cl_mem, Entry>::iterator it = m_owned.begin(); it != m_owned.end(); ++it)
+    {
+        clReleaseMemObject(it->first);
+    }
+
+    for (size_t i = 0; i < m_slabs.size(); i++)
+    {
+        clReleaseMemObject(m_slabs[i]);
+    }
+}
+
+size_t BufferPool::sizeClass(size_t size)
+{
+    if (size <= MIN_CLASS_SIZE)
+    {
+        return MIN_CLASS_SIZE;
+    }
+
+    // Four classes per power of two keep the rounding waste under 25%.
+    size_t power = MIN_CLASS_SIZE;
+    while (power * 2 <= size)
+    {
+        power *= 2;
+    }
+
+    const size_t step = power / 4;
+    return (size + step - 1) / step * step;
+}
+
+cl_mem BufferPool::acquire(size_t size)
+{
+    const size_t bytes = sizeClass(size);
+
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    std::map<size_t, std::vector<cl_mem> >::iterator it = m_free.find(bytes);
+    if (it != m_free.end() && !it->second.empty())
+    {
+        cl_mem buffer = it->second.back();
+        it->second.pop_back();
+
+        m_stats.hits++;
+        m_stats.cachedBytes -= bytes;
+        return buffer;
+    }
+
+    m_stats.misses++;
+
+    Entry entry = { bytes, false };
+    cl_mem buffer = allocate(bytes, &entry.fromSlab);
+    m_owned[buffer] = entry;
+
+    return buffer;
+}
+
+void BufferPool::release(cl_mem buffer)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    std::map<cl_mem, Entry>::iterator it = m_owned.find(buffer);
+    if (it == m_owned.end())
+    {
+        // Not one of ours.
+        clReleaseMemObject(buffer);
+        return;
+    }
+
+    m_free[it->second.size].push_back(buffer);
+    m_stats.cachedBytes += it->second.size;
+}
+
+void BufferPool::trim(void)
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    trimLocked();
+}
+
+BufferPool::Stats BufferPool::stats(void) const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    return m_stats;
+}
+
+void BufferPool::trimLocked(void)
+{
+    // Slab space is never handed back, so only stand-alone buffers are worth freeing.
+    for (std::map<size_t, std::vector<cl_mem> >::iterator it = m_free.begin(); it != m_free.end(); ++it)
+    {
+        std::vector<cl_mem>& buffers = it->second;
+        for (size_t i = 0; i < buffers.size(); )
+        {
+            std::map<cl_mem, Entry>::iterator owned = m_owned.find(buffers[i]);
+            if (owned->second.fromSlab)
+            {
+                i++;
+                continue;
+            }
+
+            m_stats.cachedBytes -= owned->second.size;
+            m_stats.allocatedBytes -= owned->second.size;
+            clReleaseMemObject(buffers[i]);
+            m_owned.erase(owned);
+            buffers[i] = buffers.back();
+            buffers.pop_back();
+        }
+    }
+}
+
+cl_mem BufferPool::allocate(size_t size, bool* fromSlab)
+{
+    if (m_useSlabs && size <= m_slabSize / 8)
+    {
+        cl_mem buffer = allocateFromSlab(size);
+        if (buffer != NULL)
+        {
+            *fromSlab = true;
+            return buffer;
+        }
+    }
+
+    *fromSlab = false;
+
+    cl_int error;
+    cl_mem buffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, size, NULL, &error);
+    if (error != CL_SUCCESS)
+    {
+        // The free lists may be holding the memory we need.
+        trimLocked();
+        buffer = clCreateBuffer(m_context, CL_MEM_READ_WRITE, size, NULL, &error);
+    }
+    if (error != CL_SUCCESS)
+    {
+        throw "upload buffer fail";
+    }
+
+    m_stats.allocatedBytes += size;
+    return buffer;
+}
+
+cl_mem BufferPool::allocateFromSlab(size_t size)
+{
+    cl_int error;
+    size_t offset = (m_slabOffset + m_alignment - 1) / m_alignment * m_alignment;
+
+    if (m_slabs.empty() || offset + size > m_slabSize)
+    {
+        cl_mem slab = clCreateBuffer(m_context, CL_MEM_READ_WRITE, m_slabSize, NULL, &error);
+        if (error != CL_SUCCESS)
+        {
+            return NULL;
+        }
+
+        m_slabs.push_back(slab);
+        m_stats.slabs++;
+        m_stats.allocatedBytes += m_slabSize;
+        offset = 0;
+    }
+
+    cl_buffer_region region = { offset, size };
+    cl_mem buffer = clCreateSubBuffer(m_slabs.back(), CL_MEM_READ_WRITE, CL_BUFFER_CREATE_TYPE_REGION, &region, &error);
+    if (error != CL_SUCCESS)
+    {
+        // No sub-buffer support (or no luck with this region), stop carving.
+        m_useSlabs = false;
+        return NULL;
+    }
+
+    m_slabOffset = offset + size;
+    return buffer;
+}
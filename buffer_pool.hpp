@@ -0,0 +1,106 @@
+#ifndef _BUFFER_POOL_HPP
+#define _BUFFER_POOL_HPP
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "mem.hpp"
+
+// Pool of device buffers reused across multiplies.
+//
+// Requests are rounded up to a size class (four classes per power of two) and
+// released buffers are kept on a free list per class. Small classes are carved
+// out of large slabs with clCreateSubBuffer when the device supports it, larger
+// ones get a buffer of their own.
+class BufferPool
+{
+public:
+    struct Stats
+    {
+        size_t hits;
+        size_t misses;
+        size_t slabs;
+        size_t allocatedBytes;
+        size_t cachedBytes;
+    };
+
+    BufferPool(cl_context context, cl_device_id device);
+    ~BufferPool(void);
+
+    // Buffer of at least size bytes, taken from the free list when possible.
+    cl_mem acquire(size_t size);
+    // Returns a buffer obtained from acquire() to its free list.
+    void release(cl_mem buffer);
+
+    // Frees every buffer on the free lists (slabs stay alive).
+    void trim(void);
+
+    Stats stats(void) const;
+
+    static size_t sizeClass(size_t size);
+
+private:
+    BufferPool(const BufferPool&);
+    BufferPool& operator=(const BufferPool&);
+
+    struct Entry
+    {
+        size_t size;
+        bool fromSlab;
+    };
+
+    cl_mem allocate(size_t size, bool* fromSlab);
+    cl_mem allocateFromSlab(size_t size);
+    void trimLocked(void);
+
+    cl_context m_context;
+    size_t m_alignment;
+    size_t m_slabSize;
+    bool m_useSlabs;
+
+    std::vector<cl_mem> m_slabs;
+    size_t m_slabOffset;
+
+    std::map<cl_mem, Entry> m_owned;
+    std::map<size_t, std::vector<cl_mem> > m_free;
+
+    mutable std::mutex m_lock;
+    Stats m_stats;
+};
+
+// Buffer borrowed from a BufferPool, handed back on destruction.
+class PooledBuffer
+{
+public:
+    PooledBuffer(BufferPool& pool, size_t size)
+        : m_pool(&pool)
+        , m_data(pool.acquire(size))
+    {}
+
+    PooledBuffer(PooledBuffer&& other)
+        : m_pool(other.m_pool)
+        , m_data(other.m_data)
+    {
+        other.m_data = NULL;
+    }
+
+    ~PooledBuffer(void)
+    {
+        if (m_data != NULL)
+        {
+            m_pool->release(m_data);
+        }
+    }
+
+    cl_mem get(void) const { return m_data; }
+
+private:
+    PooledBuffer(const PooledBuffer&);
+    PooledBuffer& operator=(const PooledBuffer&);
+
+    BufferPool* m_pool;
+    cl_mem m_data;
+};
+
+#endif // _BUFFER_POOL_HPP
@@ -0,0 +1,785 @@
+#include "gemm.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GEMM_X86 1
+#include <immintrin.h>
+#endif
+
+// The engine follows the usual Goto/BLIS structure:
+//
+//  for jc in N step NC          B panel (KC x NC) lives in L3
+//    for pc in K step KC        packed into NR wide micro-panels
+//      for ic in M step MC      A block (MC x KC) lives in L2
+//        for jr, ir             micro-kernel computes an MR x NR tile of C
+//                               with the whole tile held in registers
+//
+// The micro-kernels continue the accumulation already in C for every KC block
+// after the first, so each element of C is summed in plain k order.
+//
+// The AVX2 and AVX-512 micro-kernels accumulate with fused multiply-adds, like
+// the OpenCL kernels, so on hosts with hardware FMA the result matches a device
+// computing in the same order bit for bit. The AVX and SSE kernels of older
+// hosts round the multiply and the add separately (emulating fma would make
+// them slower than a naive loop), so there the result differs from the device
+// in the last bits. The generic kernel uses fma where the compiler target has
+// it in hardware.
+
+// Everything below is a template on the element type, instantiated for float
+// (sgemm) and double (dgemm). Each type has its own micro-kernels, so a tile
+// always fills the vector registers of the selected instruction set.
+template<typename T>
+struct MicroKernel
+{
+    const char* name;
+    int mr;
+    int nr;
+    void (*run)(int kc, const T* a, const T* b, T* c, int ldc, bool accumulate);
+};
+
+struct Blocking
+{
+    int mc;
+    int kc;
+    int nc;
+};
+
+// Micro-kernels
+
+// c + a * b, fused where the compiler target does that in hardware.
+static inline float multiplyAdd(float a, float b, float c)
+{
+#ifdef FP_FAST_FMAF
+    return std::fma(a, b, c);
+#else
+    return c + a * b;
+#endif
+}
+
+static inline double multiplyAdd(double a, double b, double c)
+{
+#ifdef FP_FAST_FMA
+    return std::fma(a, b, c);
+#else
+    return c + a * b;
+#endif
+}
+
+template<typename T>
+static void kernelGeneric(int kc, const T* a, const T* b, T* c, int ldc, bool accumulate)
+{
+    T acc[4][4];
+    for (int i = 0; i < 4; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            acc[i][j] = accumulate ? c[(size_t)i * ldc + j] : T(0);
+        }
+    }
+
+    for (int p = 0; p < kc; p++, a += 4, b += 4)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                acc[i][j] = multiplyAdd(a[i], b[j], acc[i][j]);
+            }
+        }
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        for (int j = 0; j < 4; j++)
+        {
+            c[(size_t)i * ldc + j] = acc[i][j];
+        }
+    }
+}
+
+#ifdef GEMM_X86
+
+// float: 4 x 8 tile, two xmm accumulators per row.
+__attribute__((target("sse2")))
+static void kernelSse(int kc, const float* a, const float* b, float* c, int ldc, bool accumulate)
+{
+#define SSE_INIT(i) \
+    __m128 c##i##0 = accumulate ? _mm_loadu_ps(c + (size_t)i * ldc) : _mm_setzero_ps(); \
+    __m128 c##i##1 = accumulate ? _mm_loadu_ps(c + (size_t)i * ldc + 4) : _mm_setzero_ps();
+#define SSE_STEP(i) \
+    ai = _mm_set1_ps(a[i]); \
+    c##i##0 = _mm_add_ps(c##i##0, _mm_mul_ps(ai, b0)); \
+    c##i##1 = _mm_add_ps(c##i##1, _mm_mul_ps(ai, b1));
+#define SSE_STORE(i) \
+    _mm_storeu_ps(c + (size_t)i * ldc, c##i##0); \
+    _mm_storeu_ps(c + (size_t)i * ldc + 4, c##i##1);
+
+    SSE_INIT(0) SSE_INIT(1) SSE_INIT(2) SSE_INIT(3)
+
+    for (int p = 0; p < kc; p++, a += 4, b += 8)
+    {
+        const __m128 b0 = _mm_load_ps(b);
+        const __m128 b1 = _mm_load_ps(b + 4);
+        __m128 ai;
+        SSE_STEP(0) SSE_STEP(1) SSE_STEP(2) SSE_STEP(3)
+    }
+
+    SSE_STORE(0) SSE_STORE(1) SSE_STORE(2) SSE_STORE(3)
+
+#undef SSE_INIT
+#undef SSE_STEP
+#undef SSE_STORE
+}
+
+// float: 6 x 16 tile like the AVX2 kernel, for AVX hosts without FMA.
+__attribute__((target("avx")))
+static void kernelAvx(int kc, const float* a, const float* b, float* c, int ldc, bool accumulate)
+{
+#define AVX_INIT(i) \
+    __m256 c##i##0 = accumulate ? _mm256_loadu_ps(c + (size_t)i * ldc) : _mm256_setzero_ps(); \
+    __m256 c##i##1 = accumulate ? _mm256_loadu_ps(c + (size_t)i * ldc + 8) : _mm256_setzero_ps();
+#define AVX_STEP(i) \
+    ai = _mm256_broadcast_ss(a + i); \
+    c##i##0 = _mm256_add_ps(c##i##0, _mm256_mul_ps(ai, b0)); \
+    c##i##1 = _mm256_add_ps(c##i##1, _mm256_mul_ps(ai, b1));
+#define AVX_STORE(i) \
+    _mm256_storeu_ps(c + (size_t)i * ldc, c##i##0); \
+    _mm256_storeu_ps(c + (size_t)i * ldc + 8, c##i##1);
+
+    AVX_INIT(0) AVX_INIT(1) AVX_INIT(2) AVX_INIT(3) AVX_INIT(4) AVX_INIT(5)
+
+    for (int p = 0; p < kc; p++, a += 6, b += 16)
+    {
+        const __m256 b0 = _mm256_load_ps(b);
+        const __m256 b1 = _mm256_load_ps(b + 8);
+        __m256 ai;
+        AVX_STEP(0) AVX_STEP(1) AVX_STEP(2) AVX_STEP(3) AVX_STEP(4) AVX_STEP(5)
+    }
+
+    AVX_STORE(0) AVX_STORE(1) AVX_STORE(2) AVX_STORE(3) AVX_STORE(4) AVX_STORE(5)
+
+#undef AVX_INIT
+#undef AVX_STEP
+#undef AVX_STORE
+}
+
+// float: 6 x 16 tile, two ymm accumulators per row (12 of the 16 registers).
+__attribute__((target("avx2,fma")))
+static void kernelAvx2(int kc, const float* a, const float* b, float* c, int ldc, bool accumulate)
+{
+#define AVX2_INIT(i) \
+    __m256 c##i##0 = accumulate ? _mm256_loadu_ps(c + (size_t)i * ldc) : _mm256_setzero_ps(); \
+    __m256 c##i##1 = accumulate ? _mm256_loadu_ps(c + (size_t)i * ldc + 8) : _mm256_setzero_ps();
+#define AVX2_STEP(i) \
+    ai = _mm256_broadcast_ss(a + i); \
+    c##i##0 = _mm256_fmadd_ps(ai, b0, c##i##0); \
+    c##i##1 = _mm256_fmadd_ps(ai, b1, c##i##1);
+#define AVX2_STORE(i) \
+    _mm256_storeu_ps(c + (size_t)i * ldc, c##i##0); \
+    _mm256_storeu_ps(c + (size_t)i * ldc + 8, c##i##1);
+
+    AVX2_INIT(0) AVX2_INIT(1) AVX2_INIT(2) AVX2_INIT(3) AVX2_INIT(4) AVX2_INIT(5)
+
+    for (int p = 0; p < kc; p++, a += 6, b += 16)
+    {
+        const __m256 b0 = _mm256_load_ps(b);
+        const __m256 b1 = _mm256_load_ps(b + 8);
+        __m256 ai;
+        AVX2_STEP(0) AVX2_STEP(1) AVX2_STEP(2) AVX2_STEP(3) AVX2_STEP(4) AVX2_STEP(5)
+    }
+
+    AVX2_STORE(0) AVX2_STORE(1) AVX2_STORE(2) AVX2_STORE(3) AVX2_STORE(4) AVX2_STORE(5)
+
+#undef AVX2_INIT
+#undef AVX2_STEP
+#undef AVX2_STORE
+}
+
+// float: 12 x 32 tile, two zmm accumulators per row (24 of the 32 registers).
+__attribute__((target("avx512f")))
+static void kernelAvx512(int kc, const float* a, const float* b, float* c, int ldc, bool accumulate)
+{
+#define AVX512_INIT(i) \
+    __m512 c##i##0 = accumulate ? _mm512_loadu_ps(c + (size_t)i * ldc) : _mm512_setzero_ps(); \
+    __m512 c##i##1 = accumulate ? _mm512_loadu_ps(c + (size_t)i * ldc + 16) : _mm512_setzero_ps();
+#define AVX512_STEP(i) \
+    ai = _mm512_set1_ps(a[i]); \
+    c##i##0 = _mm512_fmadd_ps(ai, b0, c##i##0); \
+    c##i##1 = _mm512_fmadd_ps(ai, b1, c##i##1);
+#define AVX512_STORE(i) \
+    _mm512_storeu_ps(c + (size_t)i * ldc, c##i##0); \
+    _mm512_storeu_ps(c + (size_t)i * ldc + 16, c##i##1);
+
+    AVX512_INIT(0) AVX512_INIT(1) AVX512_INIT(2) AVX512_INIT(3) AVX512_INIT(4) AVX512_INIT(5)
+    AVX512_INIT(6) AVX512_INIT(7) AVX512_INIT(8) AVX512_INIT(9) AVX512_INIT(10) AVX512_INIT(11)
+
+    for (int p = 0; p < kc; p++, a += 12, b += 32)
+    {
+        const __m512 b0 = _mm512_load_ps(b);
+        const __m512 b1 = _mm512_load_ps(b + 16);
+        __m512 ai;
+        AVX512_STEP(0) AVX512_STEP(1) AVX512_STEP(2) AVX512_STEP(3) AVX512_STEP(4) AVX512_STEP(5)
+        AVX512_STEP(6) AVX512_STEP(7) AVX512_STEP(8) AVX512_STEP(9) AVX512_STEP(10) AVX512_STEP(11)
+    }
+
+    AVX512_STORE(0) AVX512_STORE(1) AVX512_STORE(2) AVX512_STORE(3) AVX512_STORE(4) AVX512_STORE(5)
+    AVX512_STORE(6) AVX512_STORE(7) AVX512_STORE(8) AVX512_STORE(9) AVX512_STORE(10) AVX512_STORE(11)
+
+#undef AVX512_INIT
+#undef AVX512_STEP
+#undef AVX512_STORE
+}
+
+// double: 4 x 4 tile, two xmm accumulators per row.
+__attribute__((target("sse2")))
+static void kernelSseDouble(int kc, const double* a, const double* b, double* c, int ldc, bool accumulate)
+{
+#define SSE_INIT(i) \
+    __m128d c##i##0 = accumulate ? _mm_loadu_pd(c + (size_t)i * ldc) : _mm_setzero_pd(); \
+    __m128d c##i##1 = accumulate ? _mm_loadu_pd(c + (size_t)i * ldc + 2) : _mm_setzero_pd();
+#define SSE_STEP(i) \
+    ai = _mm_set1_pd(a[i]); \
+    c##i##0 = _mm_add_pd(c##i##0, _mm_mul_pd(ai, b0)); \
+    c##i##1 = _mm_add_pd(c##i##1, _mm_mul_pd(ai, b1));
+#define SSE_STORE(i) \
+    _mm_storeu_pd(c + (size_t)i * ldc, c##i##0); \
+    _mm_storeu_pd(c + (size_t)i * ldc + 2, c##i##1);
+
+    SSE_INIT(0) SSE_INIT(1) SSE_INIT(2) SSE_INIT(3)
+
+    for (int p = 0; p < kc; p++, a += 4, b += 4)
+    {
+        const __m128d b0 = _mm_load_pd(b);
+        const __m128d b1 = _mm_load_pd(b + 2);
+        __m128d ai;
+        SSE_STEP(0) SSE_STEP(1) SSE_STEP(2) SSE_STEP(3)
+    }
+
+    SSE_STORE(0) SSE_STORE(1) SSE_STORE(2) SSE_STORE(3)
+
+#undef SSE_INIT
+#undef SSE_STEP
+#undef SSE_STORE
+}
+
+// double: 6 x 8 tile like the AVX2 kernel, for AVX hosts without FMA.
+__attribute__((target("avx")))
+static void kernelAvxDouble(int kc, const double* a, const double* b, double* c, int ldc, bool accumulate)
+{
+#define AVX_INIT(i) \
+    __m256d c##i##0 = accumulate ? _mm256_loadu_pd(c + (size_t)i * ldc) : _mm256_setzero_pd(); \
+    __m256d c##i##1 = accumulate ? _mm256_loadu_pd(c + (size_t)i * ldc + 4) : _mm256_setzero_pd();
+#define AVX_STEP(i) \
+    ai = _mm256_broadcast_sd(a + i); \
+    c##i##0 = _mm256_add_pd(c##i##0, _mm256_mul_pd(ai, b0)); \
+    c##i##1 = _mm256_add_pd(c##i##1, _mm256_mul_pd(ai, b1));
+#define AVX_STORE(i) \
+    _mm256_storeu_pd(c + (size_t)i * ldc, c##i##0); \
+    _mm256_storeu_pd(c + (size_t)i * ldc + 4, c##i##1);
+
+    AVX_INIT(0) AVX_INIT(1) AVX_INIT(2) AVX_INIT(3) AVX_INIT(4) AVX_INIT(5)
+
+    for (int p = 0; p < kc; p++, a += 6, b += 8)
+    {
+        const __m256d b0 = _mm256_load_pd(b);
+        const __m256d b1 = _mm256_load_pd(b + 4);
+        __m256d ai;
+        AVX_STEP(0) AVX_STEP(1) AVX_STEP(2) AVX_STEP(3) AVX_STEP(4) AVX_STEP(5)
+    }
+
+    AVX_STORE(0) AVX_STORE(1) AVX_STORE(2) AVX_STORE(3) AVX_STORE(4) AVX_STORE(5)
+
+#undef AVX_INIT
+#undef AVX_STEP
+#undef AVX_STORE
+}
+
+// double: 6 x 8 tile, two ymm accumulators per row.
+__attribute__((target("avx2,fma")))
+static void kernelAvx2Double(int kc, const double* a, const double* b, double* c, int ldc, bool accumulate)
+{
+#define AVX2_INIT(i) \
+    __m256d c##i##0 = accumulate ? _mm256_loadu_pd(c + (size_t)i * ldc) : _mm256_setzero_pd(); \
+    __m256d c##i##1 = accumulate ? _mm256_loadu_pd(c + (size_t)i * ldc + 4) : _mm256_setzero_pd();
+#define AVX2_STEP(i) \
+    ai = _mm256_broadcast_sd(a + i); \
+    c##i##0 = _mm256_fmadd_pd(ai, b0, c##i##0); \
+    c##i##1 = _mm256_fmadd_pd(ai, b1, c##i##1);
+#define AVX2_STORE(i) \
+    _mm256_storeu_pd(c + (size_t)i * ldc, c##i##0); \
+    _mm256_storeu_pd(c + (size_t)i * ldc + 4, c##i##1);
+
+    AVX2_INIT(0) AVX2_INIT(1) AVX2_INIT(2) AVX2_INIT(3) AVX2_INIT(4) AVX2_INIT(5)
+
+    for (int p = 0; p < kc; p++, a += 6, b += 8)
+    {
+        const __m256d b0 = _mm256_load_pd(b);
+        const __m256d b1 = _mm256_load_pd(b + 4);
+        __m256d ai;
+        AVX2_STEP(0) AVX2_STEP(1) AVX2_STEP(2) AVX2_STEP(3) AVX2_STEP(4) AVX2_STEP(5)
+    }
+
+    AVX2_STORE(0) AVX2_STORE(1) AVX2_STORE(2) AVX2_STORE(3) AVX2_STORE(4) AVX2_STORE(5)
+
+#undef AVX2_INIT
+#undef AVX2_STEP
+#undef AVX2_STORE
+}
+
+// double: 12 x 16 tile, two zmm accumulators per row.
+__attribute__((target("avx512f")))
+static void kernelAvx512Double(int kc, const double* a, const double* b, double* c, int ldc, bool accumulate)
+{
+#define AVX512_INIT(i) \
+    __m512d c##i##0 = accumulate ? _mm512_loadu_pd(c + (size_t)i * ldc) : _mm512_setzero_pd(); \
+    __m512d c##i##1 = accumulate ? _mm512_loadu_pd(c + (size_t)i * ldc + 8) : _mm512_setzero_pd();
+#define AVX512_STEP(i) \
+    ai = _mm512_set1_pd(a[i]); \
+    c##i##0 = _mm512_fmadd_pd(ai, b0, c##i##0); \
+    c##i##1 = _mm512_fmadd_pd(ai, b1, c##i##1);
+#define AVX512_STORE(i) \
+    _mm512_storeu_pd(c + (size_t)i * ldc, c##i##0); \
+    _mm512_storeu_pd(c + (size_t)i * ldc + 8, c##i##1);
+
+    AVX512_INIT(0) AVX512_INIT(1) AVX512_INIT(2) AVX512_INIT(3) AVX512_INIT(4) AVX512_INIT(5)
+    AVX512_INIT(6) AVX512_INIT(7) AVX512_INIT(8) AVX512_INIT(9) AVX512_INIT(10) AVX512_INIT(11)
+
+    for (int p = 0; p < kc; p++, a += 12, b += 16)
+    {
+        const __m512d b0 = _mm512_load_pd(b);
+        const __m512d b1 = _mm512_load_pd(b + 8);
+        __m512d ai;
+        AVX512_STEP(0) AVX512_STEP(1) AVX512_STEP(2) AVX512_STEP(3) AVX512_STEP(4) AVX512_STEP(5)
+        AVX512_STEP(6) AVX512_STEP(7) AVX512_STEP(8) AVX512_STEP(9) AVX512_STEP(10) AVX512_STEP(11)
+    }
+
+    AVX512_STORE(0) AVX512_STORE(1) AVX512_STORE(2) AVX512_STORE(3) AVX512_STORE(4) AVX512_STORE(5)
+    AVX512_STORE(6) AVX512_STORE(7) AVX512_STORE(8) AVX512_STORE(9) AVX512_STORE(10) AVX512_STORE(11)
+
+#undef AVX512_INIT
+#undef AVX512_STEP
+#undef AVX512_STORE
+}
+
+#endif // GEMM_X86
+
+template<typename T>
+static MicroKernel<T> selectMicroKernel(void);
+
+template<>
+MicroKernel<float> selectMicroKernel<float>(void)
+{
+#ifdef GEMM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        MicroKernel<float> kernel = { "avx512", 12, 32, kernelAvx512 };
+        return kernel;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        MicroKernel<float> kernel = { "avx2", 6, 16, kernelAvx2 };
+        return kernel;
+    }
+    if (__builtin_cpu_supports("avx"))
+    {
+        MicroKernel<float> kernel = { "avx", 6, 16, kernelAvx };
+        return kernel;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        MicroKernel<float> kernel = { "sse", 4, 8, kernelSse };
+        return kernel;
+    }
+#endif
+    MicroKernel<float> kernel = { "generic", 4, 4, kernelGeneric<float> };
+    return kernel;
+}
+
+template<>
+MicroKernel<double> selectMicroKernel<double>(void)
+{
+#ifdef GEMM_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        MicroKernel<double> kernel = { "avx512", 12, 16, kernelAvx512Double };
+        return kernel;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        MicroKernel<double> kernel = { "avx2", 6, 8, kernelAvx2Double };
+        return kernel;
+    }
+    if (__builtin_cpu_supports("avx"))
+    {
+        MicroKernel<double> kernel = { "avx", 6, 8, kernelAvxDouble };
+        return kernel;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        MicroKernel<double> kernel = { "sse", 4, 4, kernelSseDouble };
+        return kernel;
+    }
+#endif
+    MicroKernel<double> kernel = { "generic", 4, 4, kernelGeneric<double> };
+    return kernel;
+}
+
+template<typename T>
+static const MicroKernel<T>& microKernel(void)
+{
+    static const MicroKernel<T> kernel = selectMicroKernel<T>();
+    return kernel;
+}
+
+// Cache blocking
+
+static long cacheSize(int name, long fallback)
+{
+    long size = sysconf(name);
+    return size > 0 ? size : fallback;
+}
+
+template<typename T>
+static Blocking selectBlocking(const MicroKernel<T>& kernel)
+{
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    long l1 = cacheSize(_SC_LEVEL1_DCACHE_SIZE, 32 * 1024);
+    long l2 = cacheSize(_SC_LEVEL2_CACHE_SIZE, 256 * 1024);
+    long l3 = cacheSize(_SC_LEVEL3_CACHE_SIZE, 8 * 1024 * 1024);
+#else
+    long l1 = 32 * 1024;
+    long l2 = 256 * 1024;
+    long l3 = 8 * 1024 * 1024;
+#endif
+
+    Blocking blocking;
+
+    // One KC x NR micro-panel of B should stay in L1 while it is reused for every A micro-panel.
+    blocking.kc = (int)(l1 / (kernel.nr * sizeof(T)));
+    blocking.kc = std::max(64, std::min(512, blocking.kc & ~7));
+
+    // The MC x KC block of A should take about half of L2.
+    blocking.mc = (int)(l2 / 2 / (blocking.kc * sizeof(T)));
+    blocking.mc = std::max(kernel.mr, std::min(1024, blocking.mc) / kernel.mr * kernel.mr);
+
+    // The KC x NC panel of B should take about half of L3.
+    blocking.nc = (int)(l3 / 2 / (blocking.kc * sizeof(T)));
+    blocking.nc = std::max(kernel.nr, std::min(4096, blocking.nc) / kernel.nr * kernel.nr);
+
+    return blocking;
+}
+
+template<typename T>
+static const Blocking& blocking(void)
+{
+    static const Blocking blocks = selectBlocking(microKernel<T>());
+    return blocks;
+}
+
+// Packing
+
+// Grows on demand and is kept per thread (see gemm()), so steady-state calls do not allocate.
+template<typename T>
+class PackBuffer
+{
+public:
+    PackBuffer(void)
+        : m_data(NULL)
+        , m_count(0)
+    {}
+
+    ~PackBuffer(void) { free(m_data); }
+
+    T* get(size_t count)
+    {
+        if (count > m_count)
+        {
+            free(m_data);
+            m_data = NULL;
+            m_count = 0;
+            if (posix_memalign((void**)&m_data, 64, count * sizeof(T)) != 0)
+            {
+                throw "pack buffer alloc fail";
+            }
+            m_count = count;
+        }
+
+        return m_data;
+    }
+
+private:
+    PackBuffer(const PackBuffer&);
+    PackBuffer& operator=(const PackBuffer&);
+
+    T* m_data;
+    size_t m_count;
+};
+
+// Packs an mc x kc block of A into MR row micro-panels, each stored k-major
+// (MR consecutive values per k) and scaled by alpha. Element (i, p) of the
+// block is a[i * rowStride + p * depthStride], so a transposed A is packed by
+// swapping the strides. Rows past mc are zero filled.
+template<typename T>
+static void packA(int mc, int kc, const T* a, int rowStride, int depthStride, T alpha, int mr, T* dst)
+{
+    for (int ir = 0; ir < mc; ir += mr)
+    {
+        const int rows = std::min(mr, mc - ir);
+        for (int p = 0; p < kc; p++)
+        {
+            for (int i = 0; i < rows; i++)
+            {
+                dst[i] = alpha * a[(size_t)(ir + i) * rowStride + (size_t)p * depthStride];
+            }
+            for (int i = rows; i < mr; i++)
+            {
+                dst[i] = T(0);
+            }
+            dst += mr;
+        }
+    }
+}
+
+// Packs a kc x nc panel of B into NR column micro-panels, each stored k-major
+// (NR consecutive values per k). A transposed B is read column by column.
+// Columns past nc are zero filled.
+template<typename T>
+static void packB(int kc, int nc, const T* b, int ldb, bool transB, int nr, T* dst)
+{
+    for (int jr = 0; jr < nc; jr += nr)
+    {
+        const int cols = std::min(nr, nc - jr);
+        for (int p = 0; p < kc; p++)
+        {
+            if (transB)
+            {
+                for (int j = 0; j < cols; j++)
+                {
+                    dst[j] = b[(size_t)(jr + j) * ldb + p];
+                }
+            }
+            else
+            {
+                memcpy(dst, b + (size_t)p * ldb + jr, cols * sizeof(T));
+            }
+            for (int j = cols; j < nr; j++)
+            {
+                dst[j] = T(0);
+            }
+            dst += nr;
+        }
+    }
+}
+
+// Scales a rows x cols block of C in place.
+template<typename T>
+static void scaleBlock(int rows, int cols, T beta, T* c, int ldc)
+{
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            c[(size_t)i * ldc + j] *= beta;
+        }
+    }
+}
+
+// Applies the epilogue to a rows x cols block of C starting at the given column of C.
+template<typename T>
+static void applyEpilogue(int rows, int cols, const BasicEpilogue<T>& epilogue, int column, T* c, int ldc)
+{
+    for (int i = 0; i < rows; i++)
+    {
+        T* row = c + (size_t)i * ldc;
+        for (int j = 0; j < cols; j++)
+        {
+            row[j] = epilogue.apply(row[j], column + j);
+        }
+    }
+}
+
+// Runs the micro-kernel over an mc x nc block of C from packed A and B. With
+// accumulate the products add to C, after scaling it by beta unless that is 1.
+// The epilogue (NULL for none) is applied to every tile right after its kernel
+// run, while the tile is still in cache. column is the column of C the block
+// starts at.
+template<typename T>
+static void macroKernel(const MicroKernel<T>& kernel, int mc, int nc, int kc,
+                        const T* packedA, const T* packedB,
+                        T* c, int ldc, bool accumulate, T beta,
+                        const BasicEpilogue<T>* epilogue, int column)
+{
+    const int mr = kernel.mr;
+    const int nr = kernel.nr;
+    T edge[32 * 32];
+
+    for (int jr = 0; jr < nc; jr += nr)
+    {
+        const int cols = std::min(nr, nc - jr);
+        const T* b = packedB + jr * kc;
+
+        for (int ir = 0; ir < mc; ir += mr)
+        {
+            const int rows = std::min(mr, mc - ir);
+            const T* a = packedA + ir * kc;
+            T* tile = c + (size_t)ir * ldc + jr;
+
+            if (accumulate && beta != T(1))
+            {
+                scaleBlock(rows, cols, beta, tile, ldc);
+            }
+
+            if (rows == mr && cols == nr)
+            {
+                kernel.run(kc, a, b, tile, ldc, accumulate);
+            }
+            else
+            {
+                // Partial tile: run the full kernel on a scratch tile and copy back the valid part.
+                for (int i = 0; i < rows && accumulate; i++)
+                {
+                    memcpy(edge + i * nr, tile + (size_t)i * ldc, cols * sizeof(T));
+                }
+                kernel.run(kc, a, b, edge, nr, accumulate);
+                for (int i = 0; i < rows; i++)
+                {
+                    memcpy(tile + (size_t)i * ldc, edge + i * nr, cols * sizeof(T));
+                }
+            }
+
+            if (epilogue != NULL)
+            {
+                applyEpilogue(rows, cols, *epilogue, column + jr, tile, ldc);
+            }
+        }
+    }
+}
+
+template<typename T>
+static void gemm(const MicroKernel<T>& kernel, const Blocking& blocks,
+                 bool transA, bool transB, int m, int n, int k, T alpha,
+                 const T* a, int lda,
+                 const T* b, int ldb,
+                 T beta, T* c, int ldc,
+                 const BasicEpilogue<T>& epilogue)
+{
+    if (m <= 0 || n <= 0)
+    {
+        return;
+    }
+
+    const BasicEpilogue<T>* finalEpilogue = epilogue.empty() ? NULL : &epilogue;
+    if (k <= 0 || alpha == T(0))
+    {
+        for (int i = 0; i < m; i++)
+        {
+            if (beta == T(0))
+            {
+                memset(c + (size_t)i * ldc, 0, n * sizeof(T));
+            }
+            else if (beta != T(1))
+            {
+                scaleBlock(1, n, beta, c + (size_t)i * ldc, ldc);
+            }
+        }
+
+        if (finalEpilogue != NULL)
+        {
+            applyEpilogue(m, n, epilogue, 0, c, ldc);
+        }
+        return;
+    }
+
+    // Strides of A along its rows (i) and its depth (p).
+    const int rowStride = transA ? 1 : lda;
+    const int depthStride = transA ? lda : 1;
+
+    const int kc = std::min(blocks.kc, k);
+    const int mc = std::min(blocks.mc, (m + kernel.mr - 1) / kernel.mr * kernel.mr);
+    const int nc = std::min(blocks.nc, (n + kernel.nr - 1) / kernel.nr * kernel.nr);
+
+    static thread_local PackBuffer<T> packBufferA;
+    static thread_local PackBuffer<T> packBufferB;
+    T* packedA = packBufferA.get((size_t)mc * kc);
+    T* packedB = packBufferB.get((size_t)nc * kc);
+
+    for (int jc = 0; jc < n; jc += nc)
+    {
+        const int ncCur = std::min(nc, n - jc);
+
+        for (int pc = 0; pc < k; pc += kc)
+        {
+            const int kcCur = std::min(kc, k - pc);
+            packB(kcCur, ncCur, transB ? b + (size_t)jc * ldb + pc : b + (size_t)pc * ldb + jc, ldb, transB,
+                  kernel.nr, packedB);
+
+            // beta only applies to what C held before the first K block.
+            const bool accumulate = pc > 0 || beta != T(0);
+            const T blockBeta = pc > 0 ? T(1) : beta;
+            const BasicEpilogue<T>* blockEpilogue = pc + kcCur == k ? finalEpilogue : NULL;
+
+            for (int ic = 0; ic < m; ic += mc)
+            {
+                const int mcCur = std::min(mc, m - ic);
+                packA(mcCur, kcCur, a + (size_t)ic * rowStride + (size_t)pc * depthStride, rowStride, depthStride,
+                      alpha, kernel.mr, packedA);
+
+                macroKernel(kernel, mcCur, ncCur, kcCur, packedA, packedB,
+                            c + (size_t)ic * ldc + jc, ldc, accumulate, blockBeta, blockEpilogue, jc);
+            }
+        }
+    }
+}
+
+void sgemm(int m, int n, int k,
+           const float* a, int lda,
+           const float* b, int ldb,
+           float* c, int ldc)
+{
+    gemm(microKernel<float>(), blocking<float>(), false, false, m, n, k, 1.0f, a, lda, b, ldb, 0.0f, c, ldc, Epilogue());
+}
+
+void sgemm(bool transA, bool transB, int m, int n, int k, float alpha,
+           const float* a, int lda,
+           const float* b, int ldb,
+           float beta, float* c, int ldc,
+           const Epilogue& epilogue)
+{
+    gemm(microKernel<float>(), blocking<float>(), transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, epilogue);
+}
+
+const char* sgemmKernelName(void)
+{
+    return microKernel<float>().name;
+}
+
+void dgemm(int m, int n, int k,
+           const double* a, int lda,
+           const double* b, int ldb,
+           double* c, int ldc)
+{
+    gemm(microKernel<double>(), blocking<double>(), false, false, m, n, k, 1.0, a, lda, b, ldb, 0.0, c, ldc,
+         BasicEpilogue<double>());
+}
+
+void dgemm(bool transA, bool transB, int m, int n, int k, double alpha,
+           const double* a, int lda,
+           const double* b, int ldb,
+           double beta, double* c, int ldc,
+           const BasicEpilogue<double>& epilogue)
+{
+    gemm(microKernel<double>(), blocking<double>(), transA, transB, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, epilogue);
+}
+
+const char* dgemmKernelName(void)
+{
+    return microKernel<double>().name;
+}
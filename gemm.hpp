@@ -0,0 +1,72 @@
+#ifndef _GEMM_HPP
+#define _GEMM_HPP
+
+#include <algorithm>
+#include <cstddef>
+
+// Blocked, packed single (sgemm) and double (dgemm) precision matrix multiply
+// used by the CPU operations.
+//
+// Computes C = A * B where A is m x k, B is k x n and C is m x n. All matrices
+// are row-major, the ld* arguments give the distance (in elements) between two
+// consecutive rows.
+void sgemm(int m, int n, int k,
+           const float* a, int lda,
+           const float* b, int ldb,
+           float* c, int ldc);
+
+// Elementwise operations applied to C right before it is stored, in this
+// order: bias[j] added to column j, negative values clamped to 0 (ReLU),
+// the result multiplied by scale.
+template<typename T>
+struct BasicEpilogue
+{
+    BasicEpilogue(void)
+        : bias(NULL)
+        , relu(false)
+        , scale(1)
+    {}
+
+    // One value per column of C, NULL for none.
+    const T* bias;
+    bool relu;
+    T scale;
+
+    bool empty(void) const { return bias == NULL && !relu && scale == T(1); }
+
+    T apply(T value, int column) const
+    {
+        value = bias != NULL ? value + bias[column] : value;
+        return (relu ? std::max(value, T(0)) : value) * scale;
+    }
+};
+
+typedef BasicEpilogue<float> Epilogue;
+
+// C = epilogue(alpha * op(A) * op(B) + beta * C) where op() transposes when the
+// flag is set. op(A) is m x k and op(B) is k x n, lda and ldb are the row
+// strides of A and B as stored (A is k x m when transposed). The transposes
+// are folded into the packing, nothing is copied. With beta 0 C is not read.
+void sgemm(bool transA, bool transB, int m, int n, int k, float alpha,
+           const float* a, int lda,
+           const float* b, int ldb,
+           float beta, float* c, int ldc,
+           const Epilogue& epilogue = Epilogue());
+
+// Name of the micro-kernel selected for the running CPU.
+const char* sgemmKernelName(void);
+
+// The double precision counterparts, with micro-kernels of their own (half as
+// many columns per vector register).
+void dgemm(int m, int n, int k,
+           const double* a, int lda,
+           const double* b, int ldb,
+           double* c, int ldc);
+void dgemm(bool transA, bool transB, int m, int n, int k, double alpha,
+           const double* a, int lda,
+           const double* b, int ldb,
+           double beta, double* c, int ldc,
+           const BasicEpilogue<double>& epilogue = BasicEpilogue<double>());
+const char* dgemmKernelName(void);
+
+#endif // _GEMM_HPP
@@ -0,0 +1,443 @@
+#include "int8_operations.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define INT8_X86 1
+#include <immintrin.h>
+#endif
+
+static float requantize(float value, float inverseOutputScale)
+{
+    return std::min(127.0f, std::max(-127.0f, rintf(value * inverseOutputScale)));
+}
+
+// Int8Matrix
+
+Int8Matrix::Int8Matrix(int width, int height, Scaling scaling)
+    : m_width(width)
+    , m_height(height)
+    , m_scaling(scaling)
+    , m_data((size_t)width * height)
+    , m_scales(scaling == PER_ROW ? height : width, 1.0f)
+{
+}
+
+Int8Matrix Int8Matrix::quantize(const Matrix& matrix, Scaling scaling)
+{
+    const int width = matrix.width();
+    const int height = matrix.height();
+    Int8Matrix result(width, height, scaling);
+
+    std::vector<float> largest(result.m_scales.size(), 0.0f);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            float& value = largest[scaling == PER_ROW ? y : x];
+            value = std::max(value, fabsf(matrix[y * width + x]));
+        }
+    }
+
+    for (size_t i = 0; i < largest.size(); i++)
+    {
+        result.m_scales[i] = largest[i] > 0.0f ? largest[i] / 127.0f : 1.0f;
+    }
+
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const float scale = result.m_scales[scaling == PER_ROW ? y : x];
+            result.m_data[(size_t)y * width + x] = (int8_t)requantize(matrix[y * width + x], 1.0f / scale);
+        }
+    }
+
+    return result;
+}
+
+Matrix Int8Matrix::dequantize(void) const
+{
+    Matrix result = Matrix::uninitialized(m_width, m_height);
+    for (int y = 0; y < m_height; y++)
+    {
+        for (int x = 0; x < m_width; x++)
+        {
+            const size_t i = (size_t)y * m_width + x;
+            result.data()[i] = m_scales[m_scaling == PER_ROW ? y : x] * m_data[i];
+        }
+    }
+
+    return result;
+}
+
+bool Int8Matrix::operator==(const Int8Matrix& other) const
+{
+    return m_width == other.m_width && m_height == other.m_height && m_scaling == other.m_scaling
+        && m_data == other.m_data && m_scales == other.m_scales;
+}
+
+// Int8Operations
+
+void Int8Operations::checkOperands(const Int8Matrix& lhs, const Int8Matrix& rhs)
+{
+    if (lhs.scaling() != Int8Matrix::PER_ROW || rhs.scaling() != Int8Matrix::PER_COLUMN)
+    {
+        throw "quantization mismatch";
+    }
+
+    if (lhs.width() != rhs.height())
+    {
+        throw "shape mismatch";
+    }
+}
+
+void Int8Operations::checkOutputScale(float outputScale)
+{
+    if (!(outputScale > 0.0f) || std::isinf(outputScale))
+    {
+        throw "output scale must be positive and finite";
+    }
+}
+
+// CPU tiles
+
+// Sums of a rows x columns tile of C over the whole of K, stored row by row.
+// A holds rows rows lda apart, b one panel of packed B.
+typedef void (*TileFn)(int groups, const uint8_t* a, int lda, const void* b, int32_t* tile);
+
+struct TileKernel
+{
+    const char* name;
+    int rows;
+    int columns;
+    // A panel of B holds groups of kGroup consecutive k values for each of its columns.
+    int kGroup;
+    // AVX2 keeps B widened to int16.
+    bool wideB;
+    // A is stored offset by 128 (as u8), the sums come back offset by 128 * column sum.
+    bool offsetA;
+    TileFn run;
+};
+
+// Largest rows x columns of the kernels below.
+static const int MAX_TILE = 8 * 32;
+
+static void tileGeneric(int groups, const uint8_t* a, int lda, const void* b, int32_t* tile)
+{
+    const int8_t* panel = (const int8_t*)b;
+    std::fill(tile, tile + 4 * 8, 0);
+
+    for (int p = 0; p < groups; p++)
+    {
+        for (int r = 0; r < 4; r++)
+        {
+            const int32_t value = (int8_t)a[r * lda + p];
+            for (int c = 0; c < 8; c++)
+            {
+                tile[r * 8 + c] += value * panel[p * 8 + c];
+            }
+        }
+    }
+}
+
+#ifdef INT8_X86
+
+// 4 x 16: pairs of k values, pmaddwd adds two int16 products into every int32
+// lane without saturating (pmaddubsw would).
+__attribute__((target("avx2")))
+static void tileAvx2(int groups, const uint8_t* a, int lda, const void* b, int32_t* tile)
+{
+    const int16_t* panel = (const int16_t*)b;
+    __m256i acc[4][2];
+    for (int r = 0; r < 4; r++)
+    {
+        acc[r][0] = _mm256_setzero_si256();
+        acc[r][1] = _mm256_setzero_si256();
+    }
+
+    for (int g = 0; g < groups; g++)
+    {
+        const __m256i b0 = _mm256_loadu_si256((const __m256i*)(panel + g * 32));
+        const __m256i b1 = _mm256_loadu_si256((const __m256i*)(panel + g * 32 + 16));
+        for (int r = 0; r < 4; r++)
+        {
+            const int8_t* row = (const int8_t*)a + r * lda + 2 * g;
+            const __m256i pair = _mm256_set1_epi32((int)((uint16_t)row[0] | ((uint32_t)(uint16_t)row[1] << 16)));
+            acc[r][0] = _mm256_add_epi32(acc[r][0], _mm256_madd_epi16(pair, b0));
+            acc[r][1] = _mm256_add_epi32(acc[r][1], _mm256_madd_epi16(pair, b1));
+        }
+    }
+
+    for (int r = 0; r < 4; r++)
+    {
+        _mm256_storeu_si256((__m256i*)(tile + r * 16), acc[r][0]);
+        _mm256_storeu_si256((__m256i*)(tile + r * 16 + 8), acc[r][1]);
+    }
+}
+
+// 8 x 32: groups of 4 k values, vpdpbusd adds four u8 x s8 products into every int32 lane.
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static void tileVnni(int groups, const uint8_t* a, int lda, const void* b, int32_t* tile)
+{
+    const int8_t* panel = (const int8_t*)b;
+    __m512i acc[8][2];
+    for (int r = 0; r < 8; r++)
+    {
+        acc[r][0] = _mm512_setzero_si512();
+        acc[r][1] = _mm512_setzero_si512();
+    }
+
+    for (int g = 0; g < groups; g++)
+    {
+        const __m512i b0 = _mm512_loadu_si512(panel + g * 128);
+        const __m512i b1 = _mm512_loadu_si512(panel + g * 128 + 64);
+        for (int r = 0; r < 8; r++)
+        {
+            int32_t quad;
+            memcpy(&quad, a + r * lda + 4 * g, sizeof(quad));
+            const __m512i broadcast = _mm512_set1_epi32(quad);
+            acc[r][0] = _mm512_dpbusd_epi32(acc[r][0], broadcast, b0);
+            acc[r][1] = _mm512_dpbusd_epi32(acc[r][1], broadcast, b1);
+        }
+    }
+
+    for (int r = 0; r < 8; r++)
+    {
+        _mm512_storeu_si512(tile + r * 32, acc[r][0]);
+        _mm512_storeu_si512(tile + r * 32 + 16, acc[r][1]);
+    }
+}
+
+#endif // INT8_X86
+
+static TileKernel selectTileKernel(void)
+{
+#ifdef INT8_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw"))
+    {
+        TileKernel kernel = { "avx512vnni", 8, 32, 4, false, true, tileVnni };
+        return kernel;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        TileKernel kernel = { "avx2", 4, 16, 2, true, false, tileAvx2 };
+        return kernel;
+    }
+#endif
+    TileKernel kernel = { "generic", 4, 8, 1, false, false, tileGeneric };
+    return kernel;
+}
+
+static const TileKernel& tileKernel(void)
+{
+    static const TileKernel kernel = selectTileKernel();
+    return kernel;
+}
+
+const char* CpuInt8Operations::kernelName(void)
+{
+    return tileKernel().name;
+}
+
+// CPU
+
+Matrix CpuInt8Operations::multiply(const Int8Matrix& lhs, const Int8Matrix& rhs) const
+{
+    Matrix result = Matrix::uninitialized(rhs.width(), lhs.height());
+    multiply(lhs, rhs, result.data(), NULL, 0.0f);
+    return result;
+}
+
+Int8Matrix CpuInt8Operations::multiplyRequantized(const Int8Matrix& lhs, const Int8Matrix& rhs, float outputScale) const
+{
+    checkOutputScale(outputScale);
+
+    Int8Matrix result(rhs.width(), lhs.height(), Int8Matrix::PER_ROW);
+    std::fill(result.scales(), result.scales() + result.height(), outputScale);
+    multiply(lhs, rhs, NULL, result.data(), outputScale);
+    return result;
+}
+
+void CpuInt8Operations::multiply(const Int8Matrix& lhs, const Int8Matrix& rhs, float* result, int8_t* requantized, float outputScale) const
+{
+    checkOperands(lhs, rhs);
+
+    const TileKernel& kernel = tileKernel();
+    const int m = lhs.height();
+    const int n = rhs.width();
+    const int k = lhs.width();
+    const int kPadded = std::max(kernel.kGroup, (k + kernel.kGroup - 1) / kernel.kGroup * kernel.kGroup);
+    const int mPadded = (m + kernel.rows - 1) / kernel.rows * kernel.rows;
+    const int nPadded = (n + kernel.columns - 1) / kernel.columns * kernel.columns;
+    const size_t panelSize = (size_t)kPadded * kernel.columns;
+
+    // A and B zero padded to whole tiles and k groups, B cut into panels of
+    // kernel.columns columns, with the sums of its columns.
+    static thread_local std::vector<uint8_t> packedA;
+    static thread_local std::vector<int16_t> packedB;
+    static thread_local std::vector<int32_t> columnSums;
+    packedA.assign((size_t)mPadded * kPadded, 0);
+    packedB.assign(kernel.wideB ? (size_t)nPadded * kPadded : ((size_t)nPadded * kPadded + 1) / 2, 0);
+    columnSums.assign(nPadded, 0);
+
+    for (int i = 0; i < m; i++)
+    {
+        // Flipping the sign bit of an int8 is adding 128 to it as a u8.
+        const int8_t* src = lhs.data() + (size_t)i * k;
+        uint8_t* dst = &packedA[(size_t)i * kPadded];
+        for (int p = 0; p < k; p++)
+        {
+            dst[p] = kernel.offsetA ? (uint8_t)(src[p] ^ 0x80) : (uint8_t)src[p];
+        }
+    }
+
+    for (int p = 0; p < k; p++)
+    {
+        const int8_t* src = rhs.data() + (size_t)p * n;
+        const size_t groupOffset = (size_t)(p / kernel.kGroup) * kernel.columns * kernel.kGroup + p % kernel.kGroup;
+        for (int j = 0; j < n; j++)
+        {
+            const size_t index = (j / kernel.columns) * panelSize + groupOffset + (j % kernel.columns) * kernel.kGroup;
+            if (kernel.wideB)
+            {
+                packedB[index] = src[j];
+            }
+            else
+            {
+                ((int8_t*)&packedB[0])[index] = src[j];
+            }
+            columnSums[j] += src[j];
+        }
+    }
+
+    const float inverseOutputScale = 1.0f / outputScale;
+    const int32_t offset = kernel.offsetA ? 128 : 0;
+    const int groups = kPadded / kernel.kGroup;
+    const size_t panelBytes = panelSize * (kernel.wideB ? sizeof(int16_t) : sizeof(int8_t));
+
+    // A panel of B is reused by every row tile while it sits in cache.
+    for (int j = 0; j < n; j += kernel.columns)
+    {
+        const void* panel = (const char*)&packedB[0] + (j / kernel.columns) * panelBytes;
+        const int columns = std::min(kernel.columns, n - j);
+
+        for (int i = 0; i < m; i += kernel.rows)
+        {
+            int32_t tile[MAX_TILE];
+            kernel.run(groups, &packedA[(size_t)i * kPadded], kPadded, panel, tile);
+
+            const int rows = std::min(kernel.rows, m - i);
+            for (int r = 0; r < rows; r++)
+            {
+                const float rowScale = lhs.scales()[i + r];
+                const size_t out = (size_t)(i + r) * n + j;
+                for (int c = 0; c < columns; c++)
+                {
+                    const int32_t sum = tile[r * kernel.columns + c] - offset * columnSums[j + c];
+                    const float value = (float)sum * (rowScale * rhs.scales()[j + c]);
+                    if (requantized != NULL)
+                    {
+                        requantized[out + c] = (int8_t)requantize(value, inverseOutputScale);
+                    }
+                    else
+                    {
+                        result[out + c] = value;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// GPU
+
+GpuInt8Operations::GpuInt8Operations(void)
+    : GpuOperations("matrix_mul_int8.cl")
+{
+}
+
+Matrix GpuInt8Operations::multiply(const Int8Matrix& lhs, const Int8Matrix& rhs) const
+{
+    Matrix result = Matrix::uninitialized(rhs.width(), lhs.height());
+    multiply(lhs, rhs, result.data(), result.dataSize(), false, 0.0f);
+    return result;
+}
+
+Int8Matrix GpuInt8Operations::multiplyRequantized(const Int8Matrix& lhs, const Int8Matrix& rhs, float outputScale) const
+{
+    checkOutputScale(outputScale);
+
+    Int8Matrix result(rhs.width(), lhs.height(), Int8Matrix::PER_ROW);
+    std::fill(result.scales(), result.scales() + result.height(), outputScale);
+    multiply(lhs, rhs, result.data(), (size_t)result.width() * result.height(), true, outputScale);
+    return result;
+}
+
+void GpuInt8Operations::multiply(const Int8Matrix& lhs, const Int8Matrix& rhs, void* result, size_t size, bool requantize, float outputScale) const
+{
+    checkOperands(lhs, rhs);
+
+    const int m = lhs.height();
+    const int n = rhs.width();
+    const int k = lhs.width();
+    if (m == 0 || n == 0)
+    {
+        return;
+    }
+    const int k4 = std::max(1, (k + 3) / 4);
+
+    // Rows of A and columns of B as whole char4 vectors.
+    m_packedA.assign((size_t)m * k4 * 4, 0);
+    m_packedB.assign((size_t)n * k4 * 4, 0);
+    for (int i = 0; i < m; i++)
+    {
+        memcpy(&m_packedA[(size_t)i * k4 * 4], lhs.data() + (size_t)i * k, k);
+    }
+    for (int p = 0; p < k; p++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            m_packedB[((size_t)j * k4) * 4 + p] = rhs.data()[(size_t)p * n + j];
+        }
+    }
+
+    PooledBuffer dev_A = pooledBuffer(m_packedA.size(), &m_packedA[0]);
+    PooledBuffer dev_B = pooledBuffer(m_packedB.size(), &m_packedB[0]);
+    PooledBuffer dev_LhsScales = pooledBuffer(sizeof(float) * m, lhs.scales());
+    PooledBuffer dev_RhsScales = pooledBuffer(sizeof(float) * n, rhs.scales());
+    PooledBuffer dev_C = pooledBuffer(size, NULL);
+
+    cl_kernel kernel = cachedKernel(requantize ? "matrix_mul_int8_requantize" : "matrix_mul_int8");
+
+    const cl_mem memObjs[] = { dev_A.get(), dev_B.get(), dev_LhsScales.get(), dev_RhsScales.get(), dev_C.get(), 0 };
+    int argNdx = setKernelArgs(kernel, 0, memObjs);
+
+    const int sizes[] = { n, k4 };
+    argNdx = setKernelArgs(kernel, argNdx, sizes, sizeof(sizes) / sizeof(sizes[0]));
+
+    const float inverseOutputScale = 1.0f / outputScale;
+    if (requantize && clSetKernelArg(kernel, argNdx, sizeof(float), &inverseOutputScale) != CL_SUCCESS)
+    {
+        throw "kernel arg set fail";
+    }
+
+    size_t globalWorkSize[2] = { (size_t)n, (size_t)m };
+    ProfiledEvent kernelDone(m_profiler, "matrix_mul_int8", m_queue.get());
+    if (clEnqueueNDRangeKernel(m_queue.get(), kernel, 2, NULL, globalWorkSize, NULL, 0, NULL, kernelDone.get()) != CL_SUCCESS)
+    {
+        throw "job enqueue fail";
+    }
+    kernelDone.enqueued();
+
+    ProfiledEvent readDone(m_profiler, "readback", m_queue.get());
+    if (clEnqueueReadBuffer(m_queue.get(), dev_C.get(), CL_TRUE, 0, size, result, 0, NULL, readDone.get()) != CL_SUCCESS)
+    {
+        throw "readback fail";
+    }
+    readDone.enqueued();
+}
@@ -0,0 +1,113 @@
+#ifndef _INT8_OPERATIONS_HPP
+#define _INT8_OPERATIONS_HPP
+
+#include <stdint.h>
+#include <vector>
+
+#include "matrix.hpp"
+#include "operations.hpp"
+
+// Symmetric int8 quantization: element (x, y) stands for scale * value, with
+// one scale per row or one per column. Values are kept in [-127, 127].
+class Int8Matrix
+{
+public:
+    enum Scaling
+    {
+        PER_ROW,
+        PER_COLUMN
+    };
+
+    Int8Matrix(int width, int height, Scaling scaling);
+
+    // Every row (column) is scaled so its largest magnitude maps to 127.
+    static Int8Matrix quantize(const Matrix& matrix, Scaling scaling);
+    Matrix dequantize(void) const;
+
+    int width(void) const { return m_width; }
+    int height(void) const { return m_height; }
+    Scaling scaling(void) const { return m_scaling; }
+
+    const int8_t* data(void) const { return m_data.data(); }
+    int8_t* data(void) { return m_data.data(); }
+    // height() scales per row, width() per column.
+    const float* scales(void) const { return m_scales.data(); }
+    float* scales(void) { return m_scales.data(); }
+
+    bool operator==(const Int8Matrix& other) const;
+    bool operator!=(const Int8Matrix& other) const { return !this->operator==(other); }
+
+private:
+    int m_width;
+    int m_height;
+    Scaling m_scaling;
+    std::vector<int8_t> m_data;
+    std::vector<float> m_scales;
+};
+
+// int8 x int8 -> int32 products. lhs must be scaled per row and rhs per
+// column, so every element of C has a single scale: C(x, y) =
+// lhsScale[y] * rhsScale[x] * sum. The scaling is fused into the store of the
+// int32 sums, either dequantizing them or requantizing them to int8.
+//
+// Every implementation gives the same bits: the sums are exact and the
+// scaling is the same float operations in the same order.
+class Int8Operations
+{
+public:
+    virtual ~Int8Operations(void) { }
+
+    virtual Matrix multiply(const Int8Matrix& lhs, const Int8Matrix& rhs) const = 0;
+    // The result quantized with outputScale for every row, ready to be the lhs
+    // of the next product. outputScale must be positive and finite.
+    virtual Int8Matrix multiplyRequantized(const Int8Matrix& lhs, const Int8Matrix& rhs, float outputScale) const = 0;
+
+protected:
+    // Throws unless the scalings and the shapes fit.
+    static void checkOperands(const Int8Matrix& lhs, const Int8Matrix& rhs);
+    // Throws unless outputScale is positive and finite.
+    static void checkOutputScale(float outputScale);
+};
+
+// Register blocked tiles of C over the whole of K, with B packed into panels
+// as wide as a tile. AVX512-VNNI runs 8 x 32 tiles adding 4 u8 x s8 products
+// per lane (A offset by 128 and the offset taken back out with the column
+// sums of B), AVX2 runs 4 x 16 tiles on B widened to int16 with pmaddwd, the
+// generic code runs everywhere.
+class CpuInt8Operations : public Int8Operations
+{
+public:
+    virtual Matrix multiply(const Int8Matrix& lhs, const Int8Matrix& rhs) const;
+    virtual Int8Matrix multiplyRequantized(const Int8Matrix& lhs, const Int8Matrix& rhs, float outputScale) const;
+
+    // Name of the tile kernel selected for the running CPU.
+    static const char* kernelName(void);
+
+private:
+    void multiply(const Int8Matrix& lhs, const Int8Matrix& rhs, float* result, int8_t* requantized, float outputScale) const;
+};
+
+// matrix_mul_int8.cl: every work-item reads its row of A and column of B as
+// char4 vectors (K padded to a multiple of 4, B packed transposed) and scales
+// the sum before the store.
+//
+// Derives privately from GpuOperations for the context and the helpers, its
+// program holds only the int8 kernels.
+class GpuInt8Operations : public Int8Operations, private GpuOperations
+{
+public:
+    GpuInt8Operations(void);
+
+    virtual Matrix multiply(const Int8Matrix& lhs, const Int8Matrix& rhs) const;
+    virtual Int8Matrix multiplyRequantized(const Int8Matrix& lhs, const Int8Matrix& rhs, float outputScale) const;
+
+private:
+    // Uploads the operands, runs the kernel (requantizing to outputScale when
+    // requantize is set) and reads back size bytes.
+    void multiply(const Int8Matrix& lhs, const Int8Matrix& rhs, void* result, size_t size, bool requantize, float outputScale) const;
+
+    mutable std::vector<int8_t> m_packedA;
+    mutable std::vector<int8_t> m_packedB;
+};
+
+#endif // _INT8_OPERATIONS_HPP
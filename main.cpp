@@ -1,12 +1,25 @@
+#include "auto_operations.hpp"
+#include "int8_operations.hpp"
 #include "matrix.hpp"
+#include "matrix_file.hpp"
+#include "multi_device_operations.hpp"
 #include "operations.hpp"
+#include "precision.hpp"
+#include "random.hpp"
+#include "strassen_operations.hpp"
+#include "verify.hpp"
 
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
 #include <cstring>
 
+#include <algorithm>
 #include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
 
 struct Measurement
 {
@@ -16,14 +29,18 @@ struct Measurement
     double dot;
     double float4;
     double constant;
+    double tiled;
+    double block4x4;
+    double block8x4;
 };
 
-static Matrix measure(Operations& op, Matrix& lhs, Matrix& rhs, double* spentTime)
+template<typename T>
+static BasicMatrix<T> measure(BasicOperations<T>& op, const BasicMatrix<T>& lhs, const BasicMatrix<T>& rhs, double* spentTime)
 {
     using namespace std::chrono;
 
     steady_clock::time_point start = std::chrono::steady_clock::now();
-    Matrix matrix = op.multiply(lhs, rhs);
+    BasicMatrix<T> matrix = op.multiply(lhs, rhs);
     steady_clock::time_point end = std::chrono::steady_clock::now();
 
     duration<double> span = duration_cast<std::chrono::duration<double> > (end - start);
@@ -32,40 +49,66 @@ static Matrix measure(Operations& op, Matrix& lhs, Matrix& rhs, double* spentTim
     return matrix;
 }
 
-static Measurement measureMultiply(Matrix& lhs, Matrix& rhs)
+// Every variant is created once up front, so the measurements do not include
+// device setup and program compilation.
+struct Variants
 {
-    Measurement result;
+    Variants(void)
+        : block4x4(4)
+        , block8x4(8)
+    {}
 
-    Operations* gpu = new GpuOperations();
-    Matrix gpuMatrix = measure(*gpu, lhs, rhs, &result.gpu);
-    delete gpu;
+    CpuOperations cpu;
+    GpuOperations gpu;
+    TransposedGpuOperations transposed;
+    DotGpuOperations dot;
+    Float4GpuOperations float4;
+    ConstantGpuOperations constant;
+    TiledGpuOperations tiled;
+    BlockedGpuOperations block4x4;
+    BlockedGpuOperations block8x4;
 
-    Operations* transposed = new TransposedGpuOperations();
-    Matrix transposedMatrix = measure(*transposed, lhs, rhs, &result.transposed);
-    delete transposed;
+    void setSpecialization(bool enabled)
+    {
+        GpuOperations* gpus[] = { &gpu, &transposed, &dot, &float4, &constant, &tiled, &block4x4, &block8x4 };
+        for (size_t i = 0; i < sizeof(gpus) / sizeof(gpus[0]); i++)
+        {
+            gpus[i]->setSpecialization(enabled);
+        }
+    }
+};
 
-    Operations* dot = new DotGpuOperations();
-    Matrix dotMatrix = measure(*dot, lhs, rhs, &result.dot);
-    delete dot;
+// The GPU results are checked with Freivalds' test (see verify.hpp), O(n^2)
+// instead of comparing with the CPU product element by element, and tolerant
+// of kernels that sum in another order.
+static const int VERIFY_ROUNDS = 2;
+static const double VERIFY_TOLERANCE = 1e-6;
 
-    Operations* float4 = new Float4GpuOperations();
-    Matrix float4Matrix = measure(*float4, lhs, rhs, &result.float4);
-    delete float4;
+static bool mismatch(const Matrix& lhs, const Matrix& rhs, const Matrix& result)
+{
+    return !freivaldsCheck<float>(lhs, rhs, result, VERIFY_ROUNDS, VERIFY_TOLERANCE);
+}
 
-    Operations* constant = new ConstantGpuOperations();
-    Matrix constantMatrix = measure(*constant, lhs, rhs, &result.constant);
-    delete constant;
+static Measurement measureMultiply(Variants& variants, Matrix& lhs, Matrix& rhs)
+{
+    Measurement result;
 
-    Operations* cpu = new CpuOperations();
-    Matrix cpuMatrix = measure(*cpu, lhs, rhs, &result.cpu);
-    delete cpu;
+    Matrix gpuMatrix = measure(variants.gpu, lhs, rhs, &result.gpu);
+    Matrix transposedMatrix = measure(variants.transposed, lhs, rhs, &result.transposed);
+    Matrix dotMatrix = measure(variants.dot, lhs, rhs, &result.dot);
+    Matrix float4Matrix = measure(variants.float4, lhs, rhs, &result.float4);
+    Matrix constantMatrix = measure(variants.constant, lhs, rhs, &result.constant);
+    Matrix tiledMatrix = measure(variants.tiled, lhs, rhs, &result.tiled);
+    Matrix block4x4Matrix = measure(variants.block4x4, lhs, rhs, &result.block4x4);
+    Matrix block8x4Matrix = measure(variants.block8x4, lhs, rhs, &result.block8x4);
+    Matrix cpuMatrix = measure(variants.cpu, lhs, rhs, &result.cpu);
 
-    if (cpuMatrix != gpuMatrix)
+    if (mismatch(lhs, rhs, gpuMatrix))
     {
         printf("GPU Matrix mismatch\n");
     }
 
-    if (cpuMatrix != transposedMatrix)
+    if (mismatch(lhs, rhs, transposedMatrix))
     {
         printf("Transposed Matrix mismatch\n");
 
@@ -86,7 +129,7 @@ static Measurement measureMultiply(Matrix& lhs, Matrix& rhs)
         printf("\n");
     }
 
-    if (cpuMatrix != dotMatrix)
+    if (mismatch(lhs, rhs, dotMatrix))
     {
         printf("Dot Matrix mismatch\n");
 
@@ -102,19 +145,939 @@ static Measurement measureMultiply(Matrix& lhs, Matrix& rhs)
         printf("\n");
     }
 
-    if (cpuMatrix != float4Matrix)
+    if (mismatch(lhs, rhs, float4Matrix))
     {
         printf("Float4 Matrix mismatch\n");
     }
 
+    if (mismatch(lhs, rhs, tiledMatrix))
+    {
+        printf("Tiled Matrix mismatch\n");
+    }
+
+    if (mismatch(lhs, rhs, block4x4Matrix))
+    {
+        printf("Block 4x4 Matrix mismatch\n");
+    }
+
+    if (mismatch(lhs, rhs, block8x4Matrix))
+    {
+        printf("Block 8x4 Matrix mismatch\n");
+    }
+
     return result;
 }
 
+static void measureThreadScaling(Matrix& lhs, Matrix& rhs, bool useCSVOutput)
+{
+    const double flops = 2.0 * lhs.height() * lhs.width() * rhs.width();
+
+    double baseTime;
+    CpuOperations cpu;
+    Matrix cpuMatrix = measure(cpu, lhs, rhs, &baseTime);
+
+    const int maxThreads = ThreadPool::hardwareThreads();
+    for (int threads = 1; ; threads = std::min(threads * 2, maxThreads))
+    {
+        ParallelCpuOperations parallel(threads);
+
+        double spentTime;
+        Matrix parallelMatrix = measure(parallel, lhs, rhs, &spentTime);
+        if (cpuMatrix != parallelMatrix)
+        {
+            printf("Parallel Matrix mismatch (%d threads)\n", threads);
+        }
+
+        if (useCSVOutput)
+        {
+            printf("%d;%d;%d; %.6f;%.6f\n", rhs.width(), lhs.height(), threads, spentTime, baseTime);
+        }
+        else
+        {
+            printf("%dx%d %3d threads: %.6f (%.2f GFLOP/s, speedup %.2f, efficiency %.0f%%)\n",
+                    rhs.width(),
+                    lhs.height(),
+                    threads,
+                    spentTime,
+                    flops / spentTime * 1e-9,
+                    baseTime / spentTime,
+                    100.0 * baseTime / spentTime / threads);
+        }
+
+        if (threads == maxThreads)
+        {
+            break;
+        }
+    }
+}
+
+static std::vector<Matrix> measureBatch(Operations& op, const std::vector<Matrix>& lhs, const std::vector<Matrix>& rhs, double* spentTime)
+{
+    using namespace std::chrono;
+
+    steady_clock::time_point start = steady_clock::now();
+    std::vector<Matrix> results = op.multiplyBatched(lhs, rhs);
+    *spentTime = duration_cast<duration<double> >(steady_clock::now() - start).count();
+
+    return results;
+}
+
+// Batches of many small products: once every product of the given size, once
+// with sizes drawn from [16, size].
+static void measureBatched(int size, bool useCSVOutput)
+{
+    static const int BATCH = 1000;
+
+    CpuOperations cpu;
+    ParallelCpuOperations parallel;
+    GpuOperations gpu;
+
+    for (int variable = 0; variable < 2; variable++)
+    {
+        std::vector<Matrix> lhs;
+        std::vector<Matrix> rhs;
+        lhs.reserve(BATCH);
+        rhs.reserve(BATCH);
+
+        double flops = 0.0;
+        for (int i = 0; i < BATCH; i++)
+        {
+            const int m = variable ? 16 + rand() % (std::max(size - 16, 0) + 1) : size;
+            const int n = variable ? 16 + rand() % (std::max(size - 16, 0) + 1) : size;
+            const int k = variable ? 16 + rand() % (std::max(size - 16, 0) + 1) : size;
+            lhs.push_back(Matrix::random(k, m, 4));
+            rhs.push_back(Matrix::random(n, k, 4));
+            flops += 2.0 * m * n * k;
+        }
+
+        // The first batch builds the batched program.
+        gpu.multiplyBatched(lhs, rhs);
+
+        double cpuTime;
+        double parallelTime;
+        double gpuTime;
+        std::vector<Matrix> cpuResults = measureBatch(cpu, lhs, rhs, &cpuTime);
+        std::vector<Matrix> parallelResults = measureBatch(parallel, lhs, rhs, &parallelTime);
+        std::vector<Matrix> gpuResults = measureBatch(gpu, lhs, rhs, &gpuTime);
+
+        // One GpuOperations::multiply() per pair, what the batched kernel replaces
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        gpu.Operations::multiplyBatched(lhs, rhs);
+        const double gpuLoopTime = std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now() - start).count();
+
+        for (int i = 0; i < BATCH; i++)
+        {
+            if (cpuResults[i] != parallelResults[i])
+            {
+                printf("Parallel batch mismatch at %d\n", i);
+                break;
+            }
+            if (cpuResults[i] != gpuResults[i])
+            {
+                printf("GPU batch mismatch at %d\n", i);
+                break;
+            }
+        }
+
+        const char* kind = variable ? "variable" : "uniform";
+        if (useCSVOutput)
+        {
+            printf("%s;%d;%d; %.6f;%.6f;%.6f;%.6f\n", kind, size, BATCH, cpuTime, parallelTime, gpuLoopTime, gpuTime);
+        }
+        else
+        {
+            printf("%s batch of %d (up to %d): CPU %.6f (%.2f GFLOP/s), parallel CPU %.6f (%.2f GFLOP/s), "
+                   "GPU loop %.6f (%.2f GFLOP/s), GPU batched %.6f (%.2f GFLOP/s)\n",
+                    kind,
+                    BATCH,
+                    size,
+                    cpuTime, flops / cpuTime * 1e-9,
+                    parallelTime, flops / parallelTime * 1e-9,
+                    gpuLoopTime, flops / gpuLoopTime * 1e-9,
+                    gpuTime, flops / gpuTime * 1e-9);
+        }
+    }
+}
+
+static void measureStream(Matrix& lhs, Matrix& rhs, bool useCSVOutput)
+{
+    using namespace std::chrono;
+
+    static const int JOBS = 1000;
+    // One job uploading, one computing, one reading back
+    static const int IN_FLIGHT = 3;
+
+    GpuOperations gpu;
+    Matrix expected = gpu.multiply(lhs, rhs);
+
+    steady_clock::time_point start = steady_clock::now();
+    for (int i = 0; i < JOBS; i++)
+    {
+        gpu.multiply(lhs, rhs);
+    }
+    const double syncTime = duration_cast<duration<double> >(steady_clock::now() - start).count();
+
+    bool mismatch = false;
+    MultiplyHandle handles[IN_FLIGHT];
+    start = steady_clock::now();
+    for (int i = 0; i < JOBS + IN_FLIGHT; i++)
+    {
+        MultiplyHandle& handle = handles[i % IN_FLIGHT];
+        if (handle.valid())
+        {
+            mismatch |= expected != handle.wait();
+            handle = MultiplyHandle();
+        }
+
+        if (i < JOBS)
+        {
+            handle = gpu.multiplyAsync(lhs, rhs);
+        }
+    }
+    const double asyncTime = duration_cast<duration<double> >(steady_clock::now() - start).count();
+
+    if (mismatch)
+    {
+        printf("Async Matrix mismatch\n");
+    }
+
+    if (useCSVOutput)
+    {
+        printf("%d;%d;%d; %.6f;%.6f\n", rhs.width(), lhs.height(), JOBS, syncTime, asyncTime);
+    }
+    else
+    {
+        printf("%dx%d %d jobs: sync %.6f (%.1f jobs/s), async %.6f (%.1f jobs/s, speedup %.2f)\n",
+                rhs.width(),
+                lhs.height(),
+                JOBS,
+                syncTime,
+                JOBS / syncTime,
+                asyncTime,
+                JOBS / asyncTime,
+                syncTime / asyncTime);
+    }
+}
+
+// Quadrants of lhs and rhs multiplied as views into a preallocated result,
+// against multiply() on copies of the quadrants.
+static void measureInto(Matrix& lhs, Matrix& rhs, bool useCSVOutput)
+{
+    using namespace std::chrono;
+
+    static const int RUNS = 20;
+
+    const int half = lhs.height() - lhs.height() / 2;
+    const int depth = lhs.width() - lhs.width() / 2;
+    const ConstMatrixView lhsBlock = ConstMatrixView(lhs).block(lhs.width() - depth, lhs.height() - half, depth, half);
+    const ConstMatrixView rhsBlock = ConstMatrixView(rhs).block(rhs.width() - half, rhs.height() - depth, half, depth);
+    const Matrix lhsCopy(lhsBlock);
+    const Matrix rhsCopy(rhsBlock);
+
+    CpuOperations cpu;
+    GpuOperations gpu;
+    Operations* ops[] = { &cpu, &gpu };
+    const char* names[] = { "CPU", "GPU" };
+
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+    {
+        Matrix expected = ops[i]->multiply(lhsCopy, rhsCopy);
+
+        steady_clock::time_point start = steady_clock::now();
+        for (int run = 0; run < RUNS; run++)
+        {
+            ops[i]->multiply(Matrix(lhsBlock), Matrix(rhsBlock));
+        }
+        const double copyTime = duration_cast<duration<double> >(steady_clock::now() - start).count() / RUNS;
+
+        Matrix result = Matrix::uninitialized(expected.width(), expected.height());
+        MatrixView resultView = result.view();
+        start = steady_clock::now();
+        for (int run = 0; run < RUNS; run++)
+        {
+            ops[i]->multiplyInto(lhsBlock, rhsBlock, resultView);
+        }
+        const double intoTime = duration_cast<duration<double> >(steady_clock::now() - start).count() / RUNS;
+
+        if (result != expected)
+        {
+            printf("%s view Matrix mismatch\n", names[i]);
+        }
+
+        if (useCSVOutput)
+        {
+            printf("%s;%d;%d;%d; %.6f;%.6f\n", names[i], lhsBlock.height(), rhsBlock.width(), lhsBlock.width(), copyTime, intoTime);
+        }
+        else
+        {
+            printf("%s %dx%dx%d: copies %.6f, views %.6f (speedup %.2f)\n",
+                    names[i],
+                    lhsBlock.height(),
+                    rhsBlock.width(),
+                    lhsBlock.width(),
+                    copyTime,
+                    intoTime,
+                    copyTime / intoTime);
+        }
+    }
+}
+
+static Matrix randomFractions(int width, int height)
+{
+    Matrix matrix = Matrix::uninitialized(width, height);
+    for (size_t i = 0; i < (size_t)width * height; i++)
+    {
+        matrix.data()[i] = 2.0f * rand() / RAND_MAX - 1.0f;
+    }
+
+    return matrix;
+}
+
+static Matrix roundedTo(StorageFormat format, const Matrix& matrix)
+{
+    Matrix rounded = Matrix::uninitialized(matrix.width(), matrix.height());
+    for (size_t i = 0; i < (size_t)matrix.width() * matrix.height(); i++)
+    {
+        rounded.data()[i] = roundToStorage(format, matrix[i]);
+    }
+
+    return rounded;
+}
+
+// Accuracy and speed of the 16 bit storage formats against fp32. The inputs
+// are fractions in [-1, 1], whole numbers would round exactly.
+static void measurePrecision(int size, bool useCSVOutput)
+{
+    const Matrix lhs = randomFractions(size, size);
+    const Matrix rhs = randomFractions(size, size);
+
+    double cpuTime;
+    double gpuTime;
+    CpuOperations cpu;
+    GpuOperations gpu;
+    Matrix reference = measure(cpu, lhs, rhs, &cpuTime);
+    measure(gpu, lhs, rhs, &gpuTime);
+
+    double referenceMax = 0.0;
+    for (int i = 0; i < size * size; i++)
+    {
+        referenceMax = std::max(referenceMax, (double)fabsf(reference[i]));
+    }
+
+    const StorageFormat formats[] = { STORAGE_FP16, STORAGE_BF16 };
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+    {
+        MixedPrecisionGpuOperations mixed(formats[f]);
+        double mixedTime;
+        Matrix result = measure(mixed, lhs, rhs, &mixedTime);
+
+        // The device must match the CPU engine on the rounded inputs exactly.
+        Matrix expected = cpu.multiply(roundedTo(formats[f], lhs), roundedTo(formats[f], rhs));
+
+        double maxError = 0.0;
+        double squaredError = 0.0;
+        for (int i = 0; i < size * size; i++)
+        {
+            const double error = fabs((double)result[i] - reference[i]);
+            maxError = std::max(maxError, error);
+            squaredError += error * error;
+        }
+        const double rmsError = sqrt(squaredError / ((double)size * size));
+
+        if (result != expected)
+        {
+            printf("%s Matrix mismatch\n", storageFormatName(formats[f]));
+        }
+
+        if (useCSVOutput)
+        {
+            printf("%s;%d; %.6f;%.6f; %.3e;%.3e\n",
+                    storageFormatName(formats[f]), size, gpuTime, mixedTime, maxError / referenceMax, rmsError / referenceMax);
+        }
+        else
+        {
+            printf("%dx%d %s: %.6f (fp32 GPU %.6f), max error %.3e, rms error %.3e (relative to max |C|)\n",
+                    size,
+                    size,
+                    storageFormatName(formats[f]),
+                    mixedTime,
+                    gpuTime,
+                    maxError / referenceMax,
+                    rmsError / referenceMax);
+        }
+    }
+}
+
+// fp32 against fp64 on the CPU and GPU engines, with the error of the fp32
+// result relative to the largest element of the fp64 one.
+static void measureDouble(int size, bool useCSVOutput)
+{
+    const Matrix lhs = randomFractions(size, size);
+    const Matrix rhs = randomFractions(size, size);
+    BasicMatrix<double> lhsDouble = BasicMatrix<double>::uninitialized(size, size);
+    BasicMatrix<double> rhsDouble = BasicMatrix<double>::uninitialized(size, size);
+    std::copy(lhs.data(), lhs.data() + size * size, lhsDouble.data());
+    std::copy(rhs.data(), rhs.data() + size * size, rhsDouble.data());
+
+    BasicCpuOperations<float> cpuFloat;
+    BasicCpuOperations<double> cpuDouble;
+
+    double cpuFloatTime;
+    double cpuDoubleTime;
+    const Matrix result = measure(cpuFloat, lhs, rhs, &cpuFloatTime);
+    const BasicMatrix<double> reference = measure(cpuDouble, lhsDouble, rhsDouble, &cpuDoubleTime);
+
+    BasicGpuOperations<float> gpuFloat;
+    double gpuFloatTime;
+    double gpuDoubleTime = 0.0;
+    measure(gpuFloat, lhs, rhs, &gpuFloatTime);
+
+    try
+    {
+        BasicGpuOperations<double> gpuDouble;
+        measure(gpuDouble, lhsDouble, rhsDouble, &gpuDoubleTime);
+    }
+    catch (const char* error)
+    {
+        printf("GPU double: %s\n", error);
+    }
+
+    double referenceMax = 0.0;
+    double maxError = 0.0;
+    for (int i = 0; i < size * size; i++)
+    {
+        referenceMax = std::max(referenceMax, fabs(reference[i]));
+        maxError = std::max(maxError, fabs(result[i] - reference[i]));
+    }
+
+    if (useCSVOutput)
+    {
+        printf("%d; %.6f;%.6f; %.6f;%.6f; %.3e\n", size, cpuFloatTime, cpuDoubleTime, gpuFloatTime, gpuDoubleTime, maxError / referenceMax);
+    }
+    else
+    {
+        printf("%dx%d CPU fp32 (%s) %.6f, fp64 (%s) %.6f; GPU fp32 %.6f, fp64 %.6f; fp32 max error %.3e (relative to max |C|)\n",
+                size,
+                size,
+                BasicCpuOperations<float>::kernelName(),
+                cpuFloatTime,
+                BasicCpuOperations<double>::kernelName(),
+                cpuDoubleTime,
+                gpuFloatTime,
+                gpuDoubleTime,
+                maxError / referenceMax);
+    }
+}
+
+// int8 products against fp32 at the same shape, the quantization error
+// relative to the largest element of the fp32 result.
+static void measureInt8(int size, bool useCSVOutput)
+{
+    using namespace std::chrono;
+
+    const Matrix lhs = randomFractions(size, size);
+    const Matrix rhs = randomFractions(size, size);
+    const Int8Matrix lhsQ = Int8Matrix::quantize(lhs, Int8Matrix::PER_ROW);
+    const Int8Matrix rhsQ = Int8Matrix::quantize(rhs, Int8Matrix::PER_COLUMN);
+
+    CpuOperations cpu;
+    GpuOperations gpu;
+    CpuInt8Operations cpuInt8;
+    GpuInt8Operations gpuInt8;
+
+    double cpuTime;
+    double gpuTime;
+    const Matrix reference = measure(cpu, lhs, rhs, &cpuTime);
+    measure(gpu, lhs, rhs, &gpuTime);
+
+    steady_clock::time_point start = steady_clock::now();
+    const Matrix cpuResult = cpuInt8.multiply(lhsQ, rhsQ);
+    const double cpuInt8Time = duration_cast<duration<double> >(steady_clock::now() - start).count();
+
+    start = steady_clock::now();
+    const Matrix gpuResult = gpuInt8.multiply(lhsQ, rhsQ);
+    const double gpuInt8Time = duration_cast<duration<double> >(steady_clock::now() - start).count();
+
+    if (cpuResult != gpuResult)
+    {
+        printf("Int8 Matrix mismatch\n");
+    }
+
+    // Requantized with the scale of the largest element
+    double referenceMax = 0.0;
+    double maxError = 0.0;
+    for (int i = 0; i < size * size; i++)
+    {
+        referenceMax = std::max(referenceMax, (double)fabsf(reference[i]));
+        maxError = std::max(maxError, fabs((double)cpuResult[i] - reference[i]));
+    }
+
+    // An all-zero product still needs a positive scale.
+    const float outputScale = referenceMax > 0.0 ? (float)(referenceMax / 127.0) : 1.0f;
+    if (cpuInt8.multiplyRequantized(lhsQ, rhsQ, outputScale) != gpuInt8.multiplyRequantized(lhsQ, rhsQ, outputScale))
+    {
+        printf("Requantized Int8 Matrix mismatch\n");
+    }
+
+    if (useCSVOutput)
+    {
+        printf("%d; %.6f;%.6f;%.6f;%.6f; %.3e\n", size, cpuTime, cpuInt8Time, gpuTime, gpuInt8Time, maxError / referenceMax);
+    }
+    else
+    {
+        printf("%dx%d CPU fp32 %.6f, int8 (%s) %.6f; GPU fp32 %.6f, int8 %.6f; max error %.3e (relative to max |C|)\n",
+                size,
+                size,
+                cpuTime,
+                CpuInt8Operations::kernelName(),
+                cpuInt8Time,
+                gpuTime,
+                gpuInt8Time,
+                maxError / referenceMax);
+    }
+}
+
+// Transpose bandwidth (bytes read plus written per second) on the host and on
+// the device, each against a plain copy of the same bytes.
+static void measureTranspose(Matrix& lhs, bool useCSVOutput)
+{
+    using namespace std::chrono;
+
+    static const int RUNS = 20;
+
+    const double bytes = 2.0 * lhs.dataSize();
+
+    // Both loops write into the same preallocated matrix, so neither times an allocation.
+    Matrix transposed = Matrix::uninitialized(lhs.height(), lhs.width());
+    steady_clock::time_point start = steady_clock::now();
+    for (int i = 0; i < RUNS; i++)
+    {
+        memcpy(transposed.data(), lhs.data(), lhs.dataSize());
+    }
+    const double cpuCopy = duration_cast<duration<double> >(steady_clock::now() - start).count() / RUNS;
+
+    const MatrixView destination = transposed.view();
+    start = steady_clock::now();
+    for (int i = 0; i < RUNS; i++)
+    {
+        lhs.transposeInto(destination);
+    }
+    const double cpuTranspose = duration_cast<duration<double> >(steady_clock::now() - start).count() / RUNS;
+
+    TransposedGpuOperations gpu;
+    if (gpu.transpose(lhs) != transposed)
+    {
+        printf("GPU transpose mismatch\n");
+    }
+
+    double gpuTranspose;
+    double gpuCopy;
+    gpu.timeTranspose(lhs.width(), lhs.height(), RUNS, &gpuTranspose, &gpuCopy);
+
+    if (useCSVOutput)
+    {
+        printf("%d;%d; %.6f;%.6f;%.6f;%.6f\n", lhs.width(), lhs.height(), cpuTranspose, cpuCopy, gpuTranspose, gpuCopy);
+    }
+    else
+    {
+        printf("%dx%d CPU transpose: %.6f (%.2f GB/s), memcpy %.6f (%.2f GB/s)\n",
+                lhs.width(), lhs.height(), cpuTranspose, bytes / cpuTranspose * 1e-9, cpuCopy, bytes / cpuCopy * 1e-9);
+        printf("%dx%d GPU transpose: %.6f (%.2f GB/s), copy %.6f (%.2f GB/s)\n",
+                lhs.width(), lhs.height(), gpuTranspose, bytes / gpuTranspose * 1e-9, gpuCopy, bytes / gpuCopy * 1e-9);
+    }
+}
+
+// lhs^T * rhs^T with a bias and ReLU: transpose(), multiply() and a pass over
+// the result against a single gemm() call.
+static void measureGemm(Matrix& lhs, Matrix& rhs, bool useCSVOutput)
+{
+    using namespace std::chrono;
+
+    std::vector<float> bias(lhs.height());
+    for (size_t i = 0; i < bias.size(); i++)
+    {
+        bias[i] = (float)(i % 7) - 3.0f;
+    }
+
+    Epilogue epilogue;
+    epilogue.bias = &bias[0];
+    epilogue.relu = true;
+
+    CpuOperations cpu;
+    GpuOperations gpu;
+    TiledGpuOperations tiled;
+    BlockedGpuOperations blocked;
+    Operations* ops[] = { &cpu, &gpu, &tiled, &blocked };
+    const char* names[] = { "CPU", "GPU", "Tiled", "Block4x4" };
+
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+    {
+        steady_clock::time_point start = steady_clock::now();
+        Matrix expected = ops[i]->multiply(rhs.transpose(), lhs.transpose());
+        for (int y = 0; y < expected.height(); y++)
+        {
+            for (int x = 0; x < expected.width(); x++)
+            {
+                expected.data()[y * expected.width() + x] = epilogue.apply(expected[y * expected.width() + x], x);
+            }
+        }
+        const double separateTime = duration_cast<duration<double> >(steady_clock::now() - start).count();
+
+        Matrix result = Matrix::uninitialized(expected.width(), expected.height());
+        MatrixView resultView = result.view();
+        start = steady_clock::now();
+        ops[i]->gemm(true, true, 1.0f, rhs, lhs, 0.0f, resultView, epilogue);
+        const double fusedTime = duration_cast<duration<double> >(steady_clock::now() - start).count();
+
+        if (result != expected)
+        {
+            printf("%s gemm Matrix mismatch\n", names[i]);
+        }
+
+        if (useCSVOutput)
+        {
+            printf("%s;%d;%d; %.6f;%.6f\n", names[i], result.width(), result.height(), separateTime, fusedTime);
+        }
+        else
+        {
+            printf("%s %dx%d: transpose + multiply + epilogue %.6f, gemm %.6f (speedup %.2f)\n",
+                    names[i],
+                    result.width(),
+                    result.height(),
+                    separateTime,
+                    fusedTime,
+                    separateTime / fusedTime);
+        }
+    }
+}
+
+// Every call re-splits the rows with the rates measured by the earlier ones.
+static void measureMultiDevice(MultiDeviceOperations& multi, Matrix& lhs, Matrix& rhs, bool useCSVOutput)
+{
+    const double flops = 2.0 * lhs.height() * lhs.width() * rhs.width();
+
+    double spentTime;
+    Matrix multiMatrix = measure(multi, lhs, rhs, &spentTime);
+
+    CpuOperations cpu;
+    if (cpu.multiply(lhs, rhs) != multiMatrix)
+    {
+        printf("Multi-device Matrix mismatch\n");
+    }
+
+    const std::vector<MultiDeviceOperations::Worker>& workers = multi.workers();
+    if (useCSVOutput)
+    {
+        printf("%d;%d; %.6f", rhs.width(), lhs.height(), spentTime);
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            printf(";%d", workers[i].rows);
+        }
+        printf("\n");
+    }
+    else
+    {
+        printf("%dx%d MDO: %.6f (%.2f GFLOP/s)\n", rhs.width(), lhs.height(), spentTime, flops / spentTime * 1e-9);
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            printf("    %5d rows, %8.2f GFLOP/s  %s\n", workers[i].rows, workers[i].rate * 1e-9, workers[i].name.c_str());
+        }
+    }
+}
+
+// Out-of-core path with an artificial budget of an eighth of the operands,
+// so any device (CPU runtimes included) has to stream tiles.
+static void measureOutOfCore(Matrix& lhs, Matrix& rhs, bool useCSVOutput)
+{
+    const double flops = 2.0 * lhs.height() * lhs.width() * rhs.width();
+    const size_t totalSize = sizeof(float) * ((size_t)lhs.width() * lhs.height()
+                                              + (size_t)rhs.width() * rhs.height()
+                                              + (size_t)rhs.width() * lhs.height());
+
+    OutOfCoreGpuOperations outOfCore(totalSize / 8);
+
+    double spentTime;
+    Matrix outOfCoreMatrix = measure(outOfCore, lhs, rhs, &spentTime);
+
+    CpuOperations cpu;
+    if (cpu.multiply(lhs, rhs) != outOfCoreMatrix)
+    {
+        printf("Out-of-core Matrix mismatch\n");
+    }
+
+    int tileM;
+    int tileN;
+    int tileK;
+    outOfCore.tileShape(lhs.width(), lhs.height(), rhs.width(), &tileM, &tileN, &tileK);
+    OutOfCoreGpuOperations::Stats stats = outOfCore.lastStats();
+
+    if (useCSVOutput)
+    {
+        printf("%d;%d; %d;%d;%d; %zu;%zu;%zu; %.6f\n",
+                rhs.width(),
+                lhs.height(),
+                tileM,
+                tileN,
+                tileK,
+                stats.tiles,
+                stats.uploads,
+                stats.reusedUploads,
+                spentTime);
+    }
+    else
+    {
+        printf("%dx%d OOC: %.6f (%.2f GFLOP/s) tiles %dx%dx%d, %zu C tiles, %zu uploads, %zu reused\n",
+                rhs.width(),
+                lhs.height(),
+                spentTime,
+                flops / spentTime * 1e-9,
+                tileM,
+                tileN,
+                tileK,
+                stats.tiles,
+                stats.uploads,
+                stats.reusedUploads);
+    }
+}
+
+static void measureAutoTuning(Matrix& lhs, Matrix& rhs, bool specialize, bool useCSVOutput)
+{
+    const double flops = 2.0 * lhs.height() * lhs.width() * rhs.width();
+
+    AutoOperations autoOps;
+    autoOps.setSpecialization(specialize);
+
+    // The first call tunes the shape unless the table already has it.
+    double firstTime;
+    double steadyTime;
+    Matrix autoMatrix = measure(autoOps, lhs, rhs, &firstTime);
+    measure(autoOps, lhs, rhs, &steadyTime);
+
+    CpuOperations cpu;
+    if (cpu.multiply(lhs, rhs) != autoMatrix)
+    {
+        printf("Auto Matrix mismatch\n");
+    }
+
+    AutoOperations::Choice choice;
+    autoOps.choice(lhs.width(), lhs.height(), rhs.width(), &choice);
+
+    if (useCSVOutput)
+    {
+        printf("%d;%d; %s;%d;%d; %.6f;%.6f\n",
+                rhs.width(),
+                lhs.height(),
+                choice.variant.c_str(),
+                (int)choice.localWorkSize[0],
+                (int)choice.localWorkSize[1],
+                firstTime,
+                steadyTime);
+    }
+    else
+    {
+        printf("%dx%d AUT: %.6f (%.2f GFLOP/s) %s, local %dx%d, first call %.6f [%s]\n",
+                rhs.width(),
+                lhs.height(),
+                steadyTime,
+                flops / steadyTime * 1e-9,
+                choice.variant.c_str(),
+                (int)choice.localWorkSize[0],
+                (int)choice.localWorkSize[1],
+                firstTime,
+                autoOps.device().c_str());
+    }
+}
+
+// Strassen-Winograd over the CPU and GPU engines against their classical
+// multiply, for cutoffs halving from size / 2 down to 64. Where the speedup
+// passes 1 is the crossover, the error (relative to max |C| of the classical
+// result) grows with every level.
+static void measureStrassen(int size, bool useCSVOutput)
+{
+    const Matrix lhs = randomFractions(size, size);
+    const Matrix rhs = randomFractions(size, size);
+
+    CpuOperations cpu;
+    GpuOperations gpu;
+    Operations* leaves[] = { &cpu, &gpu };
+    const char* names[] = { "CPU", "GPU" };
+
+    for (size_t l = 0; l < sizeof(leaves) / sizeof(leaves[0]); l++)
+    {
+        Operations& leaf = *leaves[l];
+
+        // Once to warm up the engine (program build, pack buffers).
+        leaf.multiply(lhs, rhs);
+        double classicalTime;
+        const Matrix reference = measure(leaf, lhs, rhs, &classicalTime);
+
+        double referenceMax = 0.0;
+        for (int i = 0; i < size * size; i++)
+        {
+            referenceMax = std::max(referenceMax, (double)fabsf(reference[i]));
+        }
+
+        for (int cutoff = size / 2; cutoff >= 64; cutoff /= 2)
+        {
+            StrassenOperations strassen(leaf, cutoff);
+            strassen.reserve(size, size, size);
+
+            double strassenTime;
+            const Matrix result = measure(strassen, lhs, rhs, &strassenTime);
+
+            double maxError = 0.0;
+            for (int i = 0; i < size * size; i++)
+            {
+                maxError = std::max(maxError, fabs((double)result[i] - reference[i]));
+            }
+
+            if (useCSVOutput)
+            {
+                printf("%s;%d;%d;%d; %.6f;%.6f; %.3e\n",
+                        names[l], size, cutoff, strassen.levels(size, size, size), classicalTime, strassenTime, maxError / referenceMax);
+            }
+            else
+            {
+                printf("%dx%d %s Strassen cutoff %d (%d levels): %.6f, classical %.6f, speedup %.2f, max error %.3e (relative to max |C|)\n",
+                        size,
+                        size,
+                        names[l],
+                        cutoff,
+                        strassen.levels(size, size, size),
+                        strassenTime,
+                        classicalTime,
+                        classicalTime / strassenTime,
+                        maxError / referenceMax);
+            }
+        }
+    }
+}
+
+// Generating a size x size matrix with Matrix::random() (rand(), serial), with
+// randomMatrix() on one and on all host threads, and with matrix_random.cl on
+// the device (including the readback), for every distribution. The device
+// and the thread counts must give the same bits.
+static void measureRandom(int size, bool useCSVOutput)
+{
+    using namespace std::chrono;
+
+    const uint64_t seed = 42;
+    const RandomDistribution distributions[] = {
+        RandomDistribution::integer(4), RandomDistribution::uniform(-1.0f, 1.0f), RandomDistribution::normal(0.0f, 1.0f)
+    };
+    const char* names[] = { "integer", "uniform", "normal" };
+
+    GpuOperations gpu;
+    // Once to build the program.
+    gpu.random(4, 4, seed, distributions[0]);
+
+    steady_clock::time_point start = steady_clock::now();
+    Matrix::random(size, size, 4);
+    const double randTime = duration_cast<duration<double> >(steady_clock::now() - start).count();
+
+    for (size_t d = 0; d < sizeof(distributions) / sizeof(distributions[0]); d++)
+    {
+        start = steady_clock::now();
+        const Matrix serial = randomMatrix(size, size, seed, distributions[d], 1);
+        const double serialTime = duration_cast<duration<double> >(steady_clock::now() - start).count();
+
+        start = steady_clock::now();
+        const Matrix parallel = randomMatrix(size, size, seed, distributions[d]);
+        const double parallelTime = duration_cast<duration<double> >(steady_clock::now() - start).count();
+
+        start = steady_clock::now();
+        const Matrix device = gpu.random(size, size, seed, distributions[d]);
+        const double gpuTime = duration_cast<duration<double> >(steady_clock::now() - start).count();
+
+        if (parallel != serial)
+        {
+            printf("Parallel random %s mismatch\n", names[d]);
+        }
+        if (device != serial)
+        {
+            printf("GPU random %s mismatch\n", names[d]);
+        }
+
+        if (useCSVOutput)
+        {
+            printf("%s;%d; %.6f;%.6f;%.6f;%.6f\n", names[d], size, randTime, serialTime, parallelTime, gpuTime);
+        }
+        else
+        {
+            printf("%dx%d %s: rand() %.6f, counter based 1 thread %.6f, %d threads %.6f, GPU %.6f\n",
+                    size, size, names[d], randTime, serialTime, ThreadPool::hardwareThreads(), parallelTime, gpuTime);
+        }
+    }
+}
+
+// Multiplies two matrix files (see matrix_file.hpp) with the out-of-core
+// engine. The operands are mapped, not read: tile uploads take the elements
+// straight from the page cache. C comes back one band of tile rows at a time,
+// each band is written to outFile, when given, while the device computes the
+// next one. The compute time is the whole multiply, the write time the part
+// of it spent writing.
+static void multiplyFiles(const std::string& lhsFile, const std::string& rhsFile, const std::string& outFile, bool useCSVOutput)
+{
+    using namespace std::chrono;
+
+    const MappedMatrix lhs(lhsFile);
+    const MappedMatrix rhs(rhsFile);
+    const int m = lhs.view().height();
+    const int n = rhs.view().width();
+    const int k = lhs.view().width();
+    if (rhs.view().height() != k)
+    {
+        printf("Shape mismatch: %dx%d * %dx%d\n", m, k, rhs.view().height(), n);
+        return;
+    }
+
+    OutOfCoreGpuOperations gpu;
+    std::unique_ptr<MatrixWriter> writer;
+    if (!outFile.empty())
+    {
+        writer.reset(new MatrixWriter(outFile, n, m));
+    }
+
+    double writeTime = 0.0;
+    steady_clock::time_point start = steady_clock::now();
+    gpu.multiplyRows(lhs.view(), rhs.view(), [&](const ConstMatrixView& rows, int) {
+        if (writer)
+        {
+            const steady_clock::time_point writeStart = steady_clock::now();
+            writer->write(rows);
+            writeTime += duration_cast<duration<double> >(steady_clock::now() - writeStart).count();
+        }
+    });
+    const double computeTime = duration_cast<duration<double> >(steady_clock::now() - start).count();
+
+    if (writer)
+    {
+        start = steady_clock::now();
+        writer->close();
+        writeTime += duration_cast<duration<double> >(steady_clock::now() - start).count();
+    }
+
+    const double gflops = 2.0 * m * n * k / computeTime * 1e-9;
+    if (useCSVOutput)
+    {
+        printf("%d;%d;%d; %.6f;%.6f; %.2f\n", m, n, k, computeTime, writeTime, gflops);
+    }
+    else
+    {
+        printf("%dx%dx%d from %s (%s) and %s (%s): compute %.6f (%.2f GFLOP/s), write %.6f\n",
+                m, n, k,
+                lhsFile.c_str(), lhs.mapped() ? "mapped" : "converted",
+                rhsFile.c_str(), rhs.mapped() ? "mapped" : "converted",
+                computeTime, gflops, writeTime);
+    }
+}
+
 int main(int argc, char** argv)
 {
     if (argc < 2)
     {
-        printf("Usage: %s <matrix size> [count]\n", argv[0]);
+        printf("Usage: %s --lhs=<file> --rhs=<file> [--out=<file>] [--csv]\n", argv[0]);
+        printf("       %s <matrix size> [count] [--csv] [--thread-sweep] [--specialize] [--autotune] [--stream] [--batch] [--out-of-core] [--multi-device] [--no-host] [--cpu-partition=<units>] [--into] [--gemm] [--transpose] [--precision] [--int8] [--double] [--strassen] [--random]\n", argv[0]);
         return -1;
     }
 
@@ -125,15 +1088,126 @@ int main(int argc, char** argv)
     }
 
     bool useCSVOutput = false;
+    bool threadSweep = false;
+    bool specialize = false;
+    bool autotune = false;
+    bool stream = false;
+    bool batch = false;
+    bool outOfCore = false;
+    bool multiDevice = false;
+    int hostThreads = 0;
+    int cpuPartition = 0;
+    bool into = false;
+    bool gemm = false;
+    bool transpose = false;
+    bool precision = false;
+    bool int8 = false;
+    bool fp64 = false;
+    bool strassen = false;
+    bool random = false;
+    std::string lhsFile;
+    std::string rhsFile;
+    std::string outFile;
     for (int i = 1; i < argc; i++)
     {
         if (strcmp("--csv", argv[i]) == 0)
         {
             useCSVOutput = true;
-            break;
+        }
+        else if (strcmp("--thread-sweep", argv[i]) == 0)
+        {
+            threadSweep = true;
+        }
+        else if (strcmp("--specialize", argv[i]) == 0)
+        {
+            specialize = true;
+        }
+        else if (strcmp("--autotune", argv[i]) == 0)
+        {
+            autotune = true;
+        }
+        else if (strcmp("--stream", argv[i]) == 0)
+        {
+            stream = true;
+        }
+        else if (strcmp("--batch", argv[i]) == 0)
+        {
+            batch = true;
+        }
+        else if (strcmp("--out-of-core", argv[i]) == 0)
+        {
+            outOfCore = true;
+        }
+        else if (strcmp("--multi-device", argv[i]) == 0)
+        {
+            multiDevice = true;
+        }
+        else if (strcmp("--no-host", argv[i]) == 0)
+        {
+            hostThreads = -1;
+        }
+        else if (strncmp("--cpu-partition=", argv[i], 16) == 0)
+        {
+            cpuPartition = atoi(argv[i] + 16);
+        }
+        else if (strcmp("--into", argv[i]) == 0)
+        {
+            into = true;
+        }
+        else if (strcmp("--gemm", argv[i]) == 0)
+        {
+            gemm = true;
+        }
+        else if (strcmp("--transpose", argv[i]) == 0)
+        {
+            transpose = true;
+        }
+        else if (strcmp("--precision", argv[i]) == 0)
+        {
+            precision = true;
+        }
+        else if (strcmp("--int8", argv[i]) == 0)
+        {
+            int8 = true;
+        }
+        else if (strcmp("--double", argv[i]) == 0)
+        {
+            fp64 = true;
+        }
+        else if (strcmp("--strassen", argv[i]) == 0)
+        {
+            strassen = true;
+        }
+        else if (strcmp("--random", argv[i]) == 0)
+        {
+            random = true;
+        }
+        else if (strncmp("--lhs=", argv[i], 6) == 0)
+        {
+            lhsFile = argv[i] + 6;
+        }
+        else if (strncmp("--rhs=", argv[i], 6) == 0)
+        {
+            rhsFile = argv[i] + 6;
+        }
+        else if (strncmp("--out=", argv[i], 6) == 0)
+        {
+            outFile = argv[i] + 6;
         }
     }
 
+    if (!lhsFile.empty() || !rhsFile.empty())
+    {
+        if (lhsFile.empty() || rhsFile.empty())
+        {
+            printf("--lhs and --rhs go together\n");
+            return -1;
+        }
+
+        multiplyFiles(lhsFile, rhsFile, outFile, useCSVOutput);
+        return 0;
+    }
+
     int size = atoi(argv[1]);
     srand (1);
 //    srand (time(NULL));
@@ -143,13 +1217,143 @@ int main(int argc, char** argv)
     Matrix lhs = Matrix::random(width, height, 4);
     Matrix rhs = lhs.transpose();
 
+    if (threadSweep)
+    {
+        while (count-- > 0)
+        {
+            measureThreadScaling(lhs, rhs, useCSVOutput);
+        }
+        return 0;
+    }
+
+    if (random)
+    {
+        while (count-- > 0)
+        {
+            measureRandom(size, useCSVOutput);
+        }
+        return 0;
+    }
+
+    if (strassen)
+    {
+        while (count-- > 0)
+        {
+            measureStrassen(size, useCSVOutput);
+        }
+        return 0;
+    }
+
+    if (fp64)
+    {
+        while (count-- > 0)
+        {
+            measureDouble(size, useCSVOutput);
+        }
+        return 0;
+    }
+
+    if (int8)
+    {
+        while (count-- > 0)
+        {
+            measureInt8(size, useCSVOutput);
+        }
+        return 0;
+    }
+
+    if (precision)
+    {
+        while (count-- > 0)
+        {
+            measurePrecision(size, useCSVOutput);
+        }
+        return 0;
+    }
+
+    if (transpose)
+    {
+        while (count-- > 0)
+        {
+            measureTranspose(lhs, useCSVOutput);
+        }
+        return 0;
+    }
+
+    if (gemm)
+    {
+        while (count-- > 0)
+        {
+            measureGemm(lhs, rhs, useCSVOutput);
+        }
+        return 0;
+    }
+
+    if (into)
+    {
+        while (count-- > 0)
+        {
+            measureInto(lhs, rhs, useCSVOutput);
+        }
+        return 0;
+    }
+
+    if (multiDevice)
+    {
+        MultiDeviceOperations multi(hostThreads, cpuPartition);
+        while (count-- > 0)
+        {
+            measureMultiDevice(multi, lhs, rhs, useCSVOutput);
+        }
+        return 0;
+    }
+
+    if (outOfCore)
+    {
+        while (count-- > 0)
+        {
+            measureOutOfCore(lhs, rhs, useCSVOutput);
+        }
+        return 0;
+    }
+
+    if (batch)
+    {
+        while (count-- > 0)
+        {
+            measureBatched(size, useCSVOutput);
+        }
+        return 0;
+    }
+
+    if (stream)
+    {
+        while (count-- > 0)
+        {
+            measureStream(lhs, rhs, useCSVOutput);
+        }
+        return 0;
+    }
+
+    if (autotune)
+    {
+        while (count-- > 0)
+        {
+            measureAutoTuning(lhs, rhs, specialize, useCSVOutput);
+        }
+        return 0;
+    }
+
+    Variants variants;
+    variants.setSpecialization(specialize);
+
     while (count-- > 0)
     {
-        Measurement result = measureMultiply(lhs, rhs);
+        Measurement result = measureMultiply(variants, lhs, rhs);
 
         if (useCSVOutput)
         {
-            printf("%d;%d; %.6f;%.6f;%.6f;%.6f;%.6f;%.6f\n",
+            printf("%d;%d; %.6f;%.6f;%.6f;%.6f;%.6f;%.6f;%.6f;%.6f;%.6f\n",
                     width,
                     height,
                     result.cpu,
@@ -157,16 +1361,23 @@ int main(int argc, char** argv)
                     result.transposed,
                     result.dot,
                     result.float4,
-                    result.constant);
+                    result.constant,
+                    result.tiled,
+                    result.block4x4,
+                    result.block8x4);
         }
         else
         {
-            printf("%dx%d CPU: %.6f \n", width, height, result.cpu);
-            printf("%dx%d GPU: %.6f \n", width, height, result.gpu);
-            printf("%dx%d TPU: %.6f \n", width, height, result.transposed);
-            printf("%dx%d DPU: %.6f \n", width, height, result.dot);
-            printf("%dx%d 4PU: %.6f \n", width, height, result.float4);
-            printf("%dx%d   1: %.6f \n", width, height, result.constant);
+            const double flops = 2.0 * width * width * height;
+            printf("%dx%d CPU: %.6f (%.2f GFLOP/s) \n", width, height, result.cpu, flops / result.cpu * 1e-9);
+            printf("%dx%d GPU: %.6f (%.2f GFLOP/s) \n", width, height, result.gpu, flops / result.gpu * 1e-9);
+            printf("%dx%d TPU: %.6f (%.2f GFLOP/s) \n", width, height, result.transposed, flops / result.transposed * 1e-9);
+            printf("%dx%d DPU: %.6f (%.2f GFLOP/s) \n", width, height, result.dot, flops / result.dot * 1e-9);
+            printf("%dx%d 4PU: %.6f (%.2f GFLOP/s) \n", width, height, result.float4, flops / result.float4 * 1e-9);
+            printf("%dx%d   1: %.6f (%.2f GFLOP/s) \n", width, height, result.constant, flops / result.constant * 1e-9);
+            printf("%dx%d TIL: %.6f (%.2f GFLOP/s) \n", width, height, result.tiled, flops / result.tiled * 1e-9);
+            printf("%dx%d B44: %.6f (%.2f GFLOP/s) \n", width, height, result.block4x4, flops / result.block4x4 * 1e-9);
+            printf("%dx%d B84: %.6f (%.2f GFLOP/s) \n", width, height, result.block8x4, flops / result.block8x4 * 1e-9);
             printf("\n");
         }
     }
@@ -3,73 +3,154 @@
 #include <cstdio>
 #include <cstdlib>
 
-Matrix::Matrix(int width, int height)
+template<typename T>
+BasicMatrix<T>::BasicMatrix(int width, int height)
     : m_width(width)
     , m_height(height)
-    , m_data(width * height)
+    , m_data((size_t)width * height, T(0))
 {
 }
 
-Matrix::Matrix(int width, int height, float filler)
+template<typename T>
+BasicMatrix<T>::BasicMatrix(int width, int height, T filler)
     : m_width(width)
     , m_height(height)
-    , m_data(width * height, filler)
+    , m_data((size_t)width * height, filler)
 {
 }
 
-Matrix::Matrix(const Matrix& matrix)
+template<typename T>
+BasicMatrix<T>::BasicMatrix(const BasicMatrix& matrix)
     : m_width(matrix.m_width)
     , m_height(matrix.m_height)
     , m_data(matrix.m_data)
 {
 }
 
-Matrix::Matrix(int width, int height, std::vector<float> data)
+template<typename T>
+BasicMatrix<T>::BasicMatrix(BasicMatrix&& matrix) noexcept
+    : m_width(matrix.m_width)
+    , m_height(matrix.m_height)
+    , m_data(std::move(matrix.m_data))
+{
+    matrix.m_width = 0;
+    matrix.m_height = 0;
+}
+
+template<typename T>
+BasicMatrix<T>::BasicMatrix(const BasicMatrixView<const T>& view)
+    : m_width(view.width())
+    , m_height(view.height())
+    , m_data((size_t)view.width() * view.height())
+{
+    for (int y = 0; y < m_height; y++)
+    {
+        std::copy(&view(0, y), &view(0, y) + m_width, &m_data[(size_t)y * m_width]);
+    }
+}
+
+template<typename T>
+BasicMatrix<T>& BasicMatrix<T>::operator=(const BasicMatrix& matrix)
+{
+    m_width = matrix.m_width;
+    m_height = matrix.m_height;
+    m_data = matrix.m_data;
+    return *this;
+}
+
+template<typename T>
+BasicMatrix<T>& BasicMatrix<T>::operator=(BasicMatrix&& matrix) noexcept
+{
+    m_width = matrix.m_width;
+    m_height = matrix.m_height;
+    m_data = std::move(matrix.m_data);
+    matrix.m_width = 0;
+    matrix.m_height = 0;
+    return *this;
+}
+
+template<typename T>
+BasicMatrix<T>::BasicMatrix(int width, int height, const std::vector<T>& data)
     : m_width(width)
     , m_height(height)
-    , m_data(data)
+    , m_data(data.begin(), data.end())
 {
 }
 
+template<typename T>
+BasicMatrix<T>::BasicMatrix(int width, int height, NoInit)
+    : m_width(width)
+    , m_height(height)
+    , m_data((size_t)width * height)
+{
+}
 
-Matrix Matrix::random(int width, int height, int limit)
+template<typename T>
+BasicMatrix<T> BasicMatrix<T>::random(int width, int height, int limit)
 {
-    std::vector<float> data(width * height);
+    BasicMatrix matrix(width, height, NoInit());
 
-    for (int i = 0; i < width * height; i++)
+    for (size_t i = 0; i < matrix.m_data.size(); i++)
     {
-        data[i] = rand() % limit;
+        matrix.m_data[i] = rand() % limit;
     }
 
-    return Matrix(width, height, data);
+    return matrix;
 }
 
-Matrix Matrix::transpose(void) const
+template<typename T>
+BasicMatrix<T> BasicMatrix<T>::uninitialized(int width, int height)
 {
-    int width = m_height;
-    int height = m_width;
-    std::vector<float> data(width * height);
+    return BasicMatrix(width, height, NoInit());
+}
 
-    for (int y = 0; y < m_height; y++)
+template<typename T>
+BasicMatrix<T> BasicMatrix<T>::transpose(void) const
+{
+    BasicMatrix matrix(m_height, m_width, NoInit());
+    transposeInto(matrix.view());
+    return matrix;
+}
+
+template<typename T>
+void BasicMatrix<T>::transposeInto(const BasicMatrixView<T>& destination) const
+{
+    if (destination.width() != m_height || destination.height() != m_width)
+    {
+        throw "transpose destination shape mismatch";
+    }
+
+    // Square blocks: the source rows and destination rows of a block stay in
+    // cache together, so neither side strides a whole row apart per element.
+    static const int BLOCK = 32;
+
+    for (int blockY = 0; blockY < m_height; blockY += BLOCK)
     {
-        for (int x = 0; x < m_width; x++)
+        const int endY = std::min(blockY + BLOCK, m_height);
+        for (int blockX = 0; blockX < m_width; blockX += BLOCK)
         {
-            data[x * width + y] = m_data[y * m_width + x];
+            const int endX = std::min(blockX + BLOCK, m_width);
+            for (int y = blockY; y < endY; y++)
+            {
+                for (int x = blockX; x < endX; x++)
+                {
+                    destination(y, x) = m_data[(size_t)y * m_width + x];
+                }
+            }
         }
     }
-
-    return Matrix(width, height, data);
 }
 
-bool Matrix::operator==(const Matrix& other)
+template<typename T>
+bool BasicMatrix<T>::operator==(const BasicMatrix& other) const
 {
     if (m_width != other.width() || m_height != other.height())
     {
         return false;
     }
 
-    int size = m_width * m_height;
-    for (int i = 0; i < size; i++)
+    const size_t size = m_data.size();
+    for (size_t i = 0; i < size; i++)
     {
         if (m_data[i] != other[i])
         {
@@ -80,7 +161,8 @@ bool Matrix::operator==(const Matrix& other)
     return true;
 }
 
-void print(Matrix& matrix)
+template<typename T>
+void print(const BasicMatrix<T>& matrix)
 {
     int height = matrix.height();
     int width = matrix.width();
@@ -88,8 +170,14 @@ void print(Matrix& matrix)
     {
         for (int x = 0; x < width; x++)
         {
-            printf("%.2f ", matrix[y * width + x]);
+            printf("%.2f ", (double)matrix[(size_t)y * width + x]);
         }
         printf("\n");
     }
 }
+
+template class BasicMatrix<float>;
+template class BasicMatrix<double>;
+
+template void print(const BasicMatrix<float>& matrix);
+template void print(const BasicMatrix<double>& matrix);
@@ -1,40 +1,204 @@
 #ifndef _MATRIX_HPP
 #define _MATRIX_HPP
 
-#include <vector>
+#include <cstdlib>
+
+#include <algorithm>
+#include <memory>
+#include <new>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-class Matrix
+// Allocator that default-initializes new elements. For float storage this
+// leaves fresh memory untouched, so its pages are placed (first-touch) by the
+// thread that fills them instead of by the thread that allocated them.
+template<typename T>
+class DefaultInitAllocator : public std::allocator<T>
 {
 public:
-    Matrix(int width, int height);
-    Matrix(int width, int height, float filler);
-    Matrix(const Matrix& matrix);
-    Matrix(int width, int height, std::vector<float> data);
+    template<typename U>
+    struct rebind { typedef DefaultInitAllocator<U> other; };
 
+    DefaultInitAllocator(void) {}
+    template<typename U>
+    DefaultInitAllocator(const DefaultInitAllocator<U>&) {}
 
-    static Matrix random(int width, int height, int limit);
+    template<typename U>
+    void construct(U* ptr) { ::new((void*)ptr) U; }
 
-    virtual int width(void) const { return m_width; }
-    virtual int height(void) const { return m_height; }
+    template<typename U, typename... Args>
+    void construct(U* ptr, Args&&... args) { ::new((void*)ptr) U(std::forward<Args>(args)...); }
+};
 
-    virtual float operator[](int idx) const { return m_data[idx]; }
-    virtual const float *data(void) const { return &m_data[0]; }
-    virtual int dataSize(void) const { return sizeof(float) * m_width * m_height; }
+// Alignment (and size granularity) of matrix storage. Page aligned memory
+// satisfies CL_DEVICE_MEM_BASE_ADDR_ALIGN of common devices, so OpenCL can
+// wrap it with CL_MEM_USE_HOST_PTR instead of copying it.
+static const size_t MATRIX_ALIGNMENT = 4096;
 
-    Matrix transpose(void) const;
+// DefaultInitAllocator handing out MATRIX_ALIGNMENT aligned blocks, padded to
+// a multiple of MATRIX_ALIGNMENT bytes.
+template<typename T>
+class AlignedAllocator : public DefaultInitAllocator<T>
+{
+public:
+    template<typename U>
+    struct rebind { typedef AlignedAllocator<U> other; };
 
-    bool operator==(const Matrix& other);
-    bool operator!=(const Matrix& other) { return !this->operator==(other); }
+    AlignedAllocator(void) {}
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t count, const void* = 0)
+    {
+        const size_t size = std::max(paddedSize(count * sizeof(T)), MATRIX_ALIGNMENT);
+
+        void* ptr = NULL;
+        if (posix_memalign(&ptr, MATRIX_ALIGNMENT, size) != 0)
+        {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t) { free(ptr); }
+
+    static size_t paddedSize(size_t size) { return (size + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT; }
+};
+
+template<typename T>
+class BasicMatrix;
+
+// Non-owning, row strided window on matrix data: element (x, y) is at
+// data()[y * stride() + x]. Views are cheap to copy and never allocate, the
+// viewed memory must outlive them. BasicMatrixView<const T> is the read-only
+// view, made from a const matrix or from a writable view; a writable view
+// needs a non-const matrix.
+template<typename T>
+class BasicMatrixView
+{
+public:
+    typedef typename std::remove_const<T>::type Element;
+
+    BasicMatrixView(T* data, int width, int height, int stride)
+        : m_data(data)
+        , m_width(width)
+        , m_height(height)
+        , m_stride(stride)
+    {}
+    BasicMatrixView(BasicMatrix<Element>& matrix);
+    template<typename U, typename = typename std::enable_if<std::is_same<const U, T>::value>::type>
+    BasicMatrixView(const BasicMatrix<U>& matrix);
+    template<typename U, typename = typename std::enable_if<std::is_same<const U, T>::value>::type>
+    BasicMatrixView(const BasicMatrixView<U>& view)
+        : m_data(view.data())
+        , m_width(view.width())
+        , m_height(view.height())
+        , m_stride(view.stride())
+    {}
+
+    int width(void) const { return m_width; }
+    int height(void) const { return m_height; }
+    int stride(void) const { return m_stride; }
+    T* data(void) const { return m_data; }
+    bool contiguous(void) const { return m_stride == m_width; }
+
+    T& operator()(int x, int y) const { return m_data[(size_t)y * m_stride + x]; }
+
+    // The width x height submatrix starting at column x, row y.
+    BasicMatrixView block(int x, int y, int width, int height) const
+    {
+        return BasicMatrixView(m_data + (size_t)y * m_stride + x, width, height, m_stride);
+    }
 
 private:
-    Matrix& operator=(Matrix&);
+    T* m_data;
+    int m_width;
+    int m_height;
+    int m_stride;
+};
+
+// Row-major width x height matrix of T in MATRIX_ALIGNMENT aligned storage.
+// Instantiated for float (Matrix, used by every engine) and double.
+template<typename T>
+class BasicMatrix
+{
+public:
+    typedef T Element;
+
+    BasicMatrix(int width, int height);
+    BasicMatrix(int width, int height, T filler);
+    BasicMatrix(const BasicMatrix& matrix);
+    BasicMatrix(BasicMatrix&& matrix) noexcept;
+    BasicMatrix(int width, int height, const std::vector<T>& data);
+    // Copies the viewed elements.
+    explicit BasicMatrix(const BasicMatrixView<const T>& view);
+
+    BasicMatrix& operator=(const BasicMatrix& matrix);
+    BasicMatrix& operator=(BasicMatrix&& matrix) noexcept;
+
+    static BasicMatrix random(int width, int height, int limit);
+    // Matrix with unspecified contents, to be filled completely by the caller.
+    static BasicMatrix uninitialized(int width, int height);
+
+    int width(void) const { return m_width; }
+    int height(void) const { return m_height; }
+
+    T operator[](size_t idx) const { return m_data[idx]; }
+    const T *data(void) const { return m_data.data(); }
+    T *data(void) { return m_data.data(); }
+    size_t dataSize(void) const { return sizeof(T) * m_width * m_height; }
+    // Bytes of the underlying allocation, dataSize() padded to whole MATRIX_ALIGNMENT blocks.
+    size_t storageSize(void) const { return AlignedAllocator<T>::paddedSize(dataSize()); }
+
+    BasicMatrixView<T> view(void) { return BasicMatrixView<T>(data(), m_width, m_height, m_width); }
+    BasicMatrixView<const T> view(void) const { return BasicMatrixView<const T>(data(), m_width, m_height, m_width); }
+
+    BasicMatrix transpose(void) const;
+    // Writes the transpose into destination, which must be height x width.
+    void transposeInto(const BasicMatrixView<T>& destination) const;
+
+    bool operator==(const BasicMatrix& other) const;
+    bool operator!=(const BasicMatrix& other) const { return !this->operator==(other); }
+
+private:
+    struct NoInit {};
+    BasicMatrix(int width, int height, NoInit);
 
     int m_width;
     int m_height;
-    std::vector<float> m_data;
+    std::vector<T, AlignedAllocator<T> > m_data;
 };
 
-void print(Matrix& matrix);
+template<typename T>
+inline BasicMatrixView<T>::BasicMatrixView(BasicMatrix<Element>& matrix)
+    : m_data(matrix.data())
+    , m_width(matrix.width())
+    , m_height(matrix.height())
+    , m_stride(matrix.width())
+{
+}
+
+template<typename T>
+template<typename U, typename>
+inline BasicMatrixView<T>::BasicMatrixView(const BasicMatrix<U>& matrix)
+    : m_data(matrix.data())
+    , m_width(matrix.width())
+    , m_height(matrix.height())
+    , m_stride(matrix.width())
+{
+}
+
+// Defined in matrix.cpp for these element types only.
+extern template class BasicMatrix<float>;
+extern template class BasicMatrix<double>;
+
+typedef BasicMatrix<float> Matrix;
+typedef BasicMatrixView<float> MatrixView;
+typedef BasicMatrixView<const float> ConstMatrixView;
+
+template<typename T>
+void print(const BasicMatrix<T>& matrix);
 
 #endif // _MATRIX_HPP
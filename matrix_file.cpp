@@ -0,0 +1,506 @@
+#include "matrix_file.hpp"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+
+#include <vector>
+
+static const char NATIVE_MAGIC[8] = { 'C', 'L', 'M', 'A', 'T', 'R', 'I', 'X' };
+static const uint32_t NATIVE_VERSION = 1;
+static const size_t NATIVE_HEADER_SIZE = 64;
+static const char NPY_MAGIC[6] = { '\x93', 'N', 'U', 'M', 'P', 'Y' };
+
+// Larger reads are split, Linux transfers at most about 2 GB per call.
+static const size_t READ_CHUNK = (size_t)1 << 30;
+
+static uint32_t readUint32(const unsigned char* bytes)
+{
+    return bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+static uint64_t readUint64(const unsigned char* bytes)
+{
+    return readUint32(bytes) | (uint64_t)readUint32(bytes + 4) << 32;
+}
+
+static void writeUint32(unsigned char* bytes, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static void writeUint64(unsigned char* bytes, uint64_t value)
+{
+    writeUint32(bytes, (uint32_t)value);
+    writeUint32(bytes + 4, (uint32_t)(value >> 32));
+}
+
+static bool endsWith(const std::string& text, const std::string& suffix)
+{
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static size_t elementSize(MatrixDataType type)
+{
+    return type == MATRIX_FLOAT64 ? sizeof(double) : sizeof(float);
+}
+
+// Bytes from the first element to the end of the last one.
+static size_t dataExtent(const MatrixFileInfo& info)
+{
+    const size_t lines = info.layout == MATRIX_ROW_MAJOR ? info.height : info.width;
+    const size_t lineLength = info.layout == MATRIX_ROW_MAJOR ? info.width : info.height;
+    if (lines == 0 || lineLength == 0)
+    {
+        return 0;
+    }
+
+    return ((lines - 1) * info.pitch + lineLength) * elementSize(info.type);
+}
+
+static bool readExactly(int fd, void* data, size_t size, size_t offset)
+{
+    char* bytes = static_cast<char*>(data);
+    while (size > 0)
+    {
+        const ssize_t count = pread(fd, bytes, std::min(size, READ_CHUNK), offset);
+        if (count <= 0)
+        {
+            return false;
+        }
+        bytes += count;
+        offset += count;
+        size -= count;
+    }
+
+    return true;
+}
+
+// The value following key in a .npy header dictionary, up to the next ',' (or ')' for a tuple).
+static std::string npyValue(const std::string& header, const std::string& key)
+{
+    size_t pos = header.find("'" + key + "'");
+    if (pos == std::string::npos || (pos = header.find(':', pos)) == std::string::npos)
+    {
+        throw "matrix file format";
+    }
+
+    pos = header.find_first_not_of(' ', pos + 1);
+    if (pos == std::string::npos)
+    {
+        throw "matrix file format";
+    }
+
+    const size_t end = header.find(header[pos] == '(' ? ')' : ',', pos);
+    if (end == std::string::npos)
+    {
+        throw "matrix file format";
+    }
+
+    return header.substr(pos, end - pos + (header[pos] == '(' ? 1 : 0));
+}
+
+static MatrixFileInfo parseNpy(FILE* file)
+{
+    unsigned char prefix[12];
+    if (fread(prefix, 1, 10, file) != 10 || memcmp(prefix, NPY_MAGIC, sizeof(NPY_MAGIC)) != 0)
+    {
+        throw "matrix file format";
+    }
+
+    // Version 1 has a 16 bit header length, versions 2 and 3 a 32 bit one.
+    size_t headerLength;
+    size_t prefixLength;
+    if (prefix[6] == 1)
+    {
+        headerLength = prefix[8] | (size_t)prefix[9] << 8;
+        prefixLength = 10;
+    }
+    else if ((prefix[6] == 2 || prefix[6] == 3) && fread(prefix + 10, 1, 2, file) == 2)
+    {
+        headerLength = readUint32(prefix + 8);
+        prefixLength = 12;
+    }
+    else
+    {
+        throw "matrix file format";
+    }
+
+    std::string header(headerLength, ' ');
+    if (fread(&header[0], 1, headerLength, file) != headerLength)
+    {
+        throw "matrix file format";
+    }
+
+    MatrixFileInfo info;
+    info.npy = true;
+    info.dataOffset = prefixLength + headerLength;
+
+    const std::string descr = npyValue(header, "descr");
+    if (descr == "'<f4'")
+    {
+        info.type = MATRIX_FLOAT32;
+    }
+    else if (descr == "'<f8'")
+    {
+        info.type = MATRIX_FLOAT64;
+    }
+    else
+    {
+        throw "matrix file type not supported";
+    }
+
+    info.layout = npyValue(header, "fortran_order").compare(0, 4, "True") == 0 ? MATRIX_COLUMN_MAJOR : MATRIX_ROW_MAJOR;
+
+    // "(rows, columns)" or "(columns,)" for a single row.
+    const std::string shape = npyValue(header, "shape");
+    std::vector<long long> dims;
+    for (const char* pos = shape.c_str() + 1; *pos != ')' && *pos != '\0'; )
+    {
+        char* end;
+        const long long dim = strtoll(pos, &end, 10);
+        if (end == pos)
+        {
+            break;
+        }
+        dims.push_back(dim);
+        pos = end + strspn(end, ", ");
+    }
+
+    if (dims.size() == 1)
+    {
+        dims.insert(dims.begin(), 1);
+    }
+    if (dims.size() != 2 || dims[0] < 0 || dims[1] < 0 || dims[0] > INT_MAX || dims[1] > INT_MAX)
+    {
+        throw "matrix file format";
+    }
+
+    info.height = (int)dims[0];
+    info.width = (int)dims[1];
+    info.pitch = info.layout == MATRIX_ROW_MAJOR ? info.width : info.height;
+
+    return info;
+}
+
+static MatrixFileInfo parseNative(FILE* file)
+{
+    unsigned char header[NATIVE_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, NATIVE_MAGIC, sizeof(NATIVE_MAGIC)) != 0
+        || readUint32(header + 8) != NATIVE_VERSION)
+    {
+        throw "matrix file format";
+    }
+
+    const uint32_t type = readUint32(header + 12);
+    const uint32_t layout = readUint32(header + 16);
+    const uint32_t alignment = readUint32(header + 20);
+    const uint64_t height = readUint64(header + 24);
+    const uint64_t width = readUint64(header + 32);
+    if ((type != MATRIX_FLOAT32 && type != MATRIX_FLOAT64) || (layout != MATRIX_ROW_MAJOR && layout != MATRIX_COLUMN_MAJOR)
+        || height > INT_MAX || width > INT_MAX || readUint64(header + 40) > INT_MAX)
+    {
+        throw "matrix file format";
+    }
+
+    MatrixFileInfo info;
+    info.npy = false;
+    info.type = (MatrixDataType)type;
+    info.layout = (MatrixLayout)layout;
+    info.height = (int)height;
+    info.width = (int)width;
+    info.pitch = readUint64(header + 40);
+    info.dataOffset = readUint64(header + 48);
+
+    // The alignment is a power of two the data offset is a multiple of.
+    if (info.pitch < (size_t)(info.layout == MATRIX_ROW_MAJOR ? info.width : info.height) || info.dataOffset < NATIVE_HEADER_SIZE
+        || alignment == 0 || (alignment & (alignment - 1)) != 0 || info.dataOffset % alignment != 0)
+    {
+        throw "matrix file format";
+    }
+
+    return info;
+}
+
+MatrixFileInfo readMatrixInfo(const std::string& filename)
+{
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (file == NULL)
+    {
+        throw "matrix file open fail";
+    }
+
+    char magic[sizeof(NPY_MAGIC)];
+    const bool npy = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, NPY_MAGIC, sizeof(magic)) == 0;
+    rewind(file);
+
+    MatrixFileInfo info;
+    struct stat status;
+    try
+    {
+        info = npy ? parseNpy(file) : parseNative(file);
+        if (fstat(fileno(file), &status) != 0)
+        {
+            throw "matrix file open fail";
+        }
+    }
+    catch (...)
+    {
+        fclose(file);
+        throw;
+    }
+    fclose(file);
+
+    if ((size_t)status.st_size < info.dataOffset + dataExtent(info))
+    {
+        throw "matrix file truncated";
+    }
+
+    return info;
+}
+
+// The file data as floats in row major order.
+static void convert(const char* data, const MatrixFileInfo& info, const MatrixView& result)
+{
+    const size_t rowStep = info.layout == MATRIX_ROW_MAJOR ? info.pitch : 1;
+    const size_t columnStep = info.layout == MATRIX_ROW_MAJOR ? 1 : info.pitch;
+
+    for (int y = 0; y < info.height; y++)
+    {
+        float* row = &result(0, y);
+        for (int x = 0; x < info.width; x++)
+        {
+            const size_t index = y * rowStep + x * columnStep;
+            row[x] = info.type == MATRIX_FLOAT64 ? (float)reinterpret_cast<const double*>(data)[index]
+                                                 : reinterpret_cast<const float*>(data)[index];
+        }
+    }
+}
+
+static void* mapFile(const std::string& filename, size_t size)
+{
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw "matrix file open fail";
+    }
+
+    // The mapping keeps its own reference to the file.
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        throw "matrix file map fail";
+    }
+
+    return mapping;
+}
+
+MappedMatrix::MappedMatrix(const std::string& filename)
+    : m_info(readMatrixInfo(filename))
+    , m_mapping(NULL)
+    , m_mappingSize(m_info.dataOffset + dataExtent(m_info))
+    , m_view(NULL, 0, 0, 0)
+{
+    if (dataExtent(m_info) == 0)
+    {
+        m_copy.reset(new Matrix(m_info.width, m_info.height));
+        m_view = ConstMatrixView(*m_copy);
+        return;
+    }
+
+    m_mapping = mapFile(filename, m_mappingSize);
+    const char* data = static_cast<const char*>(m_mapping) + m_info.dataOffset;
+
+    // Rows of floats can be viewed as they are, a Matrix only needs its elements 4 byte aligned.
+    if (m_info.type == MATRIX_FLOAT32 && m_info.layout == MATRIX_ROW_MAJOR && m_info.dataOffset % sizeof(float) == 0)
+    {
+        m_view = ConstMatrixView(reinterpret_cast<const float*>(data), m_info.width, m_info.height, (int)m_info.pitch);
+        return;
+    }
+
+    madvise(m_mapping, m_mappingSize, MADV_SEQUENTIAL);
+    m_copy.reset(new Matrix(Matrix::uninitialized(m_info.width, m_info.height)));
+    m_view = ConstMatrixView(*m_copy);
+    convert(data, m_info, m_copy->view());
+
+    munmap(m_mapping, m_mappingSize);
+    m_mapping = NULL;
+}
+
+MappedMatrix::~MappedMatrix(void)
+{
+    if (m_mapping != NULL)
+    {
+        munmap(m_mapping, m_mappingSize);
+    }
+}
+
+Matrix loadMatrix(const std::string& filename)
+{
+    const MatrixFileInfo info = readMatrixInfo(filename);
+    if (info.type != MATRIX_FLOAT32 || info.layout != MATRIX_ROW_MAJOR)
+    {
+        const MappedMatrix mapped(filename);
+        return Matrix(mapped.view());
+    }
+
+    Matrix matrix = Matrix::uninitialized(info.width, info.height);
+
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw "matrix file open fail";
+    }
+
+    // Straight into the matrix storage, row by row only when the file pads its rows.
+    const size_t rowSize = sizeof(float) * info.width;
+    bool complete = true;
+    if (info.pitch == (size_t)info.width)
+    {
+        complete = readExactly(fd, matrix.data(), rowSize * info.height, info.dataOffset);
+    }
+    else
+    {
+        for (int y = 0; complete && y < info.height; y++)
+        {
+            complete = readExactly(fd, matrix.data() + (size_t)y * info.width, rowSize, info.dataOffset + sizeof(float) * info.pitch * y);
+        }
+    }
+    close(fd);
+
+    if (!complete)
+    {
+        throw "matrix file truncated";
+    }
+
+    return matrix;
+}
+
+MatrixWriter::MatrixWriter(const std::string& filename, int width, int height)
+    : m_filename(filename)
+    , m_file(NULL)
+    , m_width(width)
+    , m_height(height)
+    , m_rowsWritten(0)
+{
+    // The data starts at MATRIX_ALIGNMENT in both formats.
+    std::vector<unsigned char> header(MATRIX_ALIGNMENT, 0);
+    if (endsWith(filename, ".npy"))
+    {
+        // Version 1: 10 bytes of prefix, the dictionary padded with spaces up to a closing newline.
+        const size_t headerLength = MATRIX_ALIGNMENT - 10;
+        char dictionary[128];
+        snprintf(dictionary, sizeof(dictionary), "{'descr': '<f4', 'fortran_order': False, 'shape': (%d, %d), }", height, width);
+
+        memcpy(&header[0], NPY_MAGIC, sizeof(NPY_MAGIC));
+        header[6] = 1;
+        header[7] = 0;
+        header[8] = (unsigned char)headerLength;
+        header[9] = (unsigned char)(headerLength >> 8);
+        memset(&header[10], ' ', headerLength);
+        memcpy(&header[10], dictionary, strlen(dictionary));
+        header[MATRIX_ALIGNMENT - 1] = '\n';
+    }
+    else
+    {
+        memcpy(&header[0], NATIVE_MAGIC, sizeof(NATIVE_MAGIC));
+        writeUint32(&header[8], NATIVE_VERSION);
+        writeUint32(&header[12], MATRIX_FLOAT32);
+        writeUint32(&header[16], MATRIX_ROW_MAJOR);
+        writeUint32(&header[20], MATRIX_ALIGNMENT);
+        writeUint64(&header[24], height);
+        writeUint64(&header[32], width);
+        writeUint64(&header[40], width);
+        writeUint64(&header[48], MATRIX_ALIGNMENT);
+    }
+
+    m_file = fopen(filename.c_str(), "wb");
+    if (m_file == NULL)
+    {
+        throw "matrix file open fail";
+    }
+
+    if (fwrite(&header[0], 1, header.size(), m_file) != header.size())
+    {
+        fclose(m_file);
+        m_file = NULL;
+        throw "matrix file write fail";
+    }
+}
+
+MatrixWriter::~MatrixWriter(void)
+{
+    if (m_file == NULL)
+    {
+        return;
+    }
+
+    const bool flushed = fclose(m_file) == 0;
+    if (!flushed || m_rowsWritten != m_height)
+    {
+        fprintf(stderr, "%s: incomplete matrix file, %d of %d rows written%s\n",
+                m_filename.c_str(), m_rowsWritten, m_height, flushed ? "" : ", flush failed");
+    }
+}
+
+void MatrixWriter::write(const ConstMatrixView& rows)
+{
+    if (m_file == NULL || rows.width() != m_width || m_rowsWritten + rows.height() > m_height)
+    {
+        throw "matrix file write fail";
+    }
+
+    const size_t rowSize = sizeof(float) * m_width;
+    if (rows.contiguous())
+    {
+        const size_t size = rowSize * rows.height();
+        if (fwrite(rows.data(), 1, size, m_file) != size)
+        {
+            throw "matrix file write fail";
+        }
+    }
+    else
+    {
+        for (int y = 0; y < rows.height(); y++)
+        {
+            if (fwrite(&rows(0, y), 1, rowSize, m_file) != rowSize)
+            {
+                throw "matrix file write fail";
+            }
+        }
+    }
+
+    m_rowsWritten += rows.height();
+}
+
+void MatrixWriter::close(void)
+{
+    if (m_file == NULL)
+    {
+        return;
+    }
+
+    const bool flushed = fclose(m_file) == 0;
+    m_file = NULL;
+    if (!flushed || m_rowsWritten != m_height)
+    {
+        throw "matrix file write fail";
+    }
+}
+
+void saveMatrix(const std::string& filename, const ConstMatrixView& matrix)
+{
+    MatrixWriter writer(filename, matrix.width(), matrix.height());
+    writer.write(matrix);
+    writer.close();
+}
@@ -0,0 +1,119 @@
+#ifndef _MATRIX_FILE_HPP
+#define _MATRIX_FILE_HPP
+
+#include <cstdio>
+
+#include <memory>
+#include <string>
+
+#include "matrix.hpp"
+
+// Binary matrix files, large enough that they are mapped rather than read.
+//
+// The native format is a 64 byte little-endian header followed by the
+// elements:
+//
+//   char     magic[8]      "CLMATRIX"
+//   uint32_t version       1
+//   uint32_t type          MatrixDataType
+//   uint32_t layout        MatrixLayout
+//   uint32_t alignment     the data offset is a multiple of it
+//   uint64_t height
+//   uint64_t width
+//   uint64_t pitch         elements from one row (column major: column) to the next
+//   uint64_t dataOffset    bytes from the start of the file
+//
+// NumPy .npy files (version 1 to 3, little-endian '<f4' or '<f8', C or
+// Fortran order, one or two dimensions) are read as well, a file name
+// ending in .npy is written as one. Both are written fp32, row major, with
+// the data at a MATRIX_ALIGNMENT offset, so a mapped file can be wrapped
+// with CL_MEM_USE_HOST_PTR like Matrix storage.
+enum MatrixDataType
+{
+    MATRIX_FLOAT32 = 1,
+    MATRIX_FLOAT64 = 2
+};
+
+enum MatrixLayout
+{
+    MATRIX_ROW_MAJOR = 0,
+    MATRIX_COLUMN_MAJOR = 1
+};
+
+struct MatrixFileInfo
+{
+    int width;
+    int height;
+    MatrixDataType type;
+    MatrixLayout layout;
+    size_t pitch;
+    size_t dataOffset;
+    bool npy;
+};
+
+// The header of a native or .npy file, throws "matrix file format" for anything else.
+MatrixFileInfo readMatrixInfo(const std::string& filename);
+
+// A matrix file mapped read-only. An fp32 row major file is viewed in place
+// (the pages are read on first touch, a view of a large file costs no memory
+// until used), other files are converted into a Matrix owned by the object.
+class MappedMatrix
+{
+public:
+    explicit MappedMatrix(const std::string& filename);
+    ~MappedMatrix(void);
+
+    const MatrixFileInfo& info(void) const { return m_info; }
+    // Whether view() points into the mapping rather than at a converted copy.
+    bool mapped(void) const { return !m_copy; }
+    // Valid as long as this object.
+    const ConstMatrixView& view(void) const { return m_view; }
+
+private:
+    MappedMatrix(const MappedMatrix&);
+    MappedMatrix& operator=(const MappedMatrix&);
+
+    MatrixFileInfo m_info;
+    void* m_mapping;
+    size_t m_mappingSize;
+    std::unique_ptr<Matrix> m_copy;
+    ConstMatrixView m_view;
+};
+
+// The whole file in Matrix storage, fp32 row major files are read straight
+// into it, others are converted through a mapping.
+Matrix loadMatrix(const std::string& filename);
+
+// Writes a width x height fp32 matrix row block by row block, so a result
+// can go out as it comes back without being held whole. The header is
+// written first, close() checks all rows were written and throws otherwise.
+// The destructor cannot throw: a writer destroyed before close() (say while
+// an exception unwinds) reports the missing rows on stderr, and the short
+// file is rejected as truncated when read.
+class MatrixWriter
+{
+public:
+    MatrixWriter(const std::string& filename, int width, int height);
+    ~MatrixWriter(void);
+
+    // Appends the rows of the view, its width must be the file's.
+    void write(const ConstMatrixView& rows);
+    // Throws "matrix file write fail" when rows are missing or the data did not reach the file.
+    void close(void);
+
+    int rowsWritten(void) const { return m_rowsWritten; }
+
+private:
+    MatrixWriter(const MatrixWriter&);
+    MatrixWriter& operator=(const MatrixWriter&);
+
+    std::string m_filename;
+    FILE* m_file;
+    int m_width;
+    int m_height;
+    int m_rowsWritten;
+};
+
+void saveMatrix(const std::string& filename, const ConstMatrixView& matrix);
+
+#endif // _MATRIX_FILE_HPP
@@ -0,0 +1,21 @@
+// C (+)= A * B on packed tiles: A is M x K, B is K x N and C is M x N, the
+// range is N x M. With accumulate set the products are added to what C holds,
+// so a C tile is summed up over its K tiles in order.
+//
+// The products are accumulated with fma() in plain k order, the same order
+// (and rounding) as the FMA micro-kernels of the CPU engine.
+
+__kernel void matrix_mul_accumulate(__global const float* A, __global const float* B, __global float* C,
+                                    int N, int K, int accumulate)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+
+    float result = accumulate ? C[y * N + x] : 0.0f;
+    for (int i = 0; i < K; i++)
+    {
+        result = fma(A[y * K + i], B[i * N + x], result);
+    }
+
+    C[y * N + x] = result;
+}
@@ -0,0 +1,58 @@
+// Batched multiply: one launch covers a whole batch of independent products,
+// get_global_id(2) is the index of the matrix in the batch. The matrices of a
+// batch are packed back to back (row major) in A, B and C.
+//
+// The products are accumulated with fma() in plain k order, the same order
+// (and rounding) as the FMA micro-kernels of the CPU engine.
+
+// Uniform batch: every product is (M x K) * (K x N), the range is N x M x count.
+__kernel void matrix_mul_uniform(__global const float* A, __global const float* B, __global float* C,
+                                 int M, int N, int K)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const size_t batch = get_global_id(2);
+
+    __global const float* a = A + batch * M * K + y * K;
+    __global const float* b = B + batch * K * N + x;
+
+    float result = 0;
+    for (int i = 0; i < K; i++)
+    {
+        result = fma(a[i], b[i * N], result);
+    }
+
+    C[batch * M * N + y * N + x] = result;
+}
+
+// Variable batch: descriptors holds M, N, K and the offsets of A, B and C (in
+// floats) for every product. The range covers the largest product, items
+// outside a smaller one return right away.
+#define DESCRIPTOR_SIZE 6
+
+__kernel void matrix_mul_variable(__global const float* A, __global const float* B, __global float* C,
+                                  __global const int* descriptors)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    __global const int* descriptor = descriptors + get_global_id(2) * DESCRIPTOR_SIZE;
+
+    const int M = descriptor[0];
+    const int N = descriptor[1];
+    const int K = descriptor[2];
+    if (x >= N || y >= M)
+    {
+        return;
+    }
+
+    __global const float* a = A + descriptor[3] + y * K;
+    __global const float* b = B + descriptor[4] + x;
+
+    float result = 0;
+    for (int i = 0; i < K; i++)
+    {
+        result = fma(a[i], b[i * N], result);
+    }
+
+    C[descriptor[5] + y * N + x] = result;
+}
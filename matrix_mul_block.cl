@@ -0,0 +1,201 @@
+// Register blocked multiply: every work-item computes a BLOCK_M x 4 block of C
+// held in BLOCK_M float4 accumulators.
+//
+// BLOCK_M (rows per item) and K_VEC (4 or 8) are set at build time. Rows of A
+// are read K_VEC values at a time with vload4/vload8, rows of B four columns
+// at a time with vload4, and the K loop is unrolled by K_VEC. Blocks on the
+// right/bottom edge of C and the K tail fall back to scalar code, so M, N and
+// K do not have to be multiples of the block size.
+#ifndef BLOCK_M
+#define BLOCK_M 4
+#endif
+
+#ifndef K_VEC
+#define K_VEC 4
+#endif
+
+#if K_VEC == 8
+#define floatK float8
+#define vloadK vload8
+#else
+#define floatK float4
+#define vloadK vload4
+#endif
+
+// Shape specialization: built with -DMATRIX_M/N/K the size arguments
+// become compile-time constants.
+#ifdef MATRIX_K
+#define WIDTH_A MATRIX_K
+#define WIDTH_B MATRIX_N
+#define HEIGHT_A MATRIX_M
+#else
+#define WIDTH_A width_A
+#define WIDTH_B width_B
+#define HEIGHT_A height_A
+#endif
+
+// Built with -DTRANS_A=1 / -DTRANS_B=1 A is stored K x M / B is stored N x K
+// and the kernels compute with its transpose. WIDTH_A, WIDTH_B and HEIGHT_A
+// are always K, N and M of the product. A transposed operand is gathered
+// element by element instead of with vloads.
+#ifndef TRANS_A
+#define TRANS_A 0
+#endif
+#ifndef TRANS_B
+#define TRANS_B 0
+#endif
+
+#if TRANS_A
+#define LOAD_A(row, i) A[(i) * HEIGHT_A + (row)]
+#if K_VEC == 8
+#define LOAD_AK(row, i) (float8)(LOAD_A(row, i), LOAD_A(row, i + 1), LOAD_A(row, i + 2), LOAD_A(row, i + 3), \
+                                 LOAD_A(row, i + 4), LOAD_A(row, i + 5), LOAD_A(row, i + 6), LOAD_A(row, i + 7))
+#else
+#define LOAD_AK(row, i) (float4)(LOAD_A(row, i), LOAD_A(row, i + 1), LOAD_A(row, i + 2), LOAD_A(row, i + 3))
+#endif
+#else
+#define LOAD_A(row, i) A[(row) * WIDTH_A + (i)]
+#define LOAD_AK(row, i) vloadK(0, A + (row) * WIDTH_A + (i))
+#endif
+
+#if TRANS_B
+#define LOAD_B(i, column) B[(column) * WIDTH_A + (i)]
+#define LOAD_B4(i, column) (float4)(LOAD_B(i, column), LOAD_B(i, column + 1), LOAD_B(i, column + 2), LOAD_B(i, column + 3))
+#else
+#define LOAD_B(i, column) B[(i) * WIDTH_B + (column)]
+#define LOAD_B4(i, column) vload4(0, B + (i) * WIDTH_B + (column))
+#endif
+
+// Must match GpuOperations::gemm()
+#define EPILOGUE_BIAS 1
+#define EPILOGUE_RELU 2
+
+float4 epilogue4(float4 value, __global const float* bias, int x, int flags, float scale)
+{
+    if (flags & EPILOGUE_BIAS)
+    {
+        value += vload4(0, bias + x);
+    }
+    if (flags & EPILOGUE_RELU)
+    {
+        value = fmax(value, (float4)(0.0f));
+    }
+    return value * scale;
+}
+
+float epilogue(float value, __global const float* bias, int x, int flags, float scale)
+{
+    if (flags & EPILOGUE_BIAS)
+    {
+        value += bias[x];
+    }
+    if (flags & EPILOGUE_RELU)
+    {
+        value = fmax(value, 0.0f);
+    }
+    return value * scale;
+}
+
+// The block of C = epilogue(alpha * op(A) * op(B) + beta * C) of this item.
+// alpha scales A as it is loaded, with beta 0 C is not read. matrix_mul runs
+// it with the identity (alpha 1, beta 0, no epilogue).
+void block_product(__global const float* A, __global const float* B, __global float* C, __global const float* bias,
+                   int width_A, int width_B, int height_A, int flags, float alpha, float beta, float scale)
+{
+    const int x = get_global_id(0) * 4;
+    const int y = get_global_id(1) * BLOCK_M;
+
+    if (x >= WIDTH_B || y >= HEIGHT_A)
+    {
+        return;
+    }
+
+    const int rows = min(BLOCK_M, HEIGHT_A - y);
+    const int cols = min(4, WIDTH_B - x);
+
+    if (rows < BLOCK_M || cols < 4)
+    {
+        // Edge block
+        for (int r = 0; r < rows; r++)
+        {
+            for (int c = 0; c < cols; c++)
+            {
+                float result = beta != 0.0f ? beta * C[(y + r) * WIDTH_B + x + c] : 0.0f;
+                for (int i = 0; i < WIDTH_A; i++)
+                {
+                    result = fma(alpha * LOAD_A(y + r, i), LOAD_B(i, x + c), result);
+                }
+                C[(y + r) * WIDTH_B + x + c] = epilogue(result, bias, x + c, flags, scale);
+            }
+        }
+        return;
+    }
+
+    float4 acc[BLOCK_M];
+#pragma unroll
+    for (int r = 0; r < BLOCK_M; r++)
+    {
+        acc[r] = beta != 0.0f ? beta * vload4(0, C + (y + r) * WIDTH_B + x) : (float4)(0.0f);
+    }
+
+    int i = 0;
+    for (; i + K_VEC <= WIDTH_A; i += K_VEC)
+    {
+        const float4 b0 = LOAD_B4(i + 0, x);
+        const float4 b1 = LOAD_B4(i + 1, x);
+        const float4 b2 = LOAD_B4(i + 2, x);
+        const float4 b3 = LOAD_B4(i + 3, x);
+#if K_VEC == 8
+        const float4 b4 = LOAD_B4(i + 4, x);
+        const float4 b5 = LOAD_B4(i + 5, x);
+        const float4 b6 = LOAD_B4(i + 6, x);
+        const float4 b7 = LOAD_B4(i + 7, x);
+#endif
+
+#pragma unroll
+        for (int r = 0; r < BLOCK_M; r++)
+        {
+            const floatK a = alpha * LOAD_AK(y + r, i);
+            acc[r] = fma((float4)(a.s0), b0, acc[r]);
+            acc[r] = fma((float4)(a.s1), b1, acc[r]);
+            acc[r] = fma((float4)(a.s2), b2, acc[r]);
+            acc[r] = fma((float4)(a.s3), b3, acc[r]);
+#if K_VEC == 8
+            acc[r] = fma((float4)(a.s4), b4, acc[r]);
+            acc[r] = fma((float4)(a.s5), b5, acc[r]);
+            acc[r] = fma((float4)(a.s6), b6, acc[r]);
+            acc[r] = fma((float4)(a.s7), b7, acc[r]);
+#endif
+        }
+    }
+
+    // K tail
+    for (; i < WIDTH_A; i++)
+    {
+        const float4 b = LOAD_B4(i, x);
+#pragma unroll
+        for (int r = 0; r < BLOCK_M; r++)
+        {
+            acc[r] = fma((float4)(alpha * LOAD_A(y + r, i)), b, acc[r]);
+        }
+    }
+
+#pragma unroll
+    for (int r = 0; r < BLOCK_M; r++)
+    {
+        vstore4(epilogue4(acc[r], bias, x, flags, scale), 0, C + (y + r) * WIDTH_B + x);
+    }
+}
+
+__kernel void matrix_mul(__global const float* A, __global const float* B, __global float* C,
+                         int width_A, int width_B, int height_A)
+{
+    block_product(A, B, C, NULL, width_A, width_B, height_A, 0, 1.0f, 0.0f, 1.0f);
+}
+
+// The epilogue as in matrix_mul_gemm.cl
+__kernel void gemm(__global const float* A, __global const float* B, __global float* C, __global const float* bias,
+                   int width_A, int width_B, int height_A, int flags, float alpha, float beta, float scale)
+{
+    block_product(A, B, C, bias, width_A, width_B, height_A, flags, alpha, beta, scale);
+}
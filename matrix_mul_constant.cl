@@ -1,13 +1,32 @@
-__kernel void matrix_mul(__global float* A, __global float* B, __global float* C, int width_A, int width_B)
+// Element type, built with -DREAL=double -DREAL_FP64 for double precision.
+#ifndef REAL
+#define REAL float
+#endif
+
+#ifdef REAL_FP64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+// Shape specialization: built with -DMATRIX_M/N/K the size arguments
+// become compile-time constants.
+#ifdef MATRIX_K
+#define WIDTH_A MATRIX_K
+#define WIDTH_B MATRIX_N
+#else
+#define WIDTH_A width_A
+#define WIDTH_B width_B
+#endif
+
+__kernel void matrix_mul(__global REAL* A, __global REAL* B, __global REAL* C, int width_A, int width_B)
 {
     int x = get_global_id(0);
     int y = get_global_id(1);
 
-    float result = 0;
-    for (int i = 0; i < width_A; i++)
+    REAL result = 0;
+    for (int i = 0; i < WIDTH_A; i++)
     {
         result += 1;
     }
 
-    C[y * width_B + x] = result;
+    C[y * WIDTH_B + x] = result;
 }
@@ -1,17 +1,47 @@
-__kernel void matrix_mul(__global float* A, __global float* B, __global float* C, int width_A, int width_B)
+// Element type, built with -DREAL=double -DREAL_FP64 for double precision.
+#ifndef REAL
+#define REAL float
+#endif
+
+#ifdef REAL_FP64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+#define CONCAT(a, b) a##b
+#define VECTOR4(type) CONCAT(type, 4)
+#define REAL4 VECTOR4(REAL)
+
+// Shape specialization: built with -DMATRIX_M/N/K the size arguments
+// become compile-time constants.
+#ifdef MATRIX_K
+#define WIDTH_A MATRIX_K
+#define WIDTH_B MATRIX_N
+#else
+#define WIDTH_A width_A
+#define WIDTH_B width_B
+#endif
+
+__kernel void matrix_mul(__global REAL* A, __global REAL* B, __global REAL* C, int width_A, int width_B)
 {
     int x = get_global_id(0);
     int y = get_global_id(1);
 
-    float result = 0;
-    float4 lhs;
-    float4 rhs;
-    for (int i = 0; i < width_A; i+=4)
+    REAL result = 0;
+    REAL4 lhs;
+    REAL4 rhs;
+    int i;
+    for (i = 0; i + 4 <= WIDTH_A; i+=4)
     {
-        lhs = (float4)(A[y * width_A + i + 0], A[y * width_A + i + 1], A[y * width_A + i + 2], A[y * width_A + i + 3]);
-        rhs = (float4)(B[i * width_B + x], B[(i + 1) * width_B + x], B[(i + 2) * width_B + x], B[(i + 3) * width_B + x]);
+        lhs = (REAL4)(A[y * WIDTH_A + i + 0], A[y * WIDTH_A + i + 1], A[y * WIDTH_A + i + 2], A[y * WIDTH_A + i + 3]);
+        rhs = (REAL4)(B[i * WIDTH_B + x], B[(i + 1) * WIDTH_B + x], B[(i + 2) * WIDTH_B + x], B[(i + 3) * WIDTH_B + x]);
         result += dot(lhs, rhs);
     }
 
-    C[y * width_B + x] = result;
+    // Tail when width_A is not a multiple of 4
+    for (; i < WIDTH_A; i++)
+    {
+        result += A[y * WIDTH_A + i] * B[i * WIDTH_B + x];
+    }
+
+    C[y * WIDTH_B + x] = result;
 }
@@ -0,0 +1,42 @@
+// C = epilogue(alpha * op(A) * op(B) + beta * C), the range is N x M.
+//
+// The transposes are folded into the indexing: element (i, p) of op(A) is
+// A[i * aRow + p * aDepth] and element (p, j) of op(B) is B[p * bDepth + j * bColumn],
+// so a transposed operand only swaps its strides. With beta 0 C is not read.
+//
+// The epilogue runs right before the store: bias[j] is added to column j,
+// negative values are clamped to 0 and the result is multiplied by scale.
+//
+// alpha scales A and the products are accumulated onto beta * C with fma() in
+// plain k order, the same order (and rounding) as the CPU engine.
+
+#define EPILOGUE_BIAS 1
+#define EPILOGUE_RELU 2
+
+__kernel void gemm(__global const float* A, __global const float* B, __global float* C, __global const float* bias,
+                   int N, int K, int aRow, int aDepth, int bDepth, int bColumn, int flags,
+                   float alpha, float beta, float scale)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+
+    __global const float* a = A + y * aRow;
+    __global const float* b = B + x * bColumn;
+
+    float result = beta != 0.0f ? beta * C[y * N + x] : 0.0f;
+    for (int i = 0; i < K; i++)
+    {
+        result = fma(alpha * a[i * aDepth], b[i * bDepth], result);
+    }
+
+    if (flags & EPILOGUE_BIAS)
+    {
+        result += bias[x];
+    }
+    if (flags & EPILOGUE_RELU)
+    {
+        result = fmax(result, 0.0f);
+    }
+
+    C[y * N + x] = result * scale;
+}
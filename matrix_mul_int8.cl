@@ -0,0 +1,44 @@
+// int8 x int8 -> int32 products scaled as they are stored, the range is N x M.
+// A is M x K4 char4 vectors (rows zero padded), B is packed transposed as
+// N x K4 char4 vectors, so a work-item reads both along contiguous memory.
+// Every element of C has the scale lhsScales[y] * rhsScales[x].
+//
+// The float operations and their order match CpuInt8Operations, so both give
+// the same bits.
+
+static int dotRow(__global const char4* a, __global const char4* b, int K4)
+{
+    int sum = 0;
+    for (int i = 0; i < K4; i++)
+    {
+        const int4 products = convert_int4(a[i]) * convert_int4(b[i]);
+        sum += products.x + products.y + products.z + products.w;
+    }
+
+    return sum;
+}
+
+// C dequantized to float.
+__kernel void matrix_mul_int8(__global const char4* A, __global const char4* B,
+                              __global const float* lhsScales, __global const float* rhsScales,
+                              __global float* C, int N, int K4)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+
+    const int sum = dotRow(A + y * K4, B + x * K4, K4);
+    C[y * N + x] = (float)sum * (lhsScales[y] * rhsScales[x]);
+}
+
+// C requantized to int8 with a single output scale (passed inverted).
+__kernel void matrix_mul_int8_requantize(__global const char4* A, __global const char4* B,
+                                         __global const float* lhsScales, __global const float* rhsScales,
+                                         __global char* C, int N, int K4, float inverseOutputScale)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+
+    const int sum = dotRow(A + y * K4, B + x * K4, K4);
+    const float value = (float)sum * (lhsScales[y] * rhsScales[x]);
+    C[y * N + x] = (char)clamp(rint(value * inverseOutputScale), -127.0f, 127.0f);
+}
@@ -0,0 +1,29 @@
+// Mixed precision multiply: A and B are stored in 16 bits, C in fp32, the
+// range is N x M. The products are accumulated in fp32 with fma() in plain k
+// order, so C matches the CPU engine run on the rounded inputs.
+//
+// fp16 elements are read with vload_half(), which is core OpenCL and works
+// without cl_khr_fp16. Built with -DSTORAGE_BF16 the elements are bfloat16,
+// the upper 16 bits of an fp32.
+
+#ifdef STORAGE_BF16
+#define STORAGE ushort
+#define LOAD(i, p) as_float((uint)(p)[i] << 16)
+#else
+#define STORAGE half
+#define LOAD(i, p) vload_half(i, p)
+#endif
+
+__kernel void matrix_mul_mixed(__global const STORAGE* A, __global const STORAGE* B, __global float* C, int K, int N)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+
+    float result = 0.0f;
+    for (int i = 0; i < K; i++)
+    {
+        result = fma(LOAD(y * K + i, A), LOAD(i * N + x, B), result);
+    }
+
+    C[y * N + x] = result;
+}
@@ -0,0 +1,129 @@
+// Every work-group computes a TILE x TILE block of C, where TILE is the local
+// size. Matching TILE x TILE blocks of A and B are staged in local memory so
+// each global value is read once per work-group instead of once per item.
+// The global range is padded to whole tiles: items outside C load zeros and
+// skip the store.
+//
+// The products are accumulated with fma() in plain k order, the same order
+// (and rounding) as the FMA micro-kernels of the CPU engine.
+
+// Shape specialization: built with -DMATRIX_M/N/K the size arguments
+// become compile-time constants.
+#ifdef MATRIX_K
+#define WIDTH_A MATRIX_K
+#define WIDTH_B MATRIX_N
+#define HEIGHT_A MATRIX_M
+#else
+#define WIDTH_A width_A
+#define WIDTH_B width_B
+#define HEIGHT_A height_A
+#endif
+
+// A TILE_SIZE fixed at build time also fixes the work-group size.
+#ifdef TILE_SIZE
+#define TILE TILE_SIZE
+#define TILE_ATTRIBUTE __attribute__((reqd_work_group_size(TILE_SIZE, TILE_SIZE, 1)))
+#else
+#define TILE get_local_size(0)
+#define TILE_ATTRIBUTE
+#endif
+
+// Built with -DTRANS_A=1 / -DTRANS_B=1 A is stored K x M / B is stored N x K
+// and the kernels compute with its transpose. WIDTH_A, WIDTH_B and HEIGHT_A
+// are always K, N and M of the product.
+#ifndef TRANS_A
+#define TRANS_A 0
+#endif
+#ifndef TRANS_B
+#define TRANS_B 0
+#endif
+
+#if TRANS_A
+#define LOAD_A(row, i) A[(i) * HEIGHT_A + (row)]
+#else
+#define LOAD_A(row, i) A[(row) * WIDTH_A + (i)]
+#endif
+
+#if TRANS_B
+#define LOAD_B(i, column) B[(column) * WIDTH_A + (i)]
+#else
+#define LOAD_B(i, column) B[(i) * WIDTH_B + (column)]
+#endif
+
+// Must match GpuOperations::gemm()
+#define EPILOGUE_BIAS 1
+#define EPILOGUE_RELU 2
+
+// Element (x, y) of alpha * op(A) * op(B) accumulated onto result, every item
+// of the work-group has to call it. alpha scales the A tile as it is staged.
+float tile_product(__global const float* A, __global const float* B, int width_A, int width_B, int height_A,
+                   float alpha, float result, __local float* tile_A, __local float* tile_B)
+{
+    const int tile = TILE;
+    const int lx = get_local_id(0);
+    const int ly = get_local_id(1);
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+
+    for (int t = 0; t < WIDTH_A; t += tile)
+    {
+        const int ax = t + lx;
+        const int by = t + ly;
+
+        tile_A[ly * tile + lx] = (y < HEIGHT_A && ax < WIDTH_A) ? alpha * LOAD_A(y, ax) : 0.0f;
+        tile_B[ly * tile + lx] = (by < WIDTH_A && x < WIDTH_B) ? LOAD_B(by, x) : 0.0f;
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        const int count = min(tile, WIDTH_A - t);
+        for (int i = 0; i < count; i++)
+        {
+            result = fma(tile_A[ly * tile + i], tile_B[i * tile + lx], result);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    return result;
+}
+
+__kernel TILE_ATTRIBUTE void matrix_mul(__global const float* A, __global const float* B, __global float* C,
+                         int width_A, int width_B, int height_A,
+                         __local float* tile_A, __local float* tile_B)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+
+    const float result = tile_product(A, B, width_A, width_B, height_A, 1.0f, 0.0f, tile_A, tile_B);
+
+    if (x < WIDTH_B && y < HEIGHT_A)
+    {
+        C[y * WIDTH_B + x] = result;
+    }
+}
+
+// C = epilogue(alpha * op(A) * op(B) + beta * C), the epilogue as in
+// matrix_mul_gemm.cl. With beta 0 C is not read.
+__kernel TILE_ATTRIBUTE void gemm(__global const float* A, __global const float* B, __global float* C, __global const float* bias,
+                   int width_A, int width_B, int height_A, int flags, float alpha, float beta, float scale,
+                   __local float* tile_A, __local float* tile_B)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+    const bool inside = x < WIDTH_B && y < HEIGHT_A;
+
+    float result = (inside && beta != 0.0f) ? beta * C[y * WIDTH_B + x] : 0.0f;
+    result = tile_product(A, B, width_A, width_B, height_A, alpha, result, tile_A, tile_B);
+
+    if (inside)
+    {
+        if (flags & EPILOGUE_BIAS)
+        {
+            result += bias[x];
+        }
+        if (flags & EPILOGUE_RELU)
+        {
+            result = fmax(result, 0.0f);
+        }
+
+        C[y * WIDTH_B + x] = result * scale;
+    }
+}
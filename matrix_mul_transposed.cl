@@ -1,23 +1,112 @@
-__kernel void matrix_transpose(__global float* src, __global float* dst)
+// Shape specialization: built with -DMATRIX_M/N/K the size arguments
+// become compile-time constants.
+#ifdef MATRIX_K
+#define WIDTH_A MATRIX_K
+#define WIDTH_B MATRIX_N
+#else
+#define WIDTH_A width_A
+#define WIDTH_B width_B
+#endif
+
+// Built with -DTRANS_A=1 / -DTRANS_B=1 A is stored K x M / B is stored N x K
+// and the kernels compute with its transpose; with B stored N x K both
+// operands are read along their rows. WIDTH_A and WIDTH_B are always K and N
+// of the product.
+#ifndef TRANS_A
+#define TRANS_A 0
+#endif
+#ifndef TRANS_B
+#define TRANS_B 0
+#endif
+
+#if TRANS_A
+#define LOAD_A(row, i) A[(i) * height_A + (row)]
+#else
+#define LOAD_A(row, i) A[(row) * WIDTH_A + (i)]
+#endif
+
+#if TRANS_B
+#define LOAD_B(i, column) B[(column) * WIDTH_A + (i)]
+#else
+#define LOAD_B(i, column) B[(i) * WIDTH_B + (column)]
+#endif
+
+// Must match GpuOperations::gemm()
+#define EPILOGUE_BIAS 1
+#define EPILOGUE_RELU 2
+
+// Tiled transpose of a width x height matrix, run with TRANSPOSE_TILE x
+// TRANSPOSE_TILE work-groups over a range rounded up to whole tiles. A tile
+// is read row by row into local memory and written out row by row from its
+// columns, so both the reads and the writes of a work-group are coalesced.
+// The extra column puts the elements of a tile column in different banks.
+#define TRANSPOSE_TILE 16
+
+__kernel void matrix_transpose(__global const float* src, __global float* dst, int width, int height)
 {
-    int x = get_global_id(0);
-    int y = get_global_id(1);
-    int width = get_global_size(0);
-    int height = get_global_size(1);
+    __local float tile[TRANSPOSE_TILE][TRANSPOSE_TILE + 1];
+
+    const int localX = get_local_id(0);
+    const int localY = get_local_id(1);
+    const int tileX = get_group_id(0) * TRANSPOSE_TILE;
+    const int tileY = get_group_id(1) * TRANSPOSE_TILE;
 
-    dst[x * height + y] = src[y * width + x];
+    int x = tileX + localX;
+    int y = tileY + localY;
+    if (x < width && y < height)
+    {
+        tile[localY][localX] = src[y * width + x];
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    // Row localY of the dst tile is column localY of the src tile.
+    x = tileY + localX;
+    y = tileX + localY;
+    if (x < height && y < width)
+    {
+        dst[y * height + x] = tile[localX][localY];
+    }
 }
 
-__kernel void matrix_mul(__global float* A, __global float* B, __global float* C, __const int width_A, __const int height_B)
+// multiply(): B is the N x K output of matrix_transpose and is read as with
+// TRANS_B, so both operands are read along their rows.
+__kernel void matrix_mul(__global const float* A, __global const float* B, __global float* C, __const int width_A, __const int width_B)
 {
     int x = get_global_id(0);
     int y = get_global_id(1);
 
     float result = 0;
-    for (int i = 0; i < width_A; i++)
+    for (int i = 0; i < WIDTH_A; i++)
+    {
+        result += A[y * WIDTH_A + i] * B[x * WIDTH_A + i];
+    }
+
+    C[y * WIDTH_B + x] = result;
+}
+
+// C = epilogue(alpha * op(A) * op(B) + beta * C), the epilogue as in
+// matrix_mul_gemm.cl and accumulated the same way. With beta 0 C is not read.
+__kernel void gemm(__global const float* A, __global const float* B, __global float* C, __global const float* bias,
+                   int width_A, int width_B, int height_A, int flags, float alpha, float beta, float scale)
+{
+    const int x = get_global_id(0);
+    const int y = get_global_id(1);
+
+    float result = beta != 0.0f ? beta * C[y * WIDTH_B + x] : 0.0f;
+    for (int i = 0; i < WIDTH_A; i++)
+    {
+        result = fma(alpha * LOAD_A(y, i), LOAD_B(i, x), result);
+    }
+
+    if (flags & EPILOGUE_BIAS)
+    {
+        result += bias[x];
+    }
+    if (flags & EPILOGUE_RELU)
     {
-        result += A[y * width_A + i] * B[x * width_A + i];
+        result = fmax(result, 0.0f);
     }
 
-    C[y * height_B + x] = result;
+    C[y * WIDTH_B + x] = result * scale;
 }
@@ -0,0 +1,94 @@
+// Counter based random fill, the same bits as random.cpp on the host (see
+// random.hpp). Every work-item writes the four elements of one Philox block,
+// the range is ceil(count / 4).
+//
+// Only correctly rounded operations are used and nothing may be contracted
+// into fma, so the results do not depend on the device.
+
+#pragma OPENCL FP_CONTRACT OFF
+
+// Must match random.hpp and random.cpp
+#define RANDOM_INTEGER 0
+#define RANDOM_UNIFORM 1
+#define RANDOM_NORMAL 2
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define NORMAL_TERMS 12
+
+uint4 philox4x32(uint4 counter, uint2 key)
+{
+    for (int round = 0; round < 10; round++)
+    {
+        const uint hi0 = mul_hi(PHILOX_M0, counter.x);
+        const uint lo0 = PHILOX_M0 * counter.x;
+        const uint hi1 = mul_hi(PHILOX_M1, counter.z);
+        const uint lo1 = PHILOX_M1 * counter.z;
+        counter = (uint4)(hi1 ^ counter.y ^ key.x, lo1, hi0 ^ counter.w ^ key.y, lo0);
+        key += (uint2)(PHILOX_W0, PHILOX_W1);
+    }
+
+    return counter;
+}
+
+uint4 block(uint2 key, ulong high, uint stream)
+{
+    return philox4x32((uint4)((uint)high, (uint)(high >> 32), stream, 0), key);
+}
+
+float fromWord(uint word, int kind, float a, float b)
+{
+    if (kind == RANDOM_INTEGER)
+    {
+        return convert_float((uint)(((ulong)word * (uint)a) >> 32));
+    }
+
+    const float u = convert_float(word >> 8) * (1.0f / 16777216.0f);
+    return a + (b - a) * u;
+}
+
+float normalElement(uint2 key, ulong index, float mean, float stddev)
+{
+    int sum = 0;
+    for (uint stream = 1; stream <= NORMAL_TERMS / 4; stream++)
+    {
+        const uint4 words = block(key, index, stream) >> 8;
+        sum += (int)(words.x + words.y + words.z + words.w);
+    }
+
+    const float z = convert_float(sum - (NORMAL_TERMS / 2 << 24)) * (1.0f / 16777216.0f);
+    return mean + stddev * z;
+}
+
+__kernel void fill_random(__global float* out, ulong count, uint seedLow, uint seedHigh, int kind, float a, float b)
+{
+    const ulong group = get_global_id(0);
+    const uint2 key = (uint2)(seedLow, seedHigh);
+
+    float values[4];
+    if (kind == RANDOM_NORMAL)
+    {
+        for (int lane = 0; lane < 4; lane++)
+        {
+            values[lane] = normalElement(key, group * 4 + lane, a, b);
+        }
+    }
+    else
+    {
+        const uint4 words = block(key, group, 0);
+        values[0] = fromWord(words.x, kind, a, b);
+        values[1] = fromWord(words.y, kind, a, b);
+        values[2] = fromWord(words.z, kind, a, b);
+        values[3] = fromWord(words.w, kind, a, b);
+    }
+
+    for (int lane = 0; lane < 4; lane++)
+    {
+        if (group * 4 + lane < count)
+        {
+            out[group * 4 + lane] = values[lane];
+        }
+    }
+}
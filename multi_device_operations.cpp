@@ -0,0 +1,273 @@
+#include "multi_device_operations.hpp"
+#include "gemm.hpp"
+
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <thread>
+
+// Rows are split in blocks of this many rows.
+static const int ROW_BLOCK = 16;
+// Rows per host task, several per thread keep the pool balanced.
+static const int HOST_ROWS = 64;
+// Weight of the newest measurement in the moving average.
+static const double RATE_SMOOTHING = 0.5;
+
+MultiDeviceOperations::MultiDeviceOperations(int hostThreads, int cpuPartition)
+{
+    const std::vector<cl_device_id> devices = GpuOperations::devices();
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        cl_device_type type = CL_DEVICE_TYPE_DEFAULT;
+        clGetDeviceInfo(devices[i], CL_DEVICE_TYPE, sizeof(type), &type, NULL);
+
+        cl_uint count = 0;
+        const cl_device_partition_property properties[] = { CL_DEVICE_PARTITION_EQUALLY, cpuPartition, 0 };
+        if (cpuPartition > 0 && (type & CL_DEVICE_TYPE_CPU)
+            && clCreateSubDevices(devices[i], properties, 0, NULL, &count) == CL_SUCCESS && count > 0)
+        {
+            std::vector<cl_device_id> subDevices(count);
+            clCreateSubDevices(devices[i], properties, count, &subDevices[0], NULL);
+            m_subDevices.insert(m_subDevices.end(), subDevices.begin(), subDevices.end());
+
+            for (cl_uint j = 0; j < count; j++)
+            {
+                char suffix[32];
+                snprintf(suffix, sizeof(suffix), " (part %u)", j);
+                addDevice(subDevices[j], suffix);
+            }
+        }
+        else
+        {
+            addDevice(devices[i], "");
+        }
+    }
+
+    if (hostThreads >= 0)
+    {
+        m_pool.reset(new ThreadPool(hostThreads));
+
+        char name[32];
+        snprintf(name, sizeof(name), "host (%d threads)", m_pool->size());
+        Worker worker = { name, 1.0, 0 };
+        m_workers.push_back(worker);
+    }
+
+    if (m_workers.empty())
+    {
+        throw "no device";
+    }
+
+    m_measured.assign(m_workers.size(), false);
+}
+
+MultiDeviceOperations::~MultiDeviceOperations(void)
+{
+    for (size_t i = 0; i < m_devices.size(); i++)
+    {
+        delete m_devices[i];
+    }
+
+    for (size_t i = 0; i < m_subDevices.size(); i++)
+    {
+        clReleaseDevice(m_subDevices[i]);
+    }
+}
+
+void MultiDeviceOperations::addDevice(cl_device_id device, const std::string& suffix)
+{
+    // A device that can not build the kernel just does not take part.
+    GpuOperations* ops;
+    try
+    {
+        ops = new GpuOperations(device);
+    }
+    catch (const char*)
+    {
+        return;
+    }
+
+    m_devices.push_back(ops);
+    Worker worker = { ops->deviceName() + suffix, 1.0, 0 };
+    m_workers.push_back(worker);
+}
+
+std::vector<int> MultiDeviceOperations::splitRows(int height) const
+{
+    const int count = (int)m_workers.size();
+    const int blocks = (height + ROW_BLOCK - 1) / ROW_BLOCK;
+
+    double totalRate = 0.0;
+    for (int i = 0; i < count; i++)
+    {
+        totalRate += m_workers[i].rate;
+    }
+
+    // Every worker keeps at least one block while there are enough, so its rate stays measured.
+    std::vector<int> shares(count, 0);
+    int assigned = 0;
+    int fastest = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (blocks >= count)
+        {
+            shares[i] = std::max(1, (int)(blocks * m_workers[i].rate / totalRate));
+        }
+        else
+        {
+            shares[i] = i < blocks ? 1 : 0;
+        }
+
+        assigned += shares[i];
+        if (m_workers[i].rate > m_workers[fastest].rate)
+        {
+            fastest = i;
+        }
+    }
+
+    // Rounding: the fastest worker takes the rest, the largest shares give back what is over.
+    shares[fastest] += std::max(0, blocks - assigned);
+    while (assigned > blocks)
+    {
+        int largest = (int)(std::max_element(shares.begin(), shares.end()) - shares.begin());
+        shares[largest]--;
+        assigned--;
+    }
+
+    std::vector<int> rows(count, 0);
+    int first = 0;
+    for (int i = 0; i < count; i++)
+    {
+        rows[i] = std::min(shares[i] * ROW_BLOCK, height - first);
+        first += rows[i];
+    }
+
+    return rows;
+}
+
+void MultiDeviceOperations::updateRate(size_t worker, double flops, double seconds) const
+{
+    if (flops <= 0.0 || seconds <= 0.0)
+    {
+        return;
+    }
+
+    const double rate = flops / seconds;
+    m_workers[worker].rate = m_measured[worker]
+        ? (1.0 - RATE_SMOOTHING) * m_workers[worker].rate + RATE_SMOOTHING * rate
+        : rate;
+    m_measured[worker] = true;
+}
+
+Matrix MultiDeviceOperations::multiply(const Matrix& lhs, const Matrix& rhs) const
+{
+    using namespace std::chrono;
+
+    if (lhs.width() != rhs.height())
+    {
+        throw "shape mismatch";
+    }
+
+    const int width = rhs.width();
+    const int height = lhs.height();
+    const int depth = lhs.width();
+
+    // Nothing to split: an empty result, or all zeros for a 0 inner dimension.
+    if (width == 0 || height == 0 || depth == 0)
+    {
+        for (size_t i = 0; i < m_workers.size(); i++)
+        {
+            m_workers[i].rows = 0;
+        }
+        return Matrix(width, height);
+    }
+
+    const std::vector<int> rows = splitRows(height);
+    std::vector<int> firstRows(rows.size(), 0);
+    for (size_t i = 1; i < rows.size(); i++)
+    {
+        firstRows[i] = firstRows[i - 1] + rows[i - 1];
+    }
+
+    Matrix result = Matrix::uninitialized(width, height);
+    const steady_clock::time_point start = steady_clock::now();
+
+    std::vector<MultiplyHandle> handles(m_devices.size());
+    for (size_t i = 0; i < m_devices.size(); i++)
+    {
+        if (rows[i] > 0)
+        {
+            handles[i] = m_devices[i]->multiplyAsync(lhs, rhs, firstRows[i], rows[i]);
+        }
+    }
+
+    // The host rows run on their own thread, this one watches the devices.
+    std::future<double> hostTime;
+    const size_t host = m_devices.size();
+    if (m_pool && rows[host] > 0)
+    {
+        hostTime = std::async(std::launch::async, [&]() {
+            const int firstRow = firstRows[host];
+            const int tasks = (rows[host] + HOST_ROWS - 1) / HOST_ROWS;
+
+            m_pool->run(tasks, [&](int task, int) {
+                const int y = firstRow + task * HOST_ROWS;
+                const int count = std::min(HOST_ROWS, firstRow + rows[host] - y);
+
+                sgemm(count, width, depth,
+                      lhs.data() + (size_t)y * depth, depth,
+                      rhs.data(), width,
+                      result.data() + (size_t)y * width, width);
+            });
+
+            return duration_cast<duration<double> >(steady_clock::now() - start).count();
+        });
+    }
+
+    // Devices are timed when their rows are back, whichever finishes first.
+    size_t pending = 0;
+    for (size_t i = 0; i < handles.size(); i++)
+    {
+        pending += handles[i].valid() ? 1 : 0;
+    }
+
+    while (pending > 0)
+    {
+        bool progress = false;
+        for (size_t i = 0; i < handles.size(); i++)
+        {
+            if (!handles[i].valid() || !handles[i].ready())
+            {
+                continue;
+            }
+
+            const double seconds = duration_cast<duration<double> >(steady_clock::now() - start).count();
+            const Matrix& part = handles[i].wait();
+            memcpy(result.data() + (size_t)firstRows[i] * width, part.data(), part.dataSize());
+
+            updateRate(i, 2.0 * rows[i] * width * depth, seconds);
+            handles[i] = MultiplyHandle();
+            pending--;
+            progress = true;
+        }
+
+        if (!progress)
+        {
+            std::this_thread::sleep_for(microseconds(50));
+        }
+    }
+
+    if (hostTime.valid())
+    {
+        updateRate(host, 2.0 * rows[host] * width * depth, hostTime.get());
+    }
+
+    for (size_t i = 0; i < m_workers.size(); i++)
+    {
+        m_workers[i].rows = rows[i];
+    }
+
+    return result;
+}
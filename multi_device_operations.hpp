@@ -0,0 +1,58 @@
+#ifndef _MULTI_DEVICE_OPERATIONS_HPP
+#define _MULTI_DEVICE_OPERATIONS_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "operations.hpp"
+#include "thread_pool.hpp"
+
+// Splits the rows of C over every OpenCL device of every platform and the
+// host threads.
+//
+// Each device gets its own GpuOperations (context and queues) and computes its
+// rows with multiplyAsync(), while the host threads run the CPU engine on
+// theirs. Rows are handed out in blocks, in proportion to the throughput of
+// each worker: a moving average of the rates measured on earlier calls, so the
+// split rebalances from call to call.
+class MultiDeviceOperations : public Operations
+{
+public:
+    struct Worker
+    {
+        std::string name;
+        // Estimated FLOP/s, every worker starts out equal.
+        double rate;
+        // Rows of C computed by the last multiply.
+        int rows;
+    };
+
+    // hostThreads < 0 leaves the host out (a CPU OpenCL device already uses
+    // those cores), 0 uses one thread per CPU. cpuPartition > 0 splits every
+    // CPU device into sub-devices of that many compute units.
+    MultiDeviceOperations(int hostThreads = 0, int cpuPartition = 0);
+    virtual ~MultiDeviceOperations(void);
+
+    virtual Matrix multiply(const Matrix& lhs, const Matrix& rhs) const;
+
+    // Devices first, the host last.
+    const std::vector<Worker>& workers(void) const { return m_workers; }
+
+private:
+    MultiDeviceOperations(const MultiDeviceOperations&);
+    MultiDeviceOperations& operator=(const MultiDeviceOperations&);
+
+    void addDevice(cl_device_id device, const std::string& suffix);
+    std::vector<int> splitRows(int height) const;
+    void updateRate(size_t worker, double flops, double seconds) const;
+
+    std::vector<GpuOperations*> m_devices;
+    std::vector<cl_device_id> m_subDevices;
+    std::unique_ptr<ThreadPool> m_pool;
+
+    mutable std::vector<Worker> m_workers;
+    mutable std::vector<bool> m_measured;
+};
+
+#endif // _MULTI_DEVICE_OPERATIONS_HPP
@@ -1,4 +1,12 @@
 #include "operations.hpp"
+#include "gemm.hpp"
+#include "program_cache.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
 
 static char* query_device_info(cl_device_id device, cl_device_info value_param)
 {
@@ -31,7 +39,7 @@ char* read_file(const char* filename)
 
     fseek(fp, 0, SEEK_SET);
 
-    char* source = (char*)malloc(source_size);
+    char* source = (char*)malloc(source_size + 1);
     fread(source, 1, source_size, fp);
     fclose(fp);
 
@@ -41,295 +49,2200 @@ char* read_file(const char* filename)
 
 // Operations
 
-// CPU
+template<typename T>
+static void checkShapes(const BasicMatrixView<const T>& lhs, const BasicMatrixView<const T>& rhs, const BasicMatrixView<T>& result)
+{
+    if (lhs.width() != rhs.height() || result.width() != rhs.width() || result.height() != lhs.height())
+    {
+        throw "shape mismatch";
+    }
+}
 
-Matrix CpuOperations::multiply(const Matrix& lhs, const Matrix& rhs) const
+// Products with nothing to compute: an empty result, or a 0 inner dimension
+// (the result is all zeros, written here). Returns whether the product is done.
+template<typename T>
+static bool emptyProduct(const BasicMatrixView<const T>& lhs, BasicMatrixView<T>& result)
+{
+    if (result.width() != 0 && result.height() != 0 && lhs.width() != 0)
+    {
+        return false;
+    }
+
+    for (int y = 0; y < result.height() && result.width() != 0; y++)
+    {
+        std::fill(&result(0, y), &result(0, y) + result.width(), T(0));
+    }
+
+    return true;
+}
+
+// Must match the flags of the gemm kernels (matrix_mul_gemm.cl and the variant files)
+static const int EPILOGUE_BIAS = 1;
+static const int EPILOGUE_RELU = 2;
+
+// m x n x k of c = op(a) * op(b), throws when the shapes do not match.
+static void gemmShape(bool transA, bool transB, const ConstMatrixView& a, const ConstMatrixView& b, const MatrixView& c,
+                      int* m, int* n, int* k)
+{
+    *m = transA ? a.width() : a.height();
+    *k = transA ? a.height() : a.width();
+    *n = transB ? b.height() : b.width();
+
+    if ((transB ? b.width() : b.height()) != *k || c.width() != *n || c.height() != *m)
+    {
+        throw "shape mismatch";
+    }
+}
+
+std::vector<Matrix> Operations::multiplyBatched(const std::vector<Matrix>& lhs, const std::vector<Matrix>& rhs) const
+{
+    if (lhs.size() != rhs.size())
+    {
+        throw "batch size mismatch";
+    }
+
+    std::vector<Matrix> results;
+    results.reserve(lhs.size());
+    for (size_t i = 0; i < lhs.size(); i++)
+    {
+        results.push_back(multiply(lhs[i], rhs[i]));
+    }
+
+    return results;
+}
+
+template<typename T>
+void BasicOperations<T>::multiplyInto(const BasicMatrixView<const T>& lhs, const BasicMatrixView<const T>& rhs, BasicMatrixView<T>& result) const
 {
-    int lhsWidth = lhs.width();
-    int rhsWidth = rhs.width();
+    checkShapes(lhs, rhs, result);
 
-    int width = rhs.width();
-    int height = lhs.height();
-    std::vector<float> data(width * height);
-    for (int i = 0; i < width * height; i++)
+    const BasicMatrix<T> product = multiply(BasicMatrix<T>(lhs), BasicMatrix<T>(rhs));
+    for (int y = 0; y < result.height(); y++)
     {
-        int x = i % width;
-        int y = i / width;
-        float value = 0;
+        std::copy(product.data() + (size_t)y * product.width(), product.data() + (size_t)(y + 1) * product.width(), &result(0, y));
+    }
+}
+
+void Operations::gemm(bool transA, bool transB, float alpha, const ConstMatrixView& a, const ConstMatrixView& b,
+                      float beta, MatrixView& c, const Epilogue& epilogue) const
+{
+    int m, n, k;
+    gemmShape(transA, transB, a, b, c, &m, &n, &k);
 
-        for (int j = 0; j < lhsWidth; j++)
+    const Matrix product = multiply(transA ? Matrix(a).transpose() : Matrix(a),
+                                    transB ? Matrix(b).transpose() : Matrix(b));
+    for (int y = 0; y < m; y++)
+    {
+        const float* row = product.data() + (size_t)y * n;
+        for (int x = 0; x < n; x++)
         {
-            value += lhs[y * lhsWidth + j] * rhs[j * rhsWidth + x];
+            const float value = alpha * row[x];
+            c(x, y) = epilogue.apply(beta != 0.0f ? value + beta * c(x, y) : value, x);
         }
-
-        data[i] = value;
     }
+}
+
+// CPU
+
+Matrix CpuOperations::multiply(const Matrix& lhs, const Matrix& rhs) const
+{
+    Matrix result = Matrix::uninitialized(rhs.width(), lhs.height());
+    MatrixView view = result.view();
+    CpuOperations::multiplyInto(lhs, rhs, view);
 
-    return Matrix(width, height, data);
+    return result;
 }
 
-// GPU
+void CpuOperations::multiplyInto(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView& result) const
+{
+    checkShapes(lhs, rhs, result);
 
-GpuOperations::GpuOperations(void)
-    : m_deviceId(selectDevice())
-    , m_context(createContext())
-    , m_queue(createCommandQueue(m_context.get()))
-    , m_program(buildProgram(m_context.get(), "matrix_mul.cl"))
+    sgemm(result.height(), result.width(), lhs.width(),
+          lhs.data(), lhs.stride(),
+          rhs.data(), rhs.stride(),
+          result.data(), result.stride());
+}
+
+void CpuOperations::gemm(bool transA, bool transB, float alpha, const ConstMatrixView& a, const ConstMatrixView& b,
+                         float beta, MatrixView& c, const Epilogue& epilogue) const
 {
+    int m, n, k;
+    gemmShape(transA, transB, a, b, c, &m, &n, &k);
+
+    sgemm(transA, transB, m, n, k, alpha,
+          a.data(), a.stride(),
+          b.data(), b.stride(),
+          beta, c.data(), c.stride(), epilogue);
 }
 
-GpuOperations::GpuOperations(std::string kernelFile)
-    : m_deviceId(selectDevice())
-    , m_context(createContext())
-    , m_queue(createCommandQueue(m_context.get()))
-    , m_program(buildProgram(m_context.get(), kernelFile))
+// Typed CPU
+
+// sgemm or dgemm by the element type.
+static void typedGemm(int m, int n, int k, const float* a, int lda, const float* b, int ldb, float* c, int ldc)
 {
+    sgemm(m, n, k, a, lda, b, ldb, c, ldc);
 }
 
-Matrix GpuOperations::multiply(const Matrix& lhs, const Matrix& rhs) const
+static void typedGemm(int m, int n, int k, const double* a, int lda, const double* b, int ldb, double* c, int ldc)
 {
-    const int width = rhs.width();
-    const int height = lhs.height();
-    const int dataSize = sizeof(float) * width * height;
+    dgemm(m, n, k, a, lda, b, ldb, c, ldc);
+}
 
-    // Prepare kernel
-    CleanUp<cl_kernel> kernel = createKernel(m_context.get(), m_program.get(), "matrix_mul");
+static const char* typedGemmKernelName(float)
+{
+    return sgemmKernelName();
+}
 
-    // Prepare kernel arguments
-    CleanUp<cl_mem> dev_A = uploadBuffer(m_context.get(), lhs.dataSize(), lhs.data());
-    CleanUp<cl_mem> dev_B = uploadBuffer(m_context.get(), rhs.dataSize(), rhs.data());
-    CleanUp<cl_mem> dev_C = uploadBuffer(m_context.get(), dataSize, NULL);
+static const char* typedGemmKernelName(double)
+{
+    return dgemmKernelName();
+}
 
-    const cl_mem memObjs[] = { dev_A.get(), dev_B.get(), dev_C.get(), 0 };
-    int argNdx = 0;
-    for (int i = 0; memObjs[i] != 0; i++, argNdx++)
+template<typename T>
+BasicMatrix<T> BasicCpuOperations<T>::multiply(const BasicMatrix<T>& lhs, const BasicMatrix<T>& rhs) const
+{
+    BasicMatrix<T> result = BasicMatrix<T>::uninitialized(rhs.width(), lhs.height());
+    BasicMatrixView<T> view = result.view();
+    BasicCpuOperations::multiplyInto(lhs, rhs, view);
+
+    return result;
+}
+
+template<typename T>
+void BasicCpuOperations<T>::multiplyInto(const BasicMatrixView<const T>& lhs, const BasicMatrixView<const T>& rhs, BasicMatrixView<T>& result) const
+{
+    checkShapes(lhs, rhs, result);
+
+    typedGemm(result.height(), result.width(), lhs.width(),
+              lhs.data(), lhs.stride(),
+              rhs.data(), rhs.stride(),
+              result.data(), result.stride());
+}
+
+template<typename T>
+const char* BasicCpuOperations<T>::kernelName(void)
+{
+    return typedGemmKernelName(T());
+}
+
+template class BasicOperations<float>;
+template class BasicOperations<double>;
+template class BasicCpuOperations<float>;
+template class BasicCpuOperations<double>;
+
+// Parallel CPU
+
+ParallelCpuOperations::ParallelCpuOperations(int threads)
+    : m_pool(threads)
+{
+}
+
+Matrix ParallelCpuOperations::multiply(const Matrix& lhs, const Matrix& rhs) const
+{
+    // The result is left untouched here: every tile is first written by the
+    // worker computing it, and the pool hands each worker a contiguous band of
+    // tiles, so the pages of C end up local to the cores that use them.
+    Matrix result = Matrix::uninitialized(rhs.width(), lhs.height());
+    MatrixView view = result.view();
+    ParallelCpuOperations::multiplyInto(lhs, rhs, view);
+
+    return result;
+}
+
+void ParallelCpuOperations::multiplyInto(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView& result) const
+{
+    gemm(false, false, 1.0f, lhs, rhs, 0.0f, result);
+}
+
+void ParallelCpuOperations::gemm(bool transA, bool transB, float alpha, const ConstMatrixView& a, const ConstMatrixView& b,
+                                 float beta, MatrixView& c, const Epilogue& epilogue) const
+{
+    int height, width, depth;
+    gemmShape(transA, transB, a, b, c, &height, &width, &depth);
+
+    // Start from 256x256 tiles of C and shrink them until every worker has a few to balance with.
+    int tileWidth = 256;
+    int tileHeight = 256;
+    const int wantedTiles = 4 * m_pool.size();
+    while (((width + tileWidth - 1) / tileWidth) * ((height + tileHeight - 1) / tileHeight) < wantedTiles
+           && (tileWidth > 64 || tileHeight > 64))
     {
-        if (clSetKernelArg(kernel.get(), argNdx, sizeof(cl_mem), (void*)&memObjs[i]) != CL_SUCCESS)
+        if (tileWidth >= tileHeight)
         {
-            throw "kernel arg set fail";
+            tileWidth /= 2;
+        }
+        else
+        {
+            tileHeight /= 2;
         }
     }
 
-    const int sizes[] = { lhs.width(), rhs.width(), 0 };
-    for (int i = 0; sizes[i] != 0; i++, argNdx++)
+    const int columns = (width + tileWidth - 1) / tileWidth;
+    const int rows = (height + tileHeight - 1) / tileHeight;
+
+    m_pool.run(columns * rows, [&](int tile, int) {
+        const int x = (tile % columns) * tileWidth;
+        const int y = (tile / columns) * tileHeight;
+
+        // Rows y.. of op(a) and columns x.. of op(b), the bias of the tile starts at column x.
+        Epilogue tileEpilogue = epilogue;
+        tileEpilogue.bias = epilogue.bias != NULL ? epilogue.bias + x : NULL;
+
+        sgemm(transA, transB, std::min(tileHeight, height - y), std::min(tileWidth, width - x), depth, alpha,
+              transA ? &a(y, 0) : &a(0, y), a.stride(),
+              transB ? &b(0, x) : &b(x, 0), b.stride(),
+              beta, &c(x, y), c.stride(), tileEpilogue);
+    });
+}
+
+std::vector<Matrix> ParallelCpuOperations::multiplyBatched(const std::vector<Matrix>& lhs, const std::vector<Matrix>& rhs) const
+{
+    if (lhs.size() != rhs.size())
+    {
+        throw "batch size mismatch";
+    }
+
+    std::vector<Matrix> results;
+    results.reserve(lhs.size());
+    for (size_t i = 0; i < lhs.size(); i++)
+    {
+        results.push_back(Matrix::uninitialized(rhs[i].width(), lhs[i].height()));
+    }
+
+    m_pool.run((int)lhs.size(), [&](int i, int) {
+        sgemm(lhs[i].height(), rhs[i].width(), lhs[i].width(),
+              lhs[i].data(), lhs[i].width(),
+              rhs[i].data(), rhs[i].width(),
+              results[i].data(), rhs[i].width());
+    });
+
+    return results;
+}
+
+// GPU
+
+GpuOperations::GpuOperations(void)
+    : GpuOperations(selectDevice())
+{
+}
+
+GpuOperations::GpuOperations(std::string kernelFile, std::string buildOptions)
+    : GpuOperations(selectDevice(), kernelFile, buildOptions)
+{
+}
+
+GpuOperations::GpuOperations(cl_device_id device, std::string kernelFile, std::string buildOptions)
+    : m_deviceId(device)
+    , m_profiler(Profiler::active())
+    , m_context(createContext())
+    , m_queue(createCommandQueue(m_context.get(), "compute"))
+    , m_uploadQueue(createCommandQueue(m_context.get(), "upload"))
+    , m_readbackQueue(createCommandQueue(m_context.get(), "readback"))
+    , m_program(buildProgram(m_context.get(), kernelFile, buildOptions))
+    , m_bufferPool(m_context.get(), m_deviceId)
+    , m_streamPool(m_context.get(), m_deviceId)
+    , m_kernelFile(kernelFile)
+    , m_buildOptions(buildOptions)
+    , m_specialize(false)
+    , m_zeroCopy(hasUnifiedMemory())
+{
+    m_localWorkSize[0] = m_localWorkSize[1] = 0;
+    m_batchedProgram = NULL;
+    m_gemmProgram = NULL;
+    m_randomProgram = NULL;
+    std::fill(m_gemmVariantPrograms, m_gemmVariantPrograms + 4, (cl_program)NULL);
+}
+
+GpuOperations::~GpuOperations(void)
+{
+    for (std::map<std::pair<cl_program, std::string>, cl_kernel>::iterator it = m_kernels.begin(); it != m_kernels.end(); ++it)
+    {
+        clReleaseKernel(it->second);
+    }
+
+    for (std::map<std::string, cl_program>::iterator it = m_specializedPrograms.begin(); it != m_specializedPrograms.end(); ++it)
     {
-        if (clSetKernelArg(kernel.get(), argNdx, sizeof(int), (void*)&sizes[i]) != CL_SUCCESS)
+        if (it->second != NULL)
         {
-            throw "kernel arg set fail";
+            clReleaseProgram(it->second);
         }
     }
 
-    size_t globalWorkSize[2] = { (size_t)width, (size_t)height };
-
-    if (clEnqueueNDRangeKernel(m_queue.get(), kernel.get(), 2, NULL, globalWorkSize, NULL /* localWorkSize */, 0, NULL, NULL) != CL_SUCCESS)
+    if (m_batchedProgram != NULL)
     {
-        throw "job enqueue fail";
+        clReleaseProgram(m_batchedProgram);
     }
 
-    std::vector<float> data(width * height);
+    if (m_gemmProgram != NULL)
+    {
+        clReleaseProgram(m_gemmProgram);
+    }
 
-    if (clEnqueueReadBuffer(m_queue.get(), dev_C.get(), CL_TRUE, 0, dataSize, &data[0], 0, NULL, NULL) != CL_SUCCESS)
+    if (m_randomProgram != NULL)
     {
-        throw "readback fail";
+        clReleaseProgram(m_randomProgram);
     }
 
-    return Matrix(width, height, data);
+    for (int i = 0; i < 4; i++)
+    {
+        if (m_gemmVariantPrograms[i] != NULL)
+        {
+            clReleaseProgram(m_gemmVariantPrograms[i]);
+        }
+    }
 }
 
-cl_context GpuOperations::createContext(void) const
+Matrix GpuOperations::multiply(const Matrix& lhs, const Matrix& rhs) const
 {
-    cl_int error;
-    cl_context context = clCreateContext(NULL, 1, &m_deviceId, NULL, NULL, &error);
-    if (!context || error != CL_SUCCESS)
+    if (m_zeroCopy && lhs.width() != 0 && lhs.height() != 0 && rhs.width() != 0)
     {
-        throw "context fail";
+        return multiplyZeroCopy(lhs, rhs);
     }
 
-    return context;
+    Matrix result = Matrix::uninitialized(rhs.width(), lhs.height());
+    MatrixView view = result.view();
+    GpuOperations::multiplyInto(lhs, rhs, view);
+
+    return result;
 }
 
-cl_command_queue GpuOperations::createCommandQueue(cl_context context) const
+void GpuOperations::multiplyInto(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView& result) const
 {
-    cl_int error;
-    cl_command_queue queue = clCreateCommandQueue(context, m_deviceId, 0, &error);
-    if (!queue || error != CL_SUCCESS)
+    checkShapes(lhs, rhs, result);
+    if (emptyProduct(lhs, result))
     {
-        throw "command queue fail";
+        return;
     }
 
-    return queue;
+    if (m_zeroCopy && wrappable(lhs) && wrappable(rhs) && wrappable(result))
+    {
+        CleanUp<cl_mem> dev_A(hostBuffer(lhs, CL_MEM_READ_ONLY));
+        CleanUp<cl_mem> dev_B(hostBuffer(rhs, CL_MEM_READ_ONLY));
+        CleanUp<cl_mem> dev_C(hostBuffer(result, CL_MEM_WRITE_ONLY));
+        multiplyHostBuffers(dev_A.get(), dev_B.get(), dev_C.get(), lhs.width(), lhs.height(), rhs.width());
+        return;
+    }
+
+    // Prepare kernel arguments
+    PooledBuffer dev_A = pooledBuffer(lhs);
+    PooledBuffer dev_B = pooledBuffer(rhs);
+    PooledBuffer dev_C = pooledBuffer(sizeof(float) * result.width() * result.height(), NULL);
+
+    enqueueMultiply(dev_A.get(), dev_B.get(), dev_C.get(), lhs.width(), lhs.height(), rhs.width());
+
+    // Read back straight into the result
+    readBuffer(dev_C.get(), result);
 }
 
-cl_program GpuOperations::buildProgram(cl_context context, const std::string& filename) const
+void GpuOperations::gemm(bool transA, bool transB, float alpha, const ConstMatrixView& a, const ConstMatrixView& b,
+                         float beta, MatrixView& c, const Epilogue& epilogue) const
 {
-    cl_int error;
-    char* kernel_source = read_file(filename.c_str());
-    const char* src = kernel_source;
-    cl_program program = clCreateProgramWithSource(context, 1, &src, NULL, &error);
-    free(kernel_source);
-    if (!program || error != CL_SUCCESS)
+    int m, n, k;
+    gemmShape(transA, transB, a, b, c, &m, &n, &k);
+
+    if (m == 0 || n == 0)
     {
-        throw "program fail";
+        return;
     }
 
-    error = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-    if (error)
+    if (k == 0)
     {
-        size_t len;
-        char buffer[2048];
-        printf("Error: Unable to build the program, error message:\n");
-        clGetProgramBuildInfo(program, m_deviceId, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
-        printf("%s\n", buffer);
-        throw "build fail";
+        // Nothing to multiply, as in sgemm() C becomes epilogue(beta * C).
+        for (int y = 0; y < m; y++)
+        {
+            for (int x = 0; x < n; x++)
+            {
+                c(x, y) = epilogue.apply(beta != 0.0f ? beta * c(x, y) : 0.0f, x);
+            }
+        }
+        return;
     }
 
-    return program;
-}
+    // The operands go up as they are stored, packed row by row.
+    PooledBuffer dev_A = pooledBuffer(a);
+    PooledBuffer dev_B = pooledBuffer(b);
+    PooledBuffer dev_C = beta != 0.0f ? pooledBuffer(c) : pooledBuffer(sizeof(float) * m * n, NULL);
 
-cl_kernel GpuOperations::createKernel(cl_context context, cl_program program, const std::string& name) const
-{
-    cl_int error;
-    cl_kernel kernel = clCreateKernel(program, name.c_str(), &error);
-    if (!kernel || error != CL_SUCCESS)
+    // Kept until the blocking readback below
+    std::unique_ptr<PooledBuffer> dev_Bias;
+    if (epilogue.bias != NULL)
     {
-        throw "kernel fail";
+        dev_Bias.reset(new PooledBuffer(pooledBuffer(sizeof(float) * n, epilogue.bias)));
     }
 
-    return kernel;
+    enqueueGemm(transA, transB, dev_A.get(), dev_B.get(), dev_C.get(), dev_Bias ? dev_Bias->get() : NULL,
+                m, n, k, alpha, beta, epilogue);
+
+    readBuffer(dev_C.get(), c);
 }
 
-cl_mem GpuOperations::uploadBuffer(cl_context context, size_t size, const void* dataPtr) const
+void GpuOperations::enqueueGemm(bool transA, bool transB, cl_mem a, cl_mem b, cl_mem c, cl_mem bias,
+                                int m, int n, int k, float alpha, float beta, const Epilogue& epilogue) const
 {
-    cl_int error;
-    cl_mem_flags flags = CL_MEM_READ_WRITE | (dataPtr != NULL ? CL_MEM_COPY_HOST_PTR : 0);
-    cl_mem mem = clCreateBuffer(context, flags, size, const_cast<void*>(dataPtr), &error);
-    if (error != CL_SUCCESS)
+    if (m_gemmProgram == NULL)
     {
-        throw "upload buffer fail";
+        m_gemmProgram = buildProgram(m_context.get(), "matrix_mul_gemm.cl");
     }
-    return mem;
-}
 
-cl_device_id GpuOperations::selectDevice(void)
-{
-    cl_platform_id platform_id; // We'll support only the first platfrom for now.
-    clGetPlatformIDs(1, &platform_id, NULL);
+    cl_kernel kernel = cachedKernel(m_gemmProgram, "gemm");
 
-    cl_device_id selected_device = NULL;
+    const cl_mem memObjs[] = { a, b, c, 0 };
+    int argNdx = setKernelArgs(kernel, 0, memObjs);
 
-    cl_uint device_count = 0;
-    clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ALL, 0, NULL, &device_count);
-    cl_device_id* devices = (cl_device_id*)malloc(sizeof(cl_device_id) * device_count);
-    clGetDeviceIDs(platform_id, CL_DEVICE_TYPE_ALL, device_count, devices, NULL);
+    // A NULL bias is a valid argument, the kernel does not read it then. The
+    // strides of a transposed operand are swapped, the stored width of A is M
+    // when transposed and K otherwise, the one of B K or N.
+    const int flags = (epilogue.bias != NULL ? EPILOGUE_BIAS : 0) | (epilogue.relu ? EPILOGUE_RELU : 0);
+    const int ints[] = {
+        n,
+        k,
+        transA ? 1 : k,
+        transA ? m : 1,
+        transB ? 1 : n,
+        transB ? k : 1,
+        flags
+    };
+    const float floats[] = { alpha, beta, epilogue.scale };
 
-    for (cl_uint j = 0; j < device_count; j++)
+    if (clSetKernelArg(kernel, argNdx++, sizeof(cl_mem), &bias) != CL_SUCCESS)
     {
-        char* name = query_device_info(devices[j], CL_DEVICE_NAME);
-        char* hw_opencl = query_device_info(devices[j], CL_DEVICE_VERSION);
-        char* sw_opencl = query_device_info(devices[j], CL_DRIVER_VERSION);
+        throw "kernel arg set fail";
+    }
+    argNdx = setKernelArgs(kernel, argNdx, ints, sizeof(ints) / sizeof(ints[0]));
+    setKernelArgs(kernel, argNdx, floats, sizeof(floats) / sizeof(floats[0]));
 
-        int is_gpu = device_is_gpu(devices[j]);
-        /*
-        printf("%d. Device name: %s (HW: %s, SW: %s, Is gpu?: %s)\n",
-                j + 1,
-                name,
-                hw_opencl,
-                sw_opencl,
-                is_gpu ? "Yes" : "No");
-        */
-        if (is_gpu && selected_device == NULL)
-        {
-            selected_device = devices[j];
-            /* printf(" Selected device ^^\n"); */
-        }
+    size_t globalWorkSize[2] = { (size_t)n, (size_t)m };
+    ProfiledEvent kernelDone(m_profiler, "gemm", m_queue.get());
+    if (clEnqueueNDRangeKernel(m_queue.get(), kernel, 2, NULL, globalWorkSize, NULL, 0, NULL, kernelDone.get()) != CL_SUCCESS)
+    {
+        throw "job enqueue fail";
+    }
+    kernelDone.enqueued();
+}
 
-        free(name);
-        free(hw_opencl);
-        free(sw_opencl);
+cl_program GpuOperations::gemmVariantProgram(bool transA, bool transB) const
+{
+    cl_program& program = m_gemmVariantPrograms[(transA ? 2 : 0) + (transB ? 1 : 0)];
+    if (program == NULL)
+    {
+        char options[64];
+        snprintf(options, sizeof(options), " -DTRANS_A=%d -DTRANS_B=%d", transA ? 1 : 0, transB ? 1 : 0);
+        program = buildProgram(m_context.get(), m_kernelFile, m_buildOptions + options);
     }
-    free(devices);
 
-    return selected_device;
+    return program;
 }
 
+int GpuOperations::setGemmArgs(cl_kernel kernel, cl_mem a, cl_mem b, cl_mem c, cl_mem bias,
+                               int m, int n, int k, float alpha, float beta, const Epilogue& epilogue) const
+{
+    const cl_mem memObjs[] = { a, b, c, 0 };
+    int argNdx = setKernelArgs(kernel, 0, memObjs);
 
-// Transposed Gpu Operations
+    if (clSetKernelArg(kernel, argNdx++, sizeof(cl_mem), &bias) != CL_SUCCESS)
+    {
+        throw "kernel arg set fail";
+    }
 
-TransposedGpuOperations::TransposedGpuOperations(void)
-    : GpuOperations("matrix_mul_transposed.cl")
-{
+    const int flags = (epilogue.bias != NULL ? EPILOGUE_BIAS : 0) | (epilogue.relu ? EPILOGUE_RELU : 0);
+    const int ints[] = { k, n, m, flags };
+    const float floats[] = { alpha, beta, epilogue.scale };
+    argNdx = setKernelArgs(kernel, argNdx, ints, sizeof(ints) / sizeof(ints[0]));
+    return setKernelArgs(kernel, argNdx, floats, sizeof(floats) / sizeof(floats[0]));
 }
 
-Matrix TransposedGpuOperations::multiply(const Matrix& lhs, const Matrix& rhs) const
+// Random GPU
+
+Matrix GpuOperations::random(int width, int height, uint64_t seed, const RandomDistribution& distribution) const
 {
-    const int width = rhs.width();
-    const int height = lhs.height();
-    const int dataSize = sizeof(float) * width * height;
+    Matrix result = Matrix::uninitialized(width, height);
 
-    // Prepare kernel
-    CleanUp<cl_kernel> kernel = createKernel(m_context.get(), m_program.get(), "matrix_mul");
-    CleanUp<cl_kernel> transposeKernel = createKernel(m_context.get(), m_program.get(), "matrix_transpose");
+    PooledBuffer buffer = pooledBuffer(result.dataSize(), NULL);
+    enqueueRandom(buffer.get(), (size_t)width * height, seed, distribution);
+    readBuffer(buffer.get(), result.view());
 
-    // Prepare kernel arguments
-    CleanUp<cl_mem> dev_A = uploadBuffer(m_context.get(), lhs.dataSize(), lhs.data());
-    CleanUp<cl_mem> dev_B = uploadBuffer(m_context.get(), rhs.dataSize(), rhs.data());
-    // Transposed dst matrix
-    CleanUp<cl_mem> dev_T = uploadBuffer(m_context.get(), rhs.dataSize(), NULL);
-    CleanUp<cl_mem> dev_C = uploadBuffer(m_context.get(), dataSize, NULL);
+    return result;
+}
 
+Matrix GpuOperations::multiplyRandom(int lhsWidth, int lhsHeight, int rhsWidth, uint64_t lhsSeed, uint64_t rhsSeed,
+                                     const RandomDistribution& distribution) const
+{
+    // An empty result, or all zeros for a 0 inner dimension, needs no device work.
+    if (lhsWidth == 0 || lhsHeight == 0 || rhsWidth == 0)
     {
-        const cl_mem memObjs[] = { dev_B.get(), dev_T.get(), 0 };
-        int argNdx = 0;
-        for (int i = 0; memObjs[i] != 0; i++, argNdx++)
-        {
-            if (clSetKernelArg(transposeKernel.get(), argNdx, sizeof(cl_mem), (void*)&memObjs[i]) != CL_SUCCESS)
-            {
-                throw "kernel arg set fail";
-            }
-        }
+        return Matrix(rhsWidth, lhsHeight);
     }
 
-    size_t transposeWorkSize[2] = { (size_t)rhs.width(), (size_t)rhs.height() };
-    cl_event transposeEvent;
-    cl_int error = clEnqueueNDRangeKernel(m_queue.get(), transposeKernel.get(), 2, NULL, transposeWorkSize, NULL, 0, NULL, &transposeEvent);
-    if (error != CL_SUCCESS)
+    Matrix result = Matrix::uninitialized(rhsWidth, lhsHeight);
+
+    PooledBuffer dev_A = pooledBuffer(sizeof(float) * lhsWidth * lhsHeight, NULL);
+    PooledBuffer dev_B = pooledBuffer(sizeof(float) * rhsWidth * lhsWidth, NULL);
+    PooledBuffer dev_C = pooledBuffer(result.dataSize(), NULL);
+
+    // The queue is in order, the multiply sees the filled buffers.
+    enqueueRandom(dev_A.get(), (size_t)lhsWidth * lhsHeight, lhsSeed, distribution);
+    enqueueRandom(dev_B.get(), (size_t)rhsWidth * lhsWidth, rhsSeed, distribution);
+    enqueueMultiply(dev_A.get(), dev_B.get(), dev_C.get(), lhsWidth, lhsHeight, rhsWidth);
+
+    readBuffer(dev_C.get(), result.view());
+
+    return result;
+}
+
+void GpuOperations::enqueueRandom(cl_mem buffer, size_t count, uint64_t seed, const RandomDistribution& distribution) const
+{
+    if (count == 0)
     {
-        throw "transpose job enqueue fail";
+        return;
     }
 
+    if (m_randomProgram == NULL)
     {
-        const cl_mem memObjs[] = { dev_A.get(), dev_T.get(), dev_C.get(), 0 };
-        int argNdx = 0;
-        for (int i = 0; memObjs[i] != 0; i++, argNdx++)
-        {
-            if (clSetKernelArg(kernel.get(), argNdx, sizeof(cl_mem), (void*)&memObjs[i]) != CL_SUCCESS)
-            {
-                throw "kernel arg set fail";
-            }
-        }
+        m_randomProgram = buildProgram(m_context.get(), "matrix_random.cl");
+    }
 
-        const int sizes[] = { lhs.width(), rhs.width(), 0 };
-        for (int i = 0; sizes[i] != 0; i++, argNdx++)
-        {
-            if (clSetKernelArg(kernel.get(), argNdx, sizeof(int), (void*)&sizes[i]) != CL_SUCCESS)
-            {
-                throw "kernel arg set fail";
-            }
-        }
+    cl_kernel kernel = cachedKernel(m_randomProgram, "fill_random");
+
+    const cl_ulong elements = count;
+    const cl_uint seedLow = (cl_uint)seed;
+    const cl_uint seedHigh = (cl_uint)(seed >> 32);
+    const int kind = distribution.kind;
+
+    cl_int error = clSetKernelArg(kernel, 0, sizeof(cl_mem), &buffer);
+    error |= clSetKernelArg(kernel, 1, sizeof(cl_ulong), &elements);
+    error |= clSetKernelArg(kernel, 2, sizeof(cl_uint), &seedLow);
+    error |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &seedHigh);
+    error |= clSetKernelArg(kernel, 4, sizeof(int), &kind);
+    error |= clSetKernelArg(kernel, 5, sizeof(float), &distribution.a);
+    error |= clSetKernelArg(kernel, 6, sizeof(float), &distribution.b);
+    if (error != CL_SUCCESS)
+    {
+        throw "kernel arg set fail";
     }
 
-    size_t globalWorkSize[2] = { (size_t)width, (size_t)height };
-    if (clEnqueueNDRangeKernel(m_queue.get(), kernel.get(), 2, NULL, globalWorkSize, NULL, 1, &transposeEvent, NULL) != CL_SUCCESS)
+    // One work-item per Philox block of four elements.
+    size_t globalWorkSize = (count + 3) / 4;
+    ProfiledEvent filled(m_profiler, "fill_random", m_queue.get());
+    if (clEnqueueNDRangeKernel(m_queue.get(), kernel, 1, NULL, &globalWorkSize, NULL, 0, NULL, filled.get()) != CL_SUCCESS)
     {
         throw "job enqueue fail";
     }
+    filled.enqueued();
+}
 
-    std::vector<float> data(width * height);
+Matrix GpuOperations::multiplyZeroCopy(const Matrix& lhs, const Matrix& rhs) const
+{
+    Matrix result = Matrix::uninitialized(rhs.width(), lhs.height());
+
+    // The device works on the matrices' own memory
+    CleanUp<cl_mem> dev_A(hostBuffer(lhs, CL_MEM_READ_ONLY));
+    CleanUp<cl_mem> dev_B(hostBuffer(rhs, CL_MEM_READ_ONLY));
+    CleanUp<cl_mem> dev_C(hostBuffer(result, CL_MEM_WRITE_ONLY));
+    multiplyHostBuffers(dev_A.get(), dev_B.get(), dev_C.get(), lhs.width(), lhs.height(), rhs.width());
+
+    return result;
+}
 
-    if (clEnqueueReadBuffer(m_queue.get(), dev_C.get(), CL_TRUE, 0, dataSize, &data[0], 0, NULL, NULL) != CL_SUCCESS)
+void GpuOperations::multiplyHostBuffers(cl_mem lhs, cl_mem rhs, cl_mem result, int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    enqueueMultiply(lhs, rhs, result, lhsWidth, lhsHeight, rhsWidth);
+
+    // Mapping (blocking) waits for the kernels and makes C visible in the
+    // host memory behind the buffer, the pointer points into it.
+    cl_int error;
+    ProfiledEvent mapDone(m_profiler, "map result", m_queue.get());
+    void* mapped = clEnqueueMapBuffer(m_queue.get(), result, CL_TRUE, CL_MAP_READ, 0, sizeof(float) * rhsWidth * lhsHeight,
+                                      0, NULL, mapDone.get(), &error);
+    mapDone.enqueued();
+    if (error != CL_SUCCESS)
     {
         throw "readback fail";
     }
 
-    return Matrix(width, height, data);
+    ProfiledEvent unmapDone(m_profiler, "unmap result", m_queue.get());
+    clEnqueueUnmapMemObject(m_queue.get(), result, mapped, 0, NULL, unmapDone.get());
+    unmapDone.enqueued();
+    clFinish(m_queue.get());
+}
+
+cl_mem GpuOperations::hostBuffer(const Matrix& matrix, cl_mem_flags flags) const
+{
+    // The whole (padded) allocation is wrapped, some drivers only skip the copy for whole cache lines.
+    ProfiledSpan span(m_profiler, "alloc", "host pointer");
+    cl_int error;
+    cl_mem mem = clCreateBuffer(m_context.get(), flags | CL_MEM_USE_HOST_PTR, matrix.storageSize(), const_cast<float*>(matrix.data()), &error);
+    if (!mem || error != CL_SUCCESS)
+    {
+        throw "upload buffer fail";
+    }
+
+    return mem;
+}
+
+cl_mem GpuOperations::hostBuffer(const ConstMatrixView& view, cl_mem_flags flags) const
+{
+    ProfiledSpan span(m_profiler, "alloc", "host pointer");
+    cl_int error;
+    cl_mem mem = clCreateBuffer(m_context.get(), flags | CL_MEM_USE_HOST_PTR, sizeof(float) * view.width() * view.height(),
+                                const_cast<float*>(view.data()), &error);
+    if (!mem || error != CL_SUCCESS)
+    {
+        throw "upload buffer fail";
+    }
+
+    return mem;
+}
+
+bool GpuOperations::wrappable(const ConstMatrixView& view) const
+{
+    cl_uint alignBits = 0;
+    clGetDeviceInfo(m_deviceId, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(alignBits), &alignBits, NULL);
+    const size_t alignment = std::max((size_t)alignBits / 8, sizeof(float));
+
+    return view.contiguous() && view.width() > 0 && view.height() > 0 && (uintptr_t)view.data() % alignment == 0;
+}
+
+bool GpuOperations::hasUnifiedMemory(void) const
+{
+    cl_bool unified = CL_FALSE;
+    clGetDeviceInfo(m_deviceId, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL);
+    return unified == CL_TRUE;
+}
+
+// Async jobs
+
+struct MultiplyHandle::Job
+{
+    Job(BufferPool& pool, const Matrix& lhs, const Matrix& rhs, int rowCount)
+        : lhsBuffer(pool, sizeof(float) * lhs.width() * rowCount)
+        , rhsBuffer(pool, rhs.dataSize())
+        , resultBuffer(pool, sizeof(float) * rhs.width() * rowCount)
+        , result(Matrix::uninitialized(rhs.width(), rowCount))
+        , computeDone(NULL)
+        , readDone(NULL)
+    {
+        uploads[0] = uploads[1] = NULL;
+    }
+
+    ~Job(void)
+    {
+        // The buffers go back to the pool right after this, nothing may still use them.
+        cl_event events[] = { uploads[0], uploads[1], computeDone, readDone };
+        for (size_t i = 0; i < sizeof(events) / sizeof(events[0]); i++)
+        {
+            if (events[i] != NULL)
+            {
+                clWaitForEvents(1, &events[i]);
+                clReleaseEvent(events[i]);
+            }
+        }
+    }
+
+    PooledBuffer lhsBuffer;
+    PooledBuffer rhsBuffer;
+    PooledBuffer resultBuffer;
+    Matrix result;
+
+    cl_event uploads[2];
+    cl_event computeDone;
+    cl_event readDone;
+};
+
+bool MultiplyHandle::ready(void) const
+{
+    cl_int status = CL_QUEUED;
+    clGetEventInfo(m_job->readDone, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL);
+    return status == CL_COMPLETE || status < 0;
+}
+
+const Matrix& MultiplyHandle::wait(void) const
+{
+    // A failed command makes the wait fail, also for the commands waiting on it.
+    if (clWaitForEvents(1, &m_job->readDone) != CL_SUCCESS)
+    {
+        throw "readback fail";
+    }
+
+    return m_job->result;
+}
+
+MultiplyHandle GpuOperations::multiplyAsync(const Matrix& lhs, const Matrix& rhs) const
+{
+    return multiplyAsync(lhs, rhs, 0, lhs.height());
+}
+
+MultiplyHandle GpuOperations::multiplyAsync(const Matrix& lhs, const Matrix& rhs, int firstRow, int rowCount) const
+{
+    if (lhs.width() != rhs.height() || firstRow < 0 || rowCount < 0 || firstRow > lhs.height() - rowCount)
+    {
+        throw "shape mismatch";
+    }
+
+    std::shared_ptr<MultiplyHandle::Job> job = std::make_shared<MultiplyHandle::Job>(m_streamPool, lhs, rhs, rowCount);
+
+    // Nothing to run: the zero (or empty) result is ready at once.
+    if (rowCount == 0 || rhs.width() == 0 || lhs.width() == 0)
+    {
+        std::fill(job->result.data(), job->result.data() + (size_t)rhs.width() * rowCount, 0.0f);
+
+        cl_int error;
+        job->readDone = clCreateUserEvent(m_context.get(), &error);
+        if (error != CL_SUCCESS || clSetUserEventStatus(job->readDone, CL_COMPLETE) != CL_SUCCESS)
+        {
+            throw "job enqueue fail";
+        }
+        return MultiplyHandle(job);
+    }
+
+    const size_t lhsSize = sizeof(float) * lhs.width() * rowCount;
+    const float* lhsRows = lhs.data() + (size_t)firstRow * lhs.width();
+    if (clEnqueueWriteBuffer(m_uploadQueue.get(), job->lhsBuffer.get(), CL_FALSE, 0, lhsSize, lhsRows, 0, NULL, &job->uploads[0]) != CL_SUCCESS
+        || clEnqueueWriteBuffer(m_uploadQueue.get(), job->rhsBuffer.get(), CL_FALSE, 0, rhs.dataSize(), rhs.data(), 0, NULL, &job->uploads[1]) != CL_SUCCESS)
+    {
+        throw "upload buffer fail";
+    }
+    traceEvent("upload", m_uploadQueue.get(), job->uploads[0]);
+    traceEvent("upload", m_uploadQueue.get(), job->uploads[1]);
+
+    // The compute queue is in order: the barrier holds the kernels back until
+    // both uploads are done, the marker completes once the kernels did.
+    if (clEnqueueBarrierWithWaitList(m_queue.get(), 2, job->uploads, NULL) != CL_SUCCESS)
+    {
+        throw "job enqueue fail";
+    }
+
+    enqueueMultiply(job->lhsBuffer.get(), job->rhsBuffer.get(), job->resultBuffer.get(), lhs.width(), rowCount, rhs.width());
+
+    if (clEnqueueMarkerWithWaitList(m_queue.get(), 0, NULL, &job->computeDone) != CL_SUCCESS)
+    {
+        throw "job enqueue fail";
+    }
+
+    if (clEnqueueReadBuffer(m_readbackQueue.get(), job->resultBuffer.get(), CL_FALSE, 0, job->result.dataSize(), job->result.data(), 1, &job->computeDone, &job->readDone) != CL_SUCCESS)
+    {
+        throw "readback fail";
+    }
+    traceEvent("readback", m_readbackQueue.get(), job->readDone);
+
+    // Get all three queues going without waiting for a later blocking call.
+    clFlush(m_uploadQueue.get());
+    clFlush(m_queue.get());
+    clFlush(m_readbackQueue.get());
+
+    return MultiplyHandle(job);
+}
+
+// Batched GPU
+
+std::vector<Matrix> GpuOperations::multiplyBatched(const std::vector<Matrix>& lhs, const std::vector<Matrix>& rhs) const
+{
+    // Must match DESCRIPTOR_SIZE in matrix_mul_batched.cl
+    static const int DESCRIPTOR_SIZE = 6;
+
+    if (lhs.size() != rhs.size())
+    {
+        throw "batch size mismatch";
+    }
+
+    const size_t count = lhs.size();
+    std::vector<Matrix> results;
+    if (count == 0)
+    {
+        return results;
+    }
+
+    // Offsets of every product in the packed operands (in floats)
+    std::vector<int> descriptors(count * DESCRIPTOR_SIZE);
+    size_t sizeA = 0;
+    size_t sizeB = 0;
+    size_t sizeC = 0;
+    int maxWidth = 0;
+    int maxHeight = 0;
+    bool uniform = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        const int m = lhs[i].height();
+        const int n = rhs[i].width();
+        const int k = lhs[i].width();
+        if (rhs[i].height() != k)
+        {
+            throw "batch shape mismatch";
+        }
+
+        int* descriptor = &descriptors[i * DESCRIPTOR_SIZE];
+        descriptor[0] = m;
+        descriptor[1] = n;
+        descriptor[2] = k;
+        descriptor[3] = (int)sizeA;
+        descriptor[4] = (int)sizeB;
+        descriptor[5] = (int)sizeC;
+
+        uniform = uniform && m == descriptors[0] && n == descriptors[1] && k == descriptors[2];
+        maxWidth = std::max(maxWidth, n);
+        maxHeight = std::max(maxHeight, m);
+
+        sizeA += (size_t)m * k;
+        sizeB += (size_t)k * n;
+        sizeC += (size_t)m * n;
+    }
+
+    // The descriptors hold int offsets.
+    if (std::max(sizeA, std::max(sizeB, sizeC)) > 0x7fffffff)
+    {
+        throw "batch too large";
+    }
+
+    // Nothing to upload or nothing to compute: every product is empty or,
+    // with a 0 inner dimension everywhere, all zeros.
+    if (sizeA == 0 || sizeB == 0 || sizeC == 0)
+    {
+        results.reserve(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            results.push_back(Matrix(rhs[i].width(), lhs[i].height()));
+        }
+        return results;
+    }
+
+    // One upload per operand instead of one per matrix
+    std::vector<float, DefaultInitAllocator<float> > packedA(sizeA);
+    std::vector<float, DefaultInitAllocator<float> > packedB(sizeB);
+    for (size_t i = 0; i < count; i++)
+    {
+        const int* descriptor = &descriptors[i * DESCRIPTOR_SIZE];
+        std::copy(lhs[i].data(), lhs[i].data() + (size_t)descriptor[0] * descriptor[2], &packedA[descriptor[3]]);
+        std::copy(rhs[i].data(), rhs[i].data() + (size_t)descriptor[2] * descriptor[1], &packedB[descriptor[4]]);
+    }
+
+    PooledBuffer dev_A = pooledBuffer(sizeof(float) * sizeA, &packedA[0]);
+    PooledBuffer dev_B = pooledBuffer(sizeof(float) * sizeB, &packedB[0]);
+    PooledBuffer dev_C = pooledBuffer(sizeof(float) * sizeC, NULL);
+
+    if (m_batchedProgram == NULL)
+    {
+        m_batchedProgram = buildProgram(m_context.get(), "matrix_mul_batched.cl");
+    }
+
+    cl_kernel kernel = cachedKernel(m_batchedProgram, uniform ? "matrix_mul_uniform" : "matrix_mul_variable");
+
+    const cl_mem memObjs[] = { dev_A.get(), dev_B.get(), dev_C.get(), 0 };
+    int argNdx = setKernelArgs(kernel, 0, memObjs);
+
+    // Kept until the blocking readback below
+    std::unique_ptr<PooledBuffer> dev_Descriptors;
+    if (uniform)
+    {
+        const int sizes[] = { descriptors[0], descriptors[1], descriptors[2], 0 };
+        setKernelArgs(kernel, argNdx, sizes);
+    }
+    else
+    {
+        dev_Descriptors.reset(new PooledBuffer(pooledBuffer(sizeof(int) * descriptors.size(), &descriptors[0])));
+        const cl_mem descriptorObjs[] = { dev_Descriptors->get(), 0 };
+        setKernelArgs(kernel, argNdx, descriptorObjs);
+    }
+
+    size_t globalWorkSize[3] = { (size_t)maxWidth, (size_t)maxHeight, count };
+    ProfiledEvent kernelDone(m_profiler, "matrix_mul_batched", m_queue.get());
+    if (clEnqueueNDRangeKernel(m_queue.get(), kernel, 3, NULL, globalWorkSize, NULL, 0, NULL, kernelDone.get()) != CL_SUCCESS)
+    {
+        throw "job enqueue fail";
+    }
+    kernelDone.enqueued();
+
+    std::vector<float, DefaultInitAllocator<float> > packedC(sizeC);
+    ProfiledEvent readDone(m_profiler, "readback", m_queue.get());
+    if (clEnqueueReadBuffer(m_queue.get(), dev_C.get(), CL_TRUE, 0, sizeof(float) * sizeC, &packedC[0], 0, NULL, readDone.get()) != CL_SUCCESS)
+    {
+        throw "readback fail";
+    }
+    readDone.enqueued();
+
+    results.reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const int* descriptor = &descriptors[i * DESCRIPTOR_SIZE];
+        results.push_back(Matrix::uninitialized(descriptor[1], descriptor[0]));
+
+        const float* c = &packedC[descriptor[5]];
+        std::copy(c, c + (size_t)descriptor[0] * descriptor[1], results.back().data());
+    }
+
+    return results;
+}
+
+cl_program GpuOperations::programFor(int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    // A handful of hot shapes is the use case, not one program per call.
+    static const size_t MAX_SPECIALIZED_PROGRAMS = 32;
+
+    if (!m_specialize)
+    {
+        return m_program.get();
+    }
+
+    const std::string options = m_buildOptions + " " + specializationOptions(lhsWidth, lhsHeight, rhsWidth);
+
+    std::map<std::string, cl_program>::iterator it = m_specializedPrograms.find(options);
+    if (it != m_specializedPrograms.end())
+    {
+        return it->second != NULL ? it->second : m_program.get();
+    }
+
+    if (m_specializedPrograms.size() >= MAX_SPECIALIZED_PROGRAMS)
+    {
+        return m_program.get();
+    }
+
+    cl_program program = NULL;
+    try
+    {
+        program = buildProgram(m_context.get(), m_kernelFile, options);
+    }
+    catch (const char*)
+    {
+        // Keep using the generic program for this shape.
+    }
+
+    m_specializedPrograms[options] = program;
+    return program != NULL ? program : m_program.get();
+}
+
+std::string GpuOperations::specializationOptions(int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    char options[128];
+    snprintf(options, sizeof(options), "-DMATRIX_M=%d -DMATRIX_N=%d -DMATRIX_K=%d", lhsHeight, rhsWidth, lhsWidth);
+    return options;
+}
+
+void GpuOperations::enqueueMultiply(cl_mem lhs, cl_mem rhs, cl_mem result, int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    // Prepare kernel
+    cl_kernel kernel = cachedKernel(programFor(lhsWidth, lhsHeight, rhsWidth), "matrix_mul");
+
+    const cl_mem memObjs[] = { lhs, rhs, result, 0 };
+    int argNdx = setKernelArgs(kernel, 0, memObjs);
+
+    const int sizes[] = { lhsWidth, rhsWidth, 0 };
+    setKernelArgs(kernel, argNdx, sizes);
+
+    size_t globalWorkSize[2];
+    multiplyRange(lhsWidth, lhsHeight, rhsWidth, globalWorkSize);
+
+    ProfiledEvent kernelDone(m_profiler, "matrix_mul", m_queue.get());
+    if (clEnqueueNDRangeKernel(m_queue.get(), kernel, 2, NULL, globalWorkSize, localWorkSize(), 0, NULL, kernelDone.get()) != CL_SUCCESS)
+    {
+        throw "job enqueue fail";
+    }
+    kernelDone.enqueued();
+}
+
+void GpuOperations::multiplyRange(int lhsWidth, int lhsHeight, int rhsWidth, size_t* globalWorkSize) const
+{
+    globalWorkSize[0] = rhsWidth;
+    globalWorkSize[1] = lhsHeight;
+}
+
+bool GpuOperations::acceptsLocalWorkSize(size_t x, size_t y, int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    if (x == 0 && y == 0)
+    {
+        return true;
+    }
+
+    size_t maxGroupSize = 1;
+    size_t maxItemSizes[3] = { 1, 1, 1 };
+    clGetDeviceInfo(m_deviceId, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(maxGroupSize), &maxGroupSize, NULL);
+    clGetDeviceInfo(m_deviceId, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItemSizes), maxItemSizes, NULL);
+
+    size_t kernelGroupSize = maxGroupSize;
+    clGetKernelWorkGroupInfo(cachedKernel("matrix_mul"), m_deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernelGroupSize), &kernelGroupSize, NULL);
+
+    size_t globalWorkSize[2];
+    multiplyRange(lhsWidth, lhsHeight, rhsWidth, globalWorkSize);
+
+    return x != 0 && y != 0
+        && x * y <= std::min(maxGroupSize, kernelGroupSize)
+        && x <= maxItemSizes[0] && y <= maxItemSizes[1]
+        && globalWorkSize[0] % x == 0 && globalWorkSize[1] % y == 0;
+}
+
+std::string GpuOperations::deviceName(void) const
+{
+    char* name = query_device_info(m_deviceId, CL_DEVICE_NAME);
+    char* sw_opencl = query_device_info(m_deviceId, CL_DRIVER_VERSION);
+    const std::string result = std::string(name ? name : "") + " / " + (sw_opencl ? sw_opencl : "");
+    free(name);
+    free(sw_opencl);
+
+    return result;
+}
+
+void GpuOperations::traceEvent(const char* name, cl_command_queue queue, cl_event event) const
+{
+    if (m_profiler != NULL)
+    {
+        m_profiler->addEvent(name, queue, event);
+    }
+}
+
+int GpuOperations::setKernelArgs(cl_kernel kernel, int argNdx, const cl_mem* memObjs) const
+{
+    for (int i = 0; memObjs[i] != 0; i++, argNdx++)
+    {
+        if (clSetKernelArg(kernel, argNdx, sizeof(cl_mem), (void*)&memObjs[i]) != CL_SUCCESS)
+        {
+            throw "kernel arg set fail";
+        }
+    }
+
+    return argNdx;
+}
+
+int GpuOperations::setKernelArgs(cl_kernel kernel, int argNdx, const int* sizes) const
+{
+    for (int i = 0; sizes[i] != 0; i++, argNdx++)
+    {
+        if (clSetKernelArg(kernel, argNdx, sizeof(int), (void*)&sizes[i]) != CL_SUCCESS)
+        {
+            throw "kernel arg set fail";
+        }
+    }
+
+    return argNdx;
+}
+
+int GpuOperations::setKernelArgs(cl_kernel kernel, int argNdx, const int* values, size_t count) const
+{
+    for (size_t i = 0; i < count; i++, argNdx++)
+    {
+        if (clSetKernelArg(kernel, argNdx, sizeof(int), &values[i]) != CL_SUCCESS)
+        {
+            throw "kernel arg set fail";
+        }
+    }
+
+    return argNdx;
+}
+
+int GpuOperations::setKernelArgs(cl_kernel kernel, int argNdx, const float* values, size_t count) const
+{
+    for (size_t i = 0; i < count; i++, argNdx++)
+    {
+        if (clSetKernelArg(kernel, argNdx, sizeof(float), &values[i]) != CL_SUCCESS)
+        {
+            throw "kernel arg set fail";
+        }
+    }
+
+    return argNdx;
+}
+
+cl_context GpuOperations::createContext(void) const
+{
+    cl_int error;
+    cl_context context = clCreateContext(NULL, 1, &m_deviceId, NULL, NULL, &error);
+    if (!context || error != CL_SUCCESS)
+    {
+        throw "context fail";
+    }
+
+    return context;
+}
+
+cl_command_queue GpuOperations::createCommandQueue(cl_context context, const char* name) const
+{
+    const cl_command_queue_properties properties = m_profiler != NULL ? CL_QUEUE_PROFILING_ENABLE : 0;
+
+    cl_int error;
+    cl_command_queue queue = clCreateCommandQueue(context, m_deviceId, properties, &error);
+    if (!queue || error != CL_SUCCESS)
+    {
+        throw "command queue fail";
+    }
+
+    if (m_profiler != NULL)
+    {
+        m_profiler->addQueue(queue, m_deviceId, deviceName(), name);
+    }
+
+    return queue;
+}
+
+cl_program GpuOperations::buildProgram(cl_context context, const std::string& filename, const std::string& options) const
+{
+    ProfiledSpan span(m_profiler, "build", filename);
+
+    char* kernel_source = read_file(filename.c_str());
+    const std::string source = kernel_source;
+    free(kernel_source);
+
+    // A binary from an earlier run skips the compilation.
+    const ProgramCache& cache = ProgramCache::instance();
+    cl_program program = cache.load(context, m_deviceId, source, options);
+    if (program != NULL)
+    {
+        return program;
+    }
+
+    cl_int error;
+    const char* src = source.c_str();
+    program = clCreateProgramWithSource(context, 1, &src, NULL, &error);
+    if (!program || error != CL_SUCCESS)
+    {
+        throw "program fail";
+    }
+
+    error = clBuildProgram(program, 0, NULL, options.c_str(), NULL, NULL);
+    if (error)
+    {
+        size_t len;
+        char buffer[2048];
+        printf("Error: Unable to build the program, error message:\n");
+        clGetProgramBuildInfo(program, m_deviceId, CL_PROGRAM_BUILD_LOG, sizeof(buffer), buffer, &len);
+        printf("%s\n", buffer);
+        throw "build fail";
+    }
+
+    cache.store(program, m_deviceId, source, options);
+
+    return program;
+}
+
+cl_kernel GpuOperations::createKernel(cl_context context, cl_program program, const std::string& name) const
+{
+    cl_int error;
+    cl_kernel kernel = clCreateKernel(program, name.c_str(), &error);
+    if (!kernel || error != CL_SUCCESS)
+    {
+        throw "kernel fail";
+    }
+
+    return kernel;
+}
+
+cl_kernel GpuOperations::cachedKernel(cl_program program, const std::string& name) const
+{
+    const std::pair<cl_program, std::string> key(program, name);
+
+    std::map<std::pair<cl_program, std::string>, cl_kernel>::iterator it = m_kernels.find(key);
+    if (it != m_kernels.end())
+    {
+        return it->second;
+    }
+
+    ProfiledSpan span(m_profiler, "create kernel", name);
+    cl_kernel kernel = createKernel(m_context.get(), program, name);
+    m_kernels[key] = kernel;
+    return kernel;
+}
+
+cl_mem GpuOperations::uploadBuffer(cl_context context, size_t size, const void* dataPtr) const
+{
+    cl_int error;
+    cl_mem_flags flags = CL_MEM_READ_WRITE | (dataPtr != NULL ? CL_MEM_COPY_HOST_PTR : 0);
+    cl_mem mem = clCreateBuffer(context, flags, size, const_cast<void*>(dataPtr), &error);
+    if (error != CL_SUCCESS)
+    {
+        throw "upload buffer fail";
+    }
+    return mem;
+}
+
+PooledBuffer GpuOperations::acquireBuffer(size_t size) const
+{
+    ProfiledSpan span(m_profiler, "alloc");
+    return PooledBuffer(m_bufferPool, size);
+}
+
+PooledBuffer GpuOperations::pooledBuffer(size_t size, const void* dataPtr) const
+{
+    PooledBuffer buffer = acquireBuffer(size);
+
+    // Non-blocking: the caller keeps the host data alive until its blocking readback.
+    ProfiledEvent uploaded(m_profiler, "upload", m_queue.get());
+    if (dataPtr != NULL
+        && clEnqueueWriteBuffer(m_queue.get(), buffer.get(), CL_FALSE, 0, size, dataPtr, 0, NULL, uploaded.get()) != CL_SUCCESS)
+    {
+        throw "upload buffer fail";
+    }
+    uploaded.enqueued();
+
+    return buffer;
+}
+
+// Origins and regions of the rect transfers between a view and a packed buffer, in bytes.
+static void viewRegion(const ConstMatrixView& view, size_t* origin, size_t* region)
+{
+    origin[0] = origin[1] = origin[2] = 0;
+    region[0] = sizeof(float) * view.width();
+    region[1] = view.height();
+    region[2] = 1;
+}
+
+PooledBuffer GpuOperations::pooledBuffer(const ConstMatrixView& view) const
+{
+    const size_t size = sizeof(float) * view.width() * view.height();
+    if (view.contiguous())
+    {
+        return pooledBuffer(size, view.data());
+    }
+
+    PooledBuffer buffer = acquireBuffer(size);
+
+    size_t origin[3];
+    size_t region[3];
+    viewRegion(view, origin, region);
+    ProfiledEvent uploaded(m_profiler, "upload", m_queue.get());
+    if (clEnqueueWriteBufferRect(m_queue.get(), buffer.get(), CL_FALSE, origin, origin, region,
+                                 region[0], 0, sizeof(float) * view.stride(), 0, view.data(), 0, NULL, uploaded.get()) != CL_SUCCESS)
+    {
+        throw "upload buffer fail";
+    }
+    uploaded.enqueued();
+
+    return buffer;
+}
+
+void GpuOperations::readBuffer(cl_mem buffer, const MatrixView& view) const
+{
+    ProfiledEvent readDone(m_profiler, "readback", m_queue.get());
+
+    cl_int error;
+    if (view.contiguous())
+    {
+        error = clEnqueueReadBuffer(m_queue.get(), buffer, CL_TRUE, 0, sizeof(float) * view.width() * view.height(),
+                                    view.data(), 0, NULL, readDone.get());
+    }
+    else
+    {
+        size_t origin[3];
+        size_t region[3];
+        viewRegion(view, origin, region);
+        error = clEnqueueReadBufferRect(m_queue.get(), buffer, CL_TRUE, origin, origin, region,
+                                        region[0], 0, sizeof(float) * view.stride(), 0, view.data(), 0, NULL, readDone.get());
+    }
+    readDone.enqueued();
+
+    if (error != CL_SUCCESS)
+    {
+        throw "readback fail";
+    }
+}
+
+std::vector<cl_device_id> GpuOperations::devices(void)
+{
+    std::vector<cl_device_id> result;
+
+    cl_uint platform_count = 0;
+    clGetPlatformIDs(0, NULL, &platform_count);
+    if (platform_count == 0)
+    {
+        return result;
+    }
+
+    std::vector<cl_platform_id> platforms(platform_count);
+    clGetPlatformIDs(platform_count, &platforms[0], NULL);
+
+    for (cl_uint i = 0; i < platform_count; i++)
+    {
+        cl_uint device_count = 0;
+        if (clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 0, NULL, &device_count) != CL_SUCCESS || device_count == 0)
+        {
+            continue;
+        }
+
+        const size_t first = result.size();
+        result.resize(first + device_count);
+        if (clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, device_count, &result[first], NULL) != CL_SUCCESS)
+        {
+            result.resize(first);
+        }
+    }
+
+    return result;
+}
+
+cl_device_id GpuOperations::selectDevice(void)
+{
+    const std::vector<cl_device_id> all = devices();
+    if (all.empty())
+    {
+        throw "no device";
+    }
+
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        if (device_is_gpu(all[i]))
+        {
+            return all[i];
+        }
+    }
+
+    // Without a GPU use the first device, so CPU runtimes (like POCL) work too.
+    return all[0];
+}
+
+// Typed Gpu Operations
+
+template<typename T>
+BasicGpuOperations<T>::BasicGpuOperations(std::string kernelFile)
+    : m_device(realKernelFile(kernelFile), std::is_same<T, double>::value)
+{
+}
+
+template<typename T>
+const std::string& BasicGpuOperations<T>::realKernelFile(const std::string& kernelFile)
+{
+    // The other kernel files hardcode float and would silently read doubles as floats.
+    static const char* const REAL_FILES[] = { "matrix_mul.cl", "matrix_mul_constant.cl", "matrix_mul_dot.cl", "matrix_mul_float4.cl" };
+
+    const size_t slash = kernelFile.find_last_of('/');
+    const std::string name = slash == std::string::npos ? kernelFile : kernelFile.substr(slash + 1);
+    for (size_t i = 0; i < sizeof(REAL_FILES) / sizeof(REAL_FILES[0]); i++)
+    {
+        if (name == REAL_FILES[i])
+        {
+            return kernelFile;
+        }
+    }
+
+    throw "kernel file does not take REAL";
+}
+
+template<typename T>
+BasicMatrix<T> BasicGpuOperations<T>::multiply(const BasicMatrix<T>& lhs, const BasicMatrix<T>& rhs) const
+{
+    BasicMatrix<T> result = BasicMatrix<T>::uninitialized(rhs.width(), lhs.height());
+    BasicMatrixView<T> view = result.view();
+    BasicGpuOperations::multiplyInto(lhs, rhs, view);
+
+    return result;
+}
+
+template<typename T>
+void BasicGpuOperations<T>::multiplyInto(const BasicMatrixView<const T>& lhs, const BasicMatrixView<const T>& rhs, BasicMatrixView<T>& result) const
+{
+    checkShapes(lhs, rhs, result);
+    if (emptyProduct(lhs, result))
+    {
+        return;
+    }
+
+    if (!lhs.contiguous() || !rhs.contiguous() || !result.contiguous())
+    {
+        BasicOperations<T>::multiplyInto(lhs, rhs, result);
+        return;
+    }
+
+    m_device.multiply(lhs.data(), rhs.data(), result.data(), sizeof(T), lhs.width(), lhs.height(), rhs.width());
+}
+
+template<typename T>
+BasicGpuOperations<T>::Device::Device(const std::string& kernelFile, bool fp64)
+    : GpuOperations(realDevice(fp64), kernelFile, fp64 ? "-DREAL=double -DREAL_FP64" : "-DREAL=float")
+{
+}
+
+template<typename T>
+void BasicGpuOperations<T>::Device::multiply(const void* lhs, const void* rhs, void* result, size_t elementSize,
+                                             int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    const size_t resultSize = elementSize * rhsWidth * lhsHeight;
+    PooledBuffer dev_A = pooledBuffer(elementSize * lhsWidth * lhsHeight, lhs);
+    PooledBuffer dev_B = pooledBuffer(elementSize * rhsWidth * lhsWidth, rhs);
+    PooledBuffer dev_C = pooledBuffer(resultSize, NULL);
+
+    enqueueMultiply(dev_A.get(), dev_B.get(), dev_C.get(), lhsWidth, lhsHeight, rhsWidth);
+
+    ProfiledEvent readDone(m_profiler, "readback", m_queue.get());
+    if (clEnqueueReadBuffer(m_queue.get(), dev_C.get(), CL_TRUE, 0, resultSize, result, 0, NULL, readDone.get()) != CL_SUCCESS)
+    {
+        throw "readback fail";
+    }
+    readDone.enqueued();
+}
+
+template<typename T>
+cl_device_id BasicGpuOperations<T>::Device::realDevice(bool fp64)
+{
+    const cl_device_id device = selectDevice();
+    if (fp64)
+    {
+        char* extensions = query_device_info(device, CL_DEVICE_EXTENSIONS);
+        const bool supported = extensions != NULL && strstr(extensions, "cl_khr_fp64") != NULL;
+        free(extensions);
+
+        if (!supported)
+        {
+            throw "fp64 not supported";
+        }
+    }
+
+    return device;
+}
+
+template class BasicGpuOperations<float>;
+template class BasicGpuOperations<double>;
+
+// Transposed Gpu Operations
+
+TransposedGpuOperations::TransposedGpuOperations(void)
+    : GpuOperations("matrix_mul_transposed.cl")
+{
+}
+
+void TransposedGpuOperations::enqueueMultiply(cl_mem lhs, cl_mem rhs, cl_mem result, int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    const int rhsHeight = lhsWidth;
+
+    // Prepare kernel
+    cl_program program = programFor(lhsWidth, lhsHeight, rhsWidth);
+    cl_kernel kernel = cachedKernel(program, "matrix_mul");
+
+    // Transposed dst matrix
+    PooledBuffer dev_T = pooledBuffer(sizeof(float) * rhsWidth * rhsHeight, NULL);
+
+    cl_event transposeEvent;
+    enqueueTranspose(program, rhs, dev_T.get(), rhsWidth, rhsHeight, &transposeEvent);
+
+    {
+        const cl_mem memObjs[] = { lhs, dev_T.get(), result, 0 };
+        int argNdx = setKernelArgs(kernel, 0, memObjs);
+
+        const int sizes[] = { lhsWidth, rhsWidth, 0 };
+        setKernelArgs(kernel, argNdx, sizes);
+    }
+
+    size_t globalWorkSize[2];
+    multiplyRange(lhsWidth, lhsHeight, rhsWidth, globalWorkSize);
+    ProfiledEvent kernelDone(m_profiler, "matrix_mul", m_queue.get());
+    cl_int error = clEnqueueNDRangeKernel(m_queue.get(), kernel, 2, NULL, globalWorkSize, localWorkSize(), 1, &transposeEvent, kernelDone.get());
+    clReleaseEvent(transposeEvent);
+    if (error != CL_SUCCESS)
+    {
+        throw "job enqueue fail";
+    }
+    kernelDone.enqueued();
+}
+
+void TransposedGpuOperations::enqueueGemm(bool transA, bool transB, cl_mem a, cl_mem b, cl_mem c, cl_mem bias,
+                                          int m, int n, int k, float alpha, float beta, const Epilogue& epilogue) const
+{
+    cl_kernel kernel = cachedKernel(gemmVariantProgram(transA, transB), "gemm");
+    setGemmArgs(kernel, a, b, c, bias, m, n, k, alpha, beta, epilogue);
+
+    size_t globalWorkSize[2] = { (size_t)n, (size_t)m };
+    ProfiledEvent kernelDone(m_profiler, "gemm", m_queue.get());
+    if (clEnqueueNDRangeKernel(m_queue.get(), kernel, 2, NULL, globalWorkSize, NULL, 0, NULL, kernelDone.get()) != CL_SUCCESS)
+    {
+        throw "job enqueue fail";
+    }
+    kernelDone.enqueued();
+}
+
+void TransposedGpuOperations::enqueueTranspose(cl_program program, cl_mem src, cl_mem dst, int width, int height, cl_event* event) const
+{
+    // Must match TRANSPOSE_TILE in matrix_mul_transposed.cl
+    static const size_t TRANSPOSE_TILE = 16;
+
+    cl_kernel kernel = cachedKernel(program, "matrix_transpose");
+
+    const cl_mem memObjs[] = { src, dst, 0 };
+    int argNdx = setKernelArgs(kernel, 0, memObjs);
+
+    // Counted: a zero size must not end the list.
+    const int sizes[] = { width, height };
+    setKernelArgs(kernel, argNdx, sizes, sizeof(sizes) / sizeof(sizes[0]));
+
+    size_t localWorkSize[2] = { TRANSPOSE_TILE, TRANSPOSE_TILE };
+    size_t globalWorkSize[2] = {
+        (width + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE * TRANSPOSE_TILE,
+        (height + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE * TRANSPOSE_TILE
+    };
+    ProfiledEvent transposeDone(m_profiler, "matrix_transpose", m_queue.get());
+    if (clEnqueueNDRangeKernel(m_queue.get(), kernel, 2, NULL, globalWorkSize, localWorkSize, 0, NULL,
+                               event != NULL ? event : transposeDone.get()) != CL_SUCCESS)
+    {
+        throw "transpose job enqueue fail";
+    }
+    transposeDone.enqueued();
+
+    if (event != NULL)
+    {
+        traceEvent("matrix_transpose", m_queue.get(), *event);
+    }
+}
+
+Matrix TransposedGpuOperations::transpose(const Matrix& matrix) const
+{
+    if (matrix.width() == 0 || matrix.height() == 0)
+    {
+        return Matrix(matrix.height(), matrix.width());
+    }
+
+    PooledBuffer dev_Src = pooledBuffer(matrix.dataSize(), matrix.data());
+    PooledBuffer dev_Dst = pooledBuffer(matrix.dataSize(), NULL);
+
+    enqueueTranspose(m_program.get(), dev_Src.get(), dev_Dst.get(), matrix.width(), matrix.height(), NULL);
+
+    Matrix result = Matrix::uninitialized(matrix.height(), matrix.width());
+    readBuffer(dev_Dst.get(), result);
+    return result;
+}
+
+void TransposedGpuOperations::timeTranspose(int width, int height, int runs, double* transposeSeconds, double* copySeconds) const
+{
+    using namespace std::chrono;
+
+    const size_t size = sizeof(float) * width * height;
+    if (size == 0)
+    {
+        *transposeSeconds = 0.0;
+        *copySeconds = 0.0;
+        return;
+    }
+
+    PooledBuffer dev_Src = pooledBuffer(size, NULL);
+    PooledBuffer dev_Dst = pooledBuffer(size, NULL);
+
+    // The first transpose creates the kernel.
+    enqueueTranspose(m_program.get(), dev_Src.get(), dev_Dst.get(), width, height, NULL);
+    clFinish(m_queue.get());
+
+    steady_clock::time_point start = steady_clock::now();
+    for (int i = 0; i < runs; i++)
+    {
+        enqueueTranspose(m_program.get(), dev_Src.get(), dev_Dst.get(), width, height, NULL);
+    }
+    clFinish(m_queue.get());
+    *transposeSeconds = duration_cast<duration<double> >(steady_clock::now() - start).count() / runs;
+
+    start = steady_clock::now();
+    for (int i = 0; i < runs; i++)
+    {
+        ProfiledEvent copyDone(m_profiler, "copy", m_queue.get());
+        if (clEnqueueCopyBuffer(m_queue.get(), dev_Src.get(), dev_Dst.get(), 0, 0, size, 0, NULL, copyDone.get()) != CL_SUCCESS)
+        {
+            throw "copy enqueue fail";
+        }
+        copyDone.enqueued();
+    }
+    clFinish(m_queue.get());
+    *copySeconds = duration_cast<duration<double> >(steady_clock::now() - start).count() / runs;
+}
+
+
+// Tiled Gpu Operations
+
+TiledGpuOperations::TiledGpuOperations(void)
+    : GpuOperations("matrix_mul_tiled.cl")
+    , m_tileSize(selectTileSize())
+{
+}
+
+size_t TiledGpuOperations::selectTileSize(void) const
+{
+    size_t maxGroupSize = 1;
+    size_t maxItemSizes[3] = { 1, 1, 1 };
+    cl_ulong localMemSize = 0;
+    clGetDeviceInfo(m_deviceId, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(maxGroupSize), &maxGroupSize, NULL);
+    clGetDeviceInfo(m_deviceId, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItemSizes), maxItemSizes, NULL);
+    clGetDeviceInfo(m_deviceId, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(localMemSize), &localMemSize, NULL);
+
+    // The compiled kernel may support fewer work-items than the device does.
+    cl_kernel kernel = cachedKernel("matrix_mul");
+    size_t kernelGroupSize = maxGroupSize;
+    clGetKernelWorkGroupInfo(kernel, m_deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernelGroupSize), &kernelGroupSize, NULL);
+    maxGroupSize = std::min(maxGroupSize, kernelGroupSize);
+
+    size_t tile = 32;
+    while (tile > 1
+           && (tile * tile > maxGroupSize
+               || tile > maxItemSizes[0]
+               || tile > maxItemSizes[1]
+               || 2 * tile * tile * sizeof(float) > localMemSize))
+    {
+        tile /= 2;
+    }
+
+    return tile;
+}
+
+bool TiledGpuOperations::acceptsLocalWorkSize(size_t x, size_t y, int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    // The range is padded to whole tiles, so any tile that fits works for every shape.
+    return (x == 0 && y == 0)
+        || (x == y && x >= 4 && x <= m_tileSize && (x & (x - 1)) == 0);
+}
+
+std::string TiledGpuOperations::specializationOptions(int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    char options[32];
+    snprintf(options, sizeof(options), " -DTILE_SIZE=%d", (int)tileSize());
+    return GpuOperations::specializationOptions(lhsWidth, lhsHeight, rhsWidth) + options;
+}
+
+void TiledGpuOperations::enqueueMultiply(cl_mem lhs, cl_mem rhs, cl_mem result, int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    // Prepare kernel
+    cl_kernel kernel = cachedKernel(programFor(lhsWidth, lhsHeight, rhsWidth), "matrix_mul");
+
+    const cl_mem memObjs[] = { lhs, rhs, result, 0 };
+    int argNdx = setKernelArgs(kernel, 0, memObjs);
+
+    const int sizes[] = { lhsWidth, rhsWidth, lhsHeight, 0 };
+    argNdx = setKernelArgs(kernel, argNdx, sizes);
+
+    // Local memory for one tile of A and one tile of B
+    const size_t tile = tileSize();
+    const size_t tileBytes = sizeof(float) * tile * tile;
+    if (clSetKernelArg(kernel, argNdx++, tileBytes, NULL) != CL_SUCCESS
+        || clSetKernelArg(kernel, argNdx++, tileBytes, NULL) != CL_SUCCESS)
+    {
+        throw "kernel arg set fail";
+    }
+
+    // Pad the range to whole tiles, the kernel masks the items outside C.
+    size_t localWorkSize[2] = { tile, tile };
+    size_t globalWorkSize[2] = {
+        (rhsWidth + tile - 1) / tile * tile,
+        (lhsHeight + tile - 1) / tile * tile
+    };
+
+    ProfiledEvent kernelDone(m_profiler, "matrix_mul", m_queue.get());
+    if (clEnqueueNDRangeKernel(m_queue.get(), kernel, 2, NULL, globalWorkSize, localWorkSize, 0, NULL, kernelDone.get()) != CL_SUCCESS)
+    {
+        throw "job enqueue fail";
+    }
+    kernelDone.enqueued();
+}
+
+void TiledGpuOperations::enqueueGemm(bool transA, bool transB, cl_mem a, cl_mem b, cl_mem c, cl_mem bias,
+                                     int m, int n, int k, float alpha, float beta, const Epilogue& epilogue) const
+{
+    cl_kernel kernel = cachedKernel(gemmVariantProgram(transA, transB), "gemm");
+    int argNdx = setGemmArgs(kernel, a, b, c, bias, m, n, k, alpha, beta, epilogue);
+
+    // The gemm kernel may support fewer work-items than matrix_mul did.
+    size_t tile = tileSize();
+    size_t kernelGroupSize = tile * tile;
+    clGetKernelWorkGroupInfo(kernel, m_deviceId, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernelGroupSize), &kernelGroupSize, NULL);
+    while (tile > 1 && tile * tile > kernelGroupSize)
+    {
+        tile /= 2;
+    }
+
+    const size_t tileBytes = sizeof(float) * tile * tile;
+    if (clSetKernelArg(kernel, argNdx++, tileBytes, NULL) != CL_SUCCESS
+        || clSetKernelArg(kernel, argNdx++, tileBytes, NULL) != CL_SUCCESS)
+    {
+        throw "kernel arg set fail";
+    }
+
+    size_t localWorkSize[2] = { tile, tile };
+    size_t globalWorkSize[2] = {
+        (n + tile - 1) / tile * tile,
+        (m + tile - 1) / tile * tile
+    };
+
+    ProfiledEvent kernelDone(m_profiler, "gemm", m_queue.get());
+    if (clEnqueueNDRangeKernel(m_queue.get(), kernel, 2, NULL, globalWorkSize, localWorkSize, 0, NULL, kernelDone.get()) != CL_SUCCESS)
+    {
+        throw "job enqueue fail";
+    }
+    kernelDone.enqueued();
+}
+
+
+// Register blocked Gpu Operations
+
+BlockedGpuOperations::BlockedGpuOperations(int blockRows)
+    : GpuOperations("matrix_mul_block.cl", buildOptions(blockRows))
+    , m_blockRows(blockRows)
+{
+}
+
+std::string BlockedGpuOperations::buildOptions(int blockRows)
+{
+    switch (blockRows)
+    {
+        case 4: return "-DBLOCK_M=4 -DK_VEC=4";
+        case 8: return "-DBLOCK_M=8 -DK_VEC=8";
+    }
+
+    throw "unsupported block shape";
+}
+
+void BlockedGpuOperations::enqueueMultiply(cl_mem lhs, cl_mem rhs, cl_mem result, int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    // Prepare kernel
+    cl_kernel kernel = cachedKernel(programFor(lhsWidth, lhsHeight, rhsWidth), "matrix_mul");
+
+    const cl_mem memObjs[] = { lhs, rhs, result, 0 };
+    int argNdx = setKernelArgs(kernel, 0, memObjs);
+
+    const int sizes[] = { lhsWidth, rhsWidth, lhsHeight, 0 };
+    setKernelArgs(kernel, argNdx, sizes);
+
+    size_t globalWorkSize[2];
+    multiplyRange(lhsWidth, lhsHeight, rhsWidth, globalWorkSize);
+
+    ProfiledEvent kernelDone(m_profiler, "matrix_mul", m_queue.get());
+    if (clEnqueueNDRangeKernel(m_queue.get(), kernel, 2, NULL, globalWorkSize, localWorkSize(), 0, NULL, kernelDone.get()) != CL_SUCCESS)
+    {
+        throw "job enqueue fail";
+    }
+    kernelDone.enqueued();
+}
+
+void BlockedGpuOperations::enqueueGemm(bool transA, bool transB, cl_mem a, cl_mem b, cl_mem c, cl_mem bias,
+                                       int m, int n, int k, float alpha, float beta, const Epilogue& epilogue) const
+{
+    cl_kernel kernel = cachedKernel(gemmVariantProgram(transA, transB), "gemm");
+    setGemmArgs(kernel, a, b, c, bias, m, n, k, alpha, beta, epilogue);
+
+    size_t globalWorkSize[2];
+    multiplyRange(k, m, n, globalWorkSize);
+
+    ProfiledEvent kernelDone(m_profiler, "gemm", m_queue.get());
+    if (clEnqueueNDRangeKernel(m_queue.get(), kernel, 2, NULL, globalWorkSize, localWorkSize(), 0, NULL, kernelDone.get()) != CL_SUCCESS)
+    {
+        throw "job enqueue fail";
+    }
+    kernelDone.enqueued();
+}
+
+void BlockedGpuOperations::multiplyRange(int lhsWidth, int lhsHeight, int rhsWidth, size_t* globalWorkSize) const
+{
+    // One work-item per (possibly partial) block of C
+    globalWorkSize[0] = (rhsWidth + 3) / 4;
+    globalWorkSize[1] = (lhsHeight + m_blockRows - 1) / m_blockRows;
+}
+
+
+// Mixed precision Gpu Operations
+
+MixedPrecisionGpuOperations::MixedPrecisionGpuOperations(StorageFormat format)
+    : m_format(format)
+    , m_mixedProgram(buildProgram(m_context.get(), "matrix_mul_mixed.cl", format == STORAGE_BF16 ? "-DSTORAGE_BF16" : ""))
+{
+}
+
+Matrix MixedPrecisionGpuOperations::multiply(const Matrix& lhs, const Matrix& rhs) const
+{
+    Matrix result = Matrix::uninitialized(rhs.width(), lhs.height());
+    MatrixView view = result.view();
+    MixedPrecisionGpuOperations::multiplyInto(lhs, rhs, view);
+
+    return result;
+}
+
+void MixedPrecisionGpuOperations::multiplyInto(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView& result) const
+{
+    checkShapes(lhs, rhs, result);
+    if (emptyProduct(lhs, result))
+    {
+        return;
+    }
+
+    PooledBuffer dev_A = storageBuffer(lhs, m_lhsStorage);
+    PooledBuffer dev_B = storageBuffer(rhs, m_rhsStorage);
+    PooledBuffer dev_C = pooledBuffer(sizeof(float) * result.width() * result.height(), NULL);
+
+    cl_kernel kernel = cachedKernel(m_mixedProgram.get(), "matrix_mul_mixed");
+
+    const cl_mem memObjs[] = { dev_A.get(), dev_B.get(), dev_C.get(), 0 };
+    int argNdx = setKernelArgs(kernel, 0, memObjs);
+
+    const int sizes[] = { lhs.width(), rhs.width() };
+    setKernelArgs(kernel, argNdx, sizes, sizeof(sizes) / sizeof(sizes[0]));
+
+    size_t globalWorkSize[2] = { (size_t)result.width(), (size_t)result.height() };
+    ProfiledEvent kernelDone(m_profiler, "matrix_mul", m_queue.get());
+    if (clEnqueueNDRangeKernel(m_queue.get(), kernel, 2, NULL, globalWorkSize, localWorkSize(), 0, NULL, kernelDone.get()) != CL_SUCCESS)
+    {
+        throw "job enqueue fail";
+    }
+    kernelDone.enqueued();
+
+    readBuffer(dev_C.get(), result);
+}
+
+// view must not be empty, multiplyInto() returns before uploading an empty operand.
+PooledBuffer MixedPrecisionGpuOperations::storageBuffer(const ConstMatrixView& view, std::vector<uint16_t>& storage) const
+{
+    const size_t width = view.width();
+    storage.resize(width * view.height());
+    for (int y = 0; y < view.height(); y++)
+    {
+        floatToStorage(m_format, &view(0, y), &storage[y * width], width);
+    }
+
+    // Not a blocking upload, the blocking readback of the multiply waits for it.
+    return pooledBuffer(sizeof(uint16_t) * storage.size(), storage.data());
+}
+
+
+// Out-of-core Gpu Operations
+
+// Events of a tiled multiply, waited for and released on the way out so no
+// transfer still runs when the tile buffers go back to the pool.
+struct TileEvents
+{
+    ~TileEvents(void)
+    {
+        wait();
+        for (size_t i = 0; i < events.size(); i++)
+        {
+            clReleaseEvent(events[i]);
+        }
+    }
+
+    cl_int wait(void)
+    {
+        return events.empty() ? CL_SUCCESS : clWaitForEvents((cl_uint)events.size(), &events[0]);
+    }
+
+    std::vector<cl_event> events;
+};
+
+OutOfCoreGpuOperations::OutOfCoreGpuOperations(size_t memoryBudget, size_t maxBufferSize)
+    : GpuOperations("matrix_mul_accumulate.cl")
+    , m_memoryBudget(memoryBudget)
+    , m_maxBufferSize(maxBufferSize)
+{
+    cl_ulong globalMemSize = 0;
+    cl_ulong maxAllocSize = 0;
+    clGetDeviceInfo(m_deviceId, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMemSize), &globalMemSize, NULL);
+    clGetDeviceInfo(m_deviceId, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAllocSize), &maxAllocSize, NULL);
+
+    if (m_memoryBudget == 0)
+    {
+        m_memoryBudget = globalMemSize / 2;
+    }
+    if (m_maxBufferSize == 0 || (maxAllocSize != 0 && m_maxBufferSize > maxAllocSize))
+    {
+        m_maxBufferSize = maxAllocSize;
+    }
+
+    m_stats.tiles = 0;
+    m_stats.uploads = 0;
+    m_stats.reusedUploads = 0;
+}
+
+Matrix OutOfCoreGpuOperations::multiply(const Matrix& lhs, const Matrix& rhs) const
+{
+    const size_t sizeA = sizeof(float) * lhs.width() * (size_t)lhs.height();
+    const size_t sizeB = sizeof(float) * rhs.width() * (size_t)rhs.height();
+    const size_t sizeC = sizeof(float) * rhs.width() * (size_t)lhs.height();
+
+    if (fits(sizeA, sizeB, sizeC))
+    {
+        return GpuOperations::multiply(lhs, rhs);
+    }
+
+    Matrix result = Matrix::uninitialized(rhs.width(), lhs.height());
+    MatrixView view = result.view();
+    multiplyTiled(lhs, rhs, &view, RowSink());
+
+    return result;
+}
+
+void OutOfCoreGpuOperations::multiplyInto(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView& result) const
+{
+    const size_t sizeA = sizeof(float) * lhs.width() * (size_t)lhs.height();
+    const size_t sizeB = sizeof(float) * rhs.width() * (size_t)rhs.height();
+    const size_t sizeC = sizeof(float) * result.width() * (size_t)result.height();
+
+    if (fits(sizeA, sizeB, sizeC))
+    {
+        GpuOperations::multiplyInto(lhs, rhs, result);
+    }
+    else
+    {
+        checkShapes(lhs, rhs, result);
+        multiplyTiled(lhs, rhs, &result, RowSink());
+    }
+}
+
+void OutOfCoreGpuOperations::multiplyRows(const ConstMatrixView& lhs, const ConstMatrixView& rhs, const RowSink& sink) const
+{
+    if (lhs.width() != rhs.height())
+    {
+        throw "shape mismatch";
+    }
+
+    multiplyTiled(lhs, rhs, NULL, sink);
+}
+
+void OutOfCoreGpuOperations::gemm(bool transA, bool transB, float alpha, const ConstMatrixView& a, const ConstMatrixView& b,
+                                  float beta, MatrixView& c, const Epilogue& epilogue) const
+{
+    const size_t sizeA = sizeof(float) * a.width() * (size_t)a.height();
+    const size_t sizeB = sizeof(float) * b.width() * (size_t)b.height();
+    const size_t sizeC = sizeof(float) * c.width() * (size_t)c.height();
+
+    if (fits(sizeA, sizeB, sizeC))
+    {
+        GpuOperations::gemm(transA, transB, alpha, a, b, beta, c, epilogue);
+    }
+    else
+    {
+        Operations::gemm(transA, transB, alpha, a, b, beta, c, epilogue);
+    }
+}
+
+bool OutOfCoreGpuOperations::fits(size_t sizeA, size_t sizeB, size_t sizeC) const
+{
+    return std::max(sizeA, std::max(sizeB, sizeC)) <= m_maxBufferSize && sizeA + sizeB + sizeC <= m_memoryBudget;
+}
+
+void OutOfCoreGpuOperations::tileShape(int lhsWidth, int lhsHeight, int rhsWidth, int* tileM, int* tileN, int* tileK) const
+{
+    // Two square tiles per operand have to fit the budget, one tile a buffer.
+    size_t tile = (size_t)sqrt((double)(m_memoryBudget / (6 * sizeof(float))));
+    tile = std::min(tile, (size_t)sqrt((double)(m_maxBufferSize / sizeof(float))));
+    if (tile >= 16)
+    {
+        tile -= tile % 16;
+    }
+    tile = std::max(tile, (size_t)1);
+
+    // At least 1: the tile counts divide by these.
+    *tileM = (int)std::max((size_t)1, std::min((size_t)lhsHeight, tile));
+    *tileN = (int)std::max((size_t)1, std::min((size_t)rhsWidth, tile));
+    *tileK = (int)std::max((size_t)1, std::min((size_t)lhsWidth, tile));
+}
+
+void OutOfCoreGpuOperations::multiplyTiled(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView* result,
+                                           const RowSink& sink) const
+{
+    const int M = lhs.height();
+    const int N = rhs.width();
+    const int K = lhs.width();
+
+    int tileM;
+    int tileN;
+    int tileK;
+    tileShape(K, M, N, &tileM, &tileN, &tileK);
+
+    if (result != NULL && emptyProduct(lhs, *result))
+    {
+        return;
+    }
+    if (result == NULL && (M == 0 || N == 0 || K == 0))
+    {
+        // Zero rows of C, no device work.
+        const Matrix zeros(N, std::min(tileM, M));
+        for (int row = 0; row < M; row += tileM)
+        {
+            sink(zeros.view().block(0, 0, N, std::min(tileM, M - row)), row);
+        }
+        return;
+    }
+
+    const int rows = (M + tileM - 1) / tileM;
+    const int cols = (N + tileN - 1) / tileN;
+    const int depth = (K + tileK - 1) / tileK;
+
+    // Without a result every band of tile rows comes back into the host band
+    // of its parity (the second one only needed for a second band),
+    // bandReads[] are the readbacks still filling a band.
+    const int bandWidth = result != NULL ? 0 : N;
+    Matrix bands[2] = { Matrix::uninitialized(bandWidth, tileM), Matrix::uninitialized(bandWidth, rows > 1 ? tileM : 0) };
+    std::vector<cl_event> bandReads[2];
+
+    // Two device buffers per operand. A slot remembers the tile it holds, the
+    // upload that filled it and the last command using it.
+    struct Slot
+    {
+        cl_mem buffer;
+        int row;
+        int col;
+        cl_event ready;
+        cl_event free;
+    };
+
+    PooledBuffer a0(m_bufferPool, sizeof(float) * tileM * tileK);
+    PooledBuffer a1(m_bufferPool, sizeof(float) * tileM * tileK);
+    PooledBuffer b0(m_bufferPool, sizeof(float) * tileK * tileN);
+    PooledBuffer b1(m_bufferPool, sizeof(float) * tileK * tileN);
+    PooledBuffer c0(m_bufferPool, sizeof(float) * tileM * tileN);
+    PooledBuffer c1(m_bufferPool, sizeof(float) * tileM * tileN);
+    TileEvents events;
+
+    Slot aSlots[2] = { { a0.get(), -1, -1, NULL, NULL }, { a1.get(), -1, -1, NULL, NULL } };
+    Slot bSlots[2] = { { b0.get(), -1, -1, NULL, NULL }, { b1.get(), -1, -1, NULL, NULL } };
+    Slot cSlots[2] = { { c0.get(), -1, -1, NULL, NULL }, { c1.get(), -1, -1, NULL, NULL } };
+    int lastA = 1;
+    int lastB = 1;
+
+    m_stats.tiles = 0;
+    m_stats.uploads = 0;
+    m_stats.reusedUploads = 0;
+
+    // Slot holding tile (row, col) of a host matrix, uploaded into the slot not
+    // used by the previous kernel unless one of them already holds it.
+    auto tileSlot = [&](Slot* slots, int* last, int row, int col, const float* host, int hostStride,
+                        int x, int y, int width, int height) -> Slot& {
+        for (int i = 0; i < 2; i++)
+        {
+            if (slots[i].row == row && slots[i].col == col)
+            {
+                m_stats.reusedUploads++;
+                *last = i;
+                return slots[i];
+            }
+        }
+
+        Slot& slot = slots[1 - *last];
+        const size_t bufferOrigin[3] = { 0, 0, 0 };
+        const size_t hostOrigin[3] = { sizeof(float) * x, (size_t)y, 0 };
+        const size_t region[3] = { sizeof(float) * width, (size_t)height, 1 };
+
+        cl_event uploaded;
+        if (clEnqueueWriteBufferRect(m_uploadQueue.get(), slot.buffer, CL_FALSE, bufferOrigin, hostOrigin, region,
+                                     sizeof(float) * width, 0, sizeof(float) * hostStride, 0, host,
+                                     slot.free != NULL ? 1 : 0, slot.free != NULL ? &slot.free : NULL, &uploaded) != CL_SUCCESS)
+        {
+            throw "upload buffer fail";
+        }
+        events.events.push_back(uploaded);
+        traceEvent("upload tile", m_uploadQueue.get(), uploaded);
+
+        m_stats.uploads++;
+        slot.row = row;
+        slot.col = col;
+        slot.ready = uploaded;
+        *last = 1 - *last;
+        return slot;
+    };
+
+    // Waits for the readbacks of band r and hands it to the sink.
+    auto finishBand = [&](int r) {
+        std::vector<cl_event>& reads = bandReads[r % 2];
+        if (clWaitForEvents((cl_uint)reads.size(), &reads[0]) != CL_SUCCESS)
+        {
+            throw "readback fail";
+        }
+        reads.clear();
+        sink(bands[r % 2].view().block(0, 0, N, std::min(tileM, M - r * tileM)), r * tileM);
+    };
+
+    for (int r = 0; r < rows; r++)
+    {
+        for (int cc = 0; cc < cols; cc++)
+        {
+            // Snake order: odd rows run right to left, odd tiles walk K backwards,
+            // so each step starts with a tile the previous one ended on.
+            const int c = (r % 2 == 0) ? cc : cols - 1 - cc;
+            const int tile = r * cols + cc;
+            const bool forward = tile % 2 == 0;
+
+            const int m = std::min(tileM, M - r * tileM);
+            const int n = std::min(tileN, N - c * tileN);
+            Slot& cSlot = cSlots[tile % 2];
+
+            cl_event kernelDone = NULL;
+            for (int kk = 0; kk < depth; kk++)
+            {
+                const int t = forward ? kk : depth - 1 - kk;
+                const int k = std::min(tileK, K - t * tileK);
+
+                Slot& aSlot = tileSlot(aSlots, &lastA, r, t, lhs.data(), lhs.stride(), t * tileK, r * tileM, k, m);
+                Slot& bSlot = tileSlot(bSlots, &lastB, t, c, rhs.data(), rhs.stride(), c * tileN, t * tileK, n, k);
+
+                // The first kernel of a C tile overwrites the slot, the readback of its previous tile must be done.
+                const cl_event waitList[3] = { aSlot.ready, bSlot.ready, cSlot.free };
+                const cl_uint waitCount = (kk == 0 && cSlot.free != NULL) ? 3 : 2;
+                enqueueTile(aSlot.buffer, bSlot.buffer, cSlot.buffer, m, n, k, kk > 0, waitCount, waitList, &kernelDone);
+                events.events.push_back(kernelDone);
+
+                aSlot.free = kernelDone;
+                bSlot.free = kernelDone;
+            }
+
+            // Into the result, or into the host band at row 0.
+            float* host = result != NULL ? result->data() : bands[r % 2].data();
+            const int hostStride = result != NULL ? result->stride() : N;
+            const size_t bufferOrigin[3] = { 0, 0, 0 };
+            const size_t hostOrigin[3] = { sizeof(float) * c * tileN, result != NULL ? (size_t)r * tileM : 0, 0 };
+            const size_t region[3] = { sizeof(float) * n, (size_t)m, 1 };
+
+            cl_event readDone;
+            if (clEnqueueReadBufferRect(m_readbackQueue.get(), cSlot.buffer, CL_FALSE, bufferOrigin, hostOrigin, region,
+                                        sizeof(float) * n, 0, sizeof(float) * hostStride, 0, host,
+                                        1, &kernelDone, &readDone) != CL_SUCCESS)
+            {
+                throw "readback fail";
+            }
+            events.events.push_back(readDone);
+            traceEvent("readback tile", m_readbackQueue.get(), readDone);
+            cSlot.free = readDone;
+            if (result == NULL)
+            {
+                bandReads[r % 2].push_back(readDone);
+            }
+
+            clFlush(m_uploadQueue.get());
+            clFlush(m_queue.get());
+            clFlush(m_readbackQueue.get());
+            m_stats.tiles++;
+        }
+
+        // Band r is queued, the previous one is handed out while it runs. Its
+        // host band is refilled by band r + 1 only after the sink returned.
+        if (result == NULL && r > 0)
+        {
+            finishBand(r - 1);
+        }
+    }
+
+    if (result == NULL)
+    {
+        finishBand(rows - 1);
+    }
+
+    if (events.wait() != CL_SUCCESS)
+    {
+        throw "readback fail";
+    }
+}
+
+void OutOfCoreGpuOperations::enqueueMultiply(cl_mem lhs, cl_mem rhs, cl_mem result, int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    enqueueTile(lhs, rhs, result, lhsHeight, rhsWidth, lhsWidth, false, 0, NULL, NULL);
+}
+
+void OutOfCoreGpuOperations::enqueueTile(cl_mem lhs, cl_mem rhs, cl_mem result, int m, int n, int k, bool accumulate,
+                                         cl_uint waitCount, const cl_event* waitList, cl_event* event) const
+{
+    cl_kernel kernel = cachedKernel("matrix_mul_accumulate");
+
+    const cl_mem memObjs[] = { lhs, rhs, result, 0 };
+    int argNdx = setKernelArgs(kernel, 0, memObjs);
+
+    const int sizes[] = { n, k, 0 };
+    argNdx = setKernelArgs(kernel, argNdx, sizes);
+
+    const int accumulateArg = accumulate ? 1 : 0;
+    if (clSetKernelArg(kernel, argNdx, sizeof(int), &accumulateArg) != CL_SUCCESS)
+    {
+        throw "kernel arg set fail";
+    }
+
+    size_t globalWorkSize[2] = { (size_t)n, (size_t)m };
+    ProfiledEvent kernelDone(m_profiler, "matrix_mul_accumulate", m_queue.get());
+    if (clEnqueueNDRangeKernel(m_queue.get(), kernel, 2, NULL, globalWorkSize, localWorkSize(), waitCount, waitList,
+                               event != NULL ? event : kernelDone.get()) != CL_SUCCESS)
+    {
+        throw "job enqueue fail";
+    }
+    kernelDone.enqueued();
+
+    if (event != NULL)
+    {
+        traceEvent("matrix_mul_accumulate", m_queue.get(), *event);
+    }
 }
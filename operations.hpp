@@ -5,53 +5,370 @@
 #define CL_USE_DEPRECATED_OPENCL_1_2_APIS
 #include <CL/cl.h>
 
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "gemm.hpp"
 #include "matrix.hpp"
 #include "mem.hpp"
+#include "precision.hpp"
+#include "profiler.hpp"
+#include "random.hpp"
+#include "thread_pool.hpp"
+
+// What every engine offers for its element type T (float or double).
+template<typename T>
+class BasicOperations
+{
+public:
+    virtual ~BasicOperations(void) { }
+    virtual BasicMatrix<T> multiply(const BasicMatrix<T>& lhs, const BasicMatrix<T>& rhs) const = 0;
 
-class Operations
+    // result = lhs * rhs into memory the caller owns, result must already have
+    // the shape of the product. Any of the views may be a strided submatrix.
+    // The default multiplies copies of the views, the engines override it so
+    // repeated calls on the same shapes allocate nothing.
+    virtual void multiplyInto(const BasicMatrixView<const T>& lhs, const BasicMatrixView<const T>& rhs, BasicMatrixView<T>& result) const;
+};
+
+extern template class BasicOperations<float>;
+extern template class BasicOperations<double>;
+
+// The float engines, with everything beyond a plain multiply.
+class Operations : public BasicOperations<float>
 {
 public:
-    virtual ~Operations(void) { }
-    virtual Matrix multiply(const Matrix& lhs, const Matrix& rhs) const = 0;
+    // lhs[i] * rhs[i] for every i. The default runs multiply() pair by pair,
+    // which also makes it the reference for the batched GPU kernels.
+    virtual std::vector<Matrix> multiplyBatched(const std::vector<Matrix>& lhs, const std::vector<Matrix>& rhs) const;
+
+    // c = epilogue(alpha * op(a) * op(b) + beta * c), op() transposes when its
+    // flag is set and c must have the shape of the product. With beta 0 c is
+    // not read. The default multiplies transposed copies and finishes on the
+    // host, the engines fold the transposes and the epilogue into their kernels.
+    virtual void gemm(bool transA, bool transB, float alpha, const ConstMatrixView& a, const ConstMatrixView& b,
+                      float beta, MatrixView& c, const Epilogue& epilogue = Epilogue()) const;
 };
 
 class CpuOperations : public Operations
 {
 public:
     virtual Matrix multiply(const Matrix& lhs, const Matrix& rhs) const;
+    virtual void multiplyInto(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView& result) const;
+    virtual void gemm(bool transA, bool transB, float alpha, const ConstMatrixView& a, const ConstMatrixView& b,
+                      float beta, MatrixView& c, const Epilogue& epilogue = Epilogue()) const;
 };
 
-class GpuOperations : public Operations
+// The CPU engine for any element type: sgemm or dgemm, each with the
+// micro-kernels (and so the vector width) of its type. For float it computes
+// the same as CpuOperations.
+template<typename T>
+class BasicCpuOperations : public BasicOperations<T>
+{
+public:
+    virtual BasicMatrix<T> multiply(const BasicMatrix<T>& lhs, const BasicMatrix<T>& rhs) const;
+    virtual void multiplyInto(const BasicMatrixView<const T>& lhs, const BasicMatrixView<const T>& rhs, BasicMatrixView<T>& result) const;
+
+    // Name of the micro-kernel selected for T on the running CPU.
+    static const char* kernelName(void);
+};
+
+extern template class BasicCpuOperations<float>;
+extern template class BasicCpuOperations<double>;
+
+class ParallelCpuOperations : public Operations
 {
+public:
+    // threads <= 0 uses every CPU the process may run on.
+    ParallelCpuOperations(int threads = 0);
+
+    virtual Matrix multiply(const Matrix& lhs, const Matrix& rhs) const;
+    virtual void multiplyInto(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView& result) const;
+    virtual void gemm(bool transA, bool transB, float alpha, const ConstMatrixView& a, const ConstMatrixView& b,
+                      float beta, MatrixView& c, const Epilogue& epilogue = Epilogue()) const;
+    // One pair per task, the pairs are spread over the workers.
+    virtual std::vector<Matrix> multiplyBatched(const std::vector<Matrix>& lhs, const std::vector<Matrix>& rhs) const;
+
+    int threads(void) const { return m_pool.size(); }
+
+private:
+    mutable ThreadPool m_pool;
+};
+
+// Result of GpuOperations::multiplyAsync(), wraps the event chain of the job.
+// Copies share the job, the last one alive waits for it to finish.
+class MultiplyHandle
+{
+public:
+    struct Job;
+
+    MultiplyHandle(void) {}
+    explicit MultiplyHandle(const std::shared_ptr<Job>& job)
+        : m_job(job)
+    {}
+
+    bool valid(void) const { return m_job.get() != NULL; }
+    // True once the result is back on the host (or the job failed, wait() throws then).
+    bool ready(void) const;
+    // Blocks until the result is back on the host, the reference lives as long as the handle.
+    const Matrix& wait(void) const;
+
 private:
+    std::shared_ptr<Job> m_job;
+};
+
+// Kernels are created once per instance and their arguments are set right
+// before each enqueue, so one instance must not multiply from several threads
+// at the same time.
+class GpuOperations : public Operations
+{
+protected:
     cl_device_id m_deviceId;
+    // Profiler::active() at construction, NULL when profiling is off.
+    Profiler* m_profiler;
 
 public:
     GpuOperations(void);
+    // Runs on the given device instead of the selected one.
+    explicit GpuOperations(cl_device_id device, std::string kernelFile = "matrix_mul.cl", std::string buildOptions = "");
+    virtual ~GpuOperations(void);
 
     virtual Matrix multiply(const Matrix& lhs, const Matrix& rhs) const;
+    // Strided views go up and come back with rect transfers, the device buffers come from the pool.
+    virtual void multiplyInto(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView& result) const;
+    // One launch of enqueueGemm(), transposed operands go up as they are
+    // stored. An empty C returns right away, with K 0 only beta and the
+    // epilogue are applied (on the host).
+    virtual void gemm(bool transA, bool transB, float alpha, const ConstMatrixView& a, const ConstMatrixView& b,
+                      float beta, MatrixView& c, const Epilogue& epilogue = Epilogue()) const;
+
+    // Pipelined multiply: the inputs are uploaded on one queue, multiplied on
+    // a second and read back on a third, chained by events. While a stream of
+    // jobs is in flight job N+1 uploads while job N computes and job N-1 reads
+    // back. lhs and rhs must stay alive and unchanged until the handle is
+    // waited on, and every handle must be done before this object is destroyed.
+    MultiplyHandle multiplyAsync(const Matrix& lhs, const Matrix& rhs) const;
+    // Only rows [firstRow, firstRow + rowCount) of the product, throws "shape
+    // mismatch" when the shapes or the rows do not fit. An empty product gives
+    // a handle that is ready at once.
+    MultiplyHandle multiplyAsync(const Matrix& lhs, const Matrix& rhs, int firstRow, int rowCount) const;
+
+    // The whole batch is packed into one buffer per operand and multiplied with
+    // a single launch of matrix_mul_batched.cl (shared by every variant). A
+    // batch of one shape uses the uniform kernel, mixed shapes go through a
+    // descriptor table and a range sized for the largest product.
+    virtual std::vector<Matrix> multiplyBatched(const std::vector<Matrix>& lhs, const std::vector<Matrix>& rhs) const;
+
+    // Counter based random matrix (see random.hpp) generated on the device by
+    // matrix_random.cl and read back, the same bits as randomMatrix().
+    Matrix random(int width, int height, uint64_t seed, const RandomDistribution& distribution) const;
+    // lhs * rhs with both operands generated on the device from their seeds,
+    // nothing is uploaded. The host gets the same operands from randomMatrix()
+    // to check the result.
+    Matrix multiplyRandom(int lhsWidth, int lhsHeight, int rhsWidth, uint64_t lhsSeed, uint64_t rhsSeed,
+                          const RandomDistribution& distribution) const;
+
+    BufferPool::Stats bufferPoolStats(void) const { return m_bufferPool.stats(); }
+
+    // Shape specialization: when enabled, every new (M, N, K) gets a program
+    // built with the sizes as -D constants, kept for later calls with that
+    // shape. The generic program stays the fallback (build failure, too many shapes).
+    void setSpecialization(bool enabled) { m_specialize = enabled; }
+    bool specialization(void) const { return m_specialize; }
+
+    // Zero-copy: multiply() wraps the matrices' own (page aligned) memory with
+    // CL_MEM_USE_HOST_PTR and maps the result instead of uploading and reading
+    // back, multiplyInto() does the same for contiguous, aligned views (a
+    // mapped matrix file). On by default for devices sharing memory with the
+    // host (CPU, iGPU).
+    void setZeroCopy(bool enabled) { m_zeroCopy = enabled; }
+    bool zeroCopy(void) const { return m_zeroCopy; }
+
+    // Work-group size of the multiply kernel, 0 x 0 leaves the choice to the runtime.
+    void setLocalWorkSize(size_t x, size_t y) { m_localWorkSize[0] = x; m_localWorkSize[1] = y; }
+    // Whether the work-group size fits the device and evenly divides the range for the shape.
+    virtual bool acceptsLocalWorkSize(size_t x, size_t y, int lhsWidth, int lhsHeight, int rhsWidth) const;
+
+    // Device name and driver version, identifies the device in tuning tables.
+    std::string deviceName(void) const;
+
+    // The profiler this object reports to, NULL when it was created without one.
+    Profiler* profiler(void) const { return m_profiler; }
+
+    // Every device of every platform.
+    static std::vector<cl_device_id> devices(void);
 
 protected:
-    GpuOperations(std::string kernelFile);
+    GpuOperations(std::string kernelFile, std::string buildOptions = "");
     cl_context createContext(void) const;
-    cl_command_queue createCommandQueue(cl_context context) const;
-    cl_program buildProgram(cl_context context, const std::string& filename) const;
+    // With CL_QUEUE_PROFILING_ENABLE when profiling, the name labels the queue in traces.
+    cl_command_queue createCommandQueue(cl_context context, const char* name) const;
+    cl_program buildProgram(cl_context context, const std::string& filename, const std::string& options = "") const;
     cl_kernel createKernel(cl_context context, cl_program program, const std::string& name) const;
+    // Kernel created on first use and kept (owned) until the object is destroyed.
+    cl_kernel cachedKernel(cl_program program, const std::string& name) const;
+    cl_kernel cachedKernel(const std::string& name) const { return cachedKernel(m_program.get(), name); }
     cl_mem uploadBuffer(cl_context context, size_t size, const void* dataPtr) const;
+    // Buffer from the pool, recorded as an allocation when profiling.
+    PooledBuffer acquireBuffer(size_t size) const;
+    // Buffer from the pool, filled with size bytes from dataPtr unless it is NULL.
+    PooledBuffer pooledBuffer(size_t size, const void* dataPtr) const;
+    // Pooled buffer holding the viewed elements packed row by row.
+    PooledBuffer pooledBuffer(const ConstMatrixView& view) const;
+    // Enqueues matrix_random.cl filling the first count floats of the buffer.
+    void enqueueRandom(cl_mem buffer, size_t count, uint64_t seed, const RandomDistribution& distribution) const;
+    // Blocking read of a packed buffer into the view.
+    void readBuffer(cl_mem buffer, const MatrixView& view) const;
+    // Buffer using the matrix memory itself (CL_MEM_USE_HOST_PTR), owned by the caller.
+    cl_mem hostBuffer(const Matrix& matrix, cl_mem_flags flags) const;
+    // The same for the viewed elements, the view must be wrappable(). Only views
+    // of writable memory may be wrapped without CL_MEM_READ_ONLY.
+    cl_mem hostBuffer(const ConstMatrixView& view, cl_mem_flags flags) const;
+    // Contiguous and aligned to CL_DEVICE_MEM_BASE_ADDR_ALIGN, like Matrix storage or a mapped matrix file.
+    bool wrappable(const ConstMatrixView& view) const;
+    bool hasUnifiedMemory(void) const;
+    Matrix multiplyZeroCopy(const Matrix& lhs, const Matrix& rhs) const;
+    // Multiplies host buffers and maps the result, which makes it visible in the host memory behind it.
+    void multiplyHostBuffers(cl_mem lhs, cl_mem rhs, cl_mem result, int lhsWidth, int lhsHeight, int rhsWidth) const;
 
+    // Program for the shape: the specialized one when enabled, m_program otherwise.
+    cl_program programFor(int lhsWidth, int lhsHeight, int rhsWidth) const;
+    // -D options fixing the shape, subclasses add their own constants (tile size, ...).
+    virtual std::string specializationOptions(int lhsWidth, int lhsHeight, int rhsWidth) const;
+
+    // Enqueues the kernel(s) computing result = lhs * rhs on already uploaded buffers.
+    virtual void enqueueMultiply(cl_mem lhs, cl_mem rhs, cl_mem result, int lhsWidth, int lhsHeight, int rhsWidth) const;
+    // Enqueues c = epilogue(alpha * op(a) * op(b) + beta * c) for an m x n x k
+    // product (none of them 0) on uploaded buffers, bias is NULL without one.
+    // The default runs matrix_mul_gemm.cl, the variants with a kernel of their
+    // own run its gemm kernel from gemmVariantProgram().
+    virtual void enqueueGemm(bool transA, bool transB, cl_mem a, cl_mem b, cl_mem c, cl_mem bias,
+                             int m, int n, int k, float alpha, float beta, const Epilogue& epilogue) const;
+    // m_kernelFile built with -DTRANS_A and -DTRANS_B for the transposes, built on first use.
+    cl_program gemmVariantProgram(bool transA, bool transB) const;
+    // Sets A, B, C, bias, K, N, M, flags, alpha, beta and scale, the arguments
+    // the gemm kernels of the variant files start with. Returns the next index.
+    int setGemmArgs(cl_kernel kernel, cl_mem a, cl_mem b, cl_mem c, cl_mem bias,
+                    int m, int n, int k, float alpha, float beta, const Epilogue& epilogue) const;
+    // Global range of the multiply kernel for the shape.
+    virtual void multiplyRange(int lhsWidth, int lhsHeight, int rhsWidth, size_t* globalWorkSize) const;
+    // The configured work-group size, NULL when the runtime picks it.
+    const size_t* localWorkSize(void) const { return m_localWorkSize[0] != 0 ? m_localWorkSize : NULL; }
+
+    // Hands an event the caller keeps to the profiler, if there is one.
+    void traceEvent(const char* name, cl_command_queue queue, cl_event event) const;
+
+    // Set consecutive kernel arguments from a 0 terminated list, returns the next argument index.
+    int setKernelArgs(cl_kernel kernel, int argNdx, const cl_mem* memObjs) const;
+    int setKernelArgs(cl_kernel kernel, int argNdx, const int* sizes) const;
+    // Set count consecutive int or float arguments, 0 is a value here.
+    int setKernelArgs(cl_kernel kernel, int argNdx, const int* values, size_t count) const;
+    int setKernelArgs(cl_kernel kernel, int argNdx, const float* values, size_t count) const;
+
+    // The first GPU of any platform, otherwise the first device at all.
     static cl_device_id selectDevice(void);
 
     CleanUp<cl_context> m_context;
     CleanUp<cl_command_queue> m_queue;
+    CleanUp<cl_command_queue> m_uploadQueue;
+    CleanUp<cl_command_queue> m_readbackQueue;
     CleanUp<cl_program> m_program;
+    mutable BufferPool m_bufferPool;
+    // Inputs and results of async jobs. They are used from several queues, so they
+    // must not mix with the temporaries enqueueMultiply hands back to m_bufferPool
+    // while its kernels may still run. A buffer returns here only once its job is done,
+    // so a steady stream cycles through the same few sets of buffers.
+    mutable BufferPool m_streamPool;
+    mutable std::map<std::pair<cl_program, std::string>, cl_kernel> m_kernels;
+
+    std::string m_kernelFile;
+    std::string m_buildOptions;
+    bool m_specialize;
+    bool m_zeroCopy;
+    // Keyed by the full build options, NULL marks a shape that failed to build.
+    mutable std::map<std::string, cl_program> m_specializedPrograms;
+    size_t m_localWorkSize[2];
+    // matrix_mul_batched.cl, built on the first batch.
+    mutable cl_program m_batchedProgram;
+    // matrix_mul_gemm.cl, built on the first gemm().
+    mutable cl_program m_gemmProgram;
+    // gemmVariantProgram() by transA * 2 + transB, NULL until used.
+    mutable cl_program m_gemmVariantPrograms[4];
+    // matrix_random.cl, built on the first random fill.
+    mutable cl_program m_randomProgram;
 };
 
+// The plain GPU engine for any element type. The kernel file is built with
+// -DREAL=float or -DREAL=double, the files taking REAL are matrix_mul.cl,
+// matrix_mul_constant.cl, matrix_mul_dot.cl and matrix_mul_float4.cl, the
+// constructor throws "kernel file does not take REAL" for any other. double
+// needs a device with cl_khr_fp64, the constructor throws "fp64 not supported"
+// otherwise.
+template<typename T>
+class BasicGpuOperations : public BasicOperations<T>
+{
+public:
+    explicit BasicGpuOperations(std::string kernelFile = "matrix_mul.cl");
+
+    virtual BasicMatrix<T> multiply(const BasicMatrix<T>& lhs, const BasicMatrix<T>& rhs) const;
+    // Contiguous views are multiplied in place, strided ones go through copies.
+    virtual void multiplyInto(const BasicMatrixView<const T>& lhs, const BasicMatrixView<const T>& rhs, BasicMatrixView<T>& result) const;
+
+    std::string deviceName(void) const { return m_device.deviceName(); }
+
+private:
+    // GpuOperations holds the context, the program and the buffers, it only
+    // ever sees the elements as bytes.
+    class Device : public GpuOperations
+    {
+    public:
+        Device(const std::string& kernelFile, bool fp64);
+
+        void multiply(const void* lhs, const void* rhs, void* result, size_t elementSize,
+                      int lhsWidth, int lhsHeight, int rhsWidth) const;
+
+    private:
+        // The selected device, checked for cl_khr_fp64 when fp64 is set.
+        static cl_device_id realDevice(bool fp64);
+    };
+
+    // kernelFile, throws unless it is one of the REAL files.
+    static const std::string& realKernelFile(const std::string& kernelFile);
+
+    Device m_device;
+};
+
+extern template class BasicGpuOperations<float>;
+extern template class BasicGpuOperations<double>;
+
+// The multiply kernel reads both operands along their rows when B is stored
+// transposed: multiply() transposes B on the device first, gemm(false, true, ...)
+// runs on a B^T the caller already has.
 class TransposedGpuOperations : public GpuOperations
 {
 public:
     TransposedGpuOperations(void);
 
-    virtual Matrix multiply(const Matrix& lhs, const Matrix& rhs) const;
+    // The transpose kernel alone, uploads the matrix and reads back the result.
+    Matrix transpose(const Matrix& matrix) const;
+
+    // Average seconds of a device transpose of a width x height matrix and of a
+    // device to device copy of the same bytes (the bandwidth bound), each timed
+    // on the host over runs enqueued back to back.
+    void timeTranspose(int width, int height, int runs, double* transposeSeconds, double* copySeconds) const;
+
+protected:
+    virtual void enqueueMultiply(cl_mem lhs, cl_mem rhs, cl_mem result, int lhsWidth, int lhsHeight, int rhsWidth) const;
+    virtual void enqueueGemm(bool transA, bool transB, cl_mem a, cl_mem b, cl_mem c, cl_mem bias,
+                             int m, int n, int k, float alpha, float beta, const Epilogue& epilogue) const;
+
+private:
+    void enqueueTranspose(cl_program program, cl_mem src, cl_mem dst, int width, int height, cl_event* event) const;
 };
 
 class DotGpuOperations : public GpuOperations
@@ -79,4 +396,137 @@ public:
     {}
 };
 
+// Work-groups of TILE x TILE items stage blocks of A and B in local memory.
+// The tile size is picked from the device work-group and local memory limits.
+class TiledGpuOperations : public GpuOperations
+{
+public:
+    TiledGpuOperations(void);
+
+    // Tile size in use: the local work size when one is set, the largest fitting one otherwise.
+    size_t tileSize(void) const { return m_localWorkSize[0] != 0 ? m_localWorkSize[0] : m_tileSize; }
+
+    // Only square power of two tiles up to the largest fitting one.
+    virtual bool acceptsLocalWorkSize(size_t x, size_t y, int lhsWidth, int lhsHeight, int rhsWidth) const;
+
+protected:
+    virtual std::string specializationOptions(int lhsWidth, int lhsHeight, int rhsWidth) const;
+    virtual void enqueueMultiply(cl_mem lhs, cl_mem rhs, cl_mem result, int lhsWidth, int lhsHeight, int rhsWidth) const;
+    virtual void enqueueGemm(bool transA, bool transB, cl_mem a, cl_mem b, cl_mem c, cl_mem bias,
+                             int m, int n, int k, float alpha, float beta, const Epilogue& epilogue) const;
+
+private:
+    size_t selectTileSize(void) const;
+
+    size_t m_tileSize;
+};
+
+// Register blocked kernels: every work-item computes a blockRows x 4 block of C.
+// Supported shapes are 4x4 (A read with vload4) and 8x4 (A read with vload8).
+class BlockedGpuOperations : public GpuOperations
+{
+public:
+    BlockedGpuOperations(int blockRows = 4);
+
+    int blockRows(void) const { return m_blockRows; }
+
+protected:
+    virtual void enqueueMultiply(cl_mem lhs, cl_mem rhs, cl_mem result, int lhsWidth, int lhsHeight, int rhsWidth) const;
+    virtual void enqueueGemm(bool transA, bool transB, cl_mem a, cl_mem b, cl_mem c, cl_mem bias,
+                             int m, int n, int k, float alpha, float beta, const Epilogue& epilogue) const;
+    virtual void multiplyRange(int lhsWidth, int lhsHeight, int rhsWidth, size_t* globalWorkSize) const;
+
+private:
+    static std::string buildOptions(int blockRows);
+
+    int m_blockRows;
+};
+
+// Mixed precision: multiply() and multiplyInto() convert A and B to 16 bit
+// storage on the host and upload half the bytes, matrix_mul_mixed.cl
+// accumulates in fp32 and C comes back in fp32. The results match
+// CpuOperations on the inputs rounded with roundToStorage(). Everything else
+// (async, batched, gemm) is inherited and runs in fp32.
+class MixedPrecisionGpuOperations : public GpuOperations
+{
+public:
+    MixedPrecisionGpuOperations(StorageFormat format = STORAGE_FP16);
+
+    StorageFormat format(void) const { return m_format; }
+
+    virtual Matrix multiply(const Matrix& lhs, const Matrix& rhs) const;
+    virtual void multiplyInto(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView& result) const;
+
+private:
+    // Converts the view into storage (reused between calls) and uploads it.
+    PooledBuffer storageBuffer(const ConstMatrixView& view, std::vector<uint16_t>& storage) const;
+
+    StorageFormat m_format;
+    CleanUp<cl_program> m_mixedProgram;
+    mutable std::vector<uint16_t> m_lhsStorage;
+    mutable std::vector<uint16_t> m_rhsStorage;
+};
+
+// Multiplies matrices that do not fit on the device by streaming tiles of A, B
+// and C through it. Every C tile is summed up over its K tiles on the device
+// and read back once. Uploads, kernels and readbacks run on separate queues
+// with two buffers per operand, so the next tiles upload while the current
+// ones are multiplied. C tiles are visited in a snake order (and the K tiles
+// of consecutive C tiles in alternating direction), so consecutive steps share
+// an A or B tile that is still on the device.
+//
+// Products that fit the budgets are multiplied whole.
+class OutOfCoreGpuOperations : public GpuOperations
+{
+public:
+    // Receives consecutive rows of C starting at firstRow, valid during the call.
+    typedef std::function<void(const ConstMatrixView& rows, int firstRow)> RowSink;
+
+    struct Stats
+    {
+        size_t tiles;
+        size_t uploads;
+        size_t reusedUploads;
+    };
+
+    // Device memory for the tiles of one multiply and the size of one buffer.
+    // 0 takes half of CL_DEVICE_GLOBAL_MEM_SIZE and CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+    // small values force the tiled path on any device.
+    OutOfCoreGpuOperations(size_t memoryBudget = 0, size_t maxBufferSize = 0);
+
+    virtual Matrix multiply(const Matrix& lhs, const Matrix& rhs) const;
+    // Products that fit are multiplied in place, larger ones are tiled straight from the views.
+    virtual void multiplyInto(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView& result) const;
+    virtual void gemm(bool transA, bool transB, float alpha, const ConstMatrixView& a, const ConstMatrixView& b,
+                      float beta, MatrixView& c, const Epilogue& epilogue = Epilogue()) const;
+
+    // lhs * rhs without holding C: always tiled, every band of tile rows is
+    // read back into one of two host bands and handed to sink in order. The
+    // sink for a band runs while the device already works on the next one, so
+    // writing C out overlaps the multiply.
+    void multiplyRows(const ConstMatrixView& lhs, const ConstMatrixView& rhs, const RowSink& sink) const;
+
+    // Tile sizes used for the shape, every dimension is covered by whole or edge tiles.
+    void tileShape(int lhsWidth, int lhsHeight, int rhsWidth, int* tileM, int* tileN, int* tileK) const;
+
+    // Counters of the last tiled multiply.
+    Stats lastStats(void) const { return m_stats; }
+
+protected:
+    virtual void enqueueMultiply(cl_mem lhs, cl_mem rhs, cl_mem result, int lhsWidth, int lhsHeight, int rhsWidth) const;
+
+private:
+    // Whether operands of these sizes (in bytes) are multiplied whole.
+    bool fits(size_t sizeA, size_t sizeB, size_t sizeC) const;
+    // Reads C back into result, or with a NULL result band by band into host
+    // bands handed to sink.
+    void multiplyTiled(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView* result, const RowSink& sink) const;
+    void enqueueTile(cl_mem lhs, cl_mem rhs, cl_mem result, int m, int n, int k, bool accumulate,
+                     cl_uint waitCount, const cl_event* waitList, cl_event* event) const;
+
+    size_t m_memoryBudget;
+    size_t m_maxBufferSize;
+    mutable Stats m_stats;
+};
+
 #endif // _OPERATIONS_HPP
@@ -0,0 +1,280 @@
+#include "precision.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PRECISION_X86 1
+#include <immintrin.h>
+#endif
+
+typedef void (*ToStorageFn)(const float* src, uint16_t* dst, size_t count);
+typedef void (*FromStorageFn)(const uint16_t* src, float* dst, size_t count);
+
+struct Converters
+{
+    ToStorageFn toHalf;
+    FromStorageFn fromHalf;
+    ToStorageFn toBfloat16;
+    FromStorageFn fromBfloat16;
+};
+
+static uint32_t floatBits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static float bitsFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Scalar conversions
+
+static uint16_t floatToHalf(float value)
+{
+    const uint32_t bits = floatBits(value);
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t abs = bits & 0x7fffffff;
+
+    // Infinity, or NaN with the quiet bit set (as F16C does)
+    if (abs >= 0x7f800000)
+    {
+        return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 | ((abs >> 13) & 0x3ff) : 0);
+    }
+
+    // 65520 and up round past the largest half (65504)
+    if (abs >= 0x477ff000)
+    {
+        return sign | 0x7c00;
+    }
+
+    uint32_t result;
+    uint32_t rest;
+    uint32_t halfway;
+    if (abs < 0x38800000)
+    {
+        // Subnormal half: the significand shifted down to units of 2^-24
+        const uint32_t exponent = abs >> 23;
+        if (exponent < 102)
+        {
+            return sign;
+        }
+
+        const uint32_t significand = (abs & 0x7fffff) | 0x800000;
+        const uint32_t shift = 126 - exponent;
+        result = significand >> shift;
+        rest = significand & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    }
+    else
+    {
+        // Exponent rebiased from 127 to 15, a carry out of the significand bumps it
+        result = (abs - 0x38000000) >> 13;
+        rest = abs & 0x1fff;
+        halfway = 0x1000;
+    }
+
+    if (rest > halfway || (rest == halfway && (result & 1)))
+    {
+        result++;
+    }
+
+    return sign | result;
+}
+
+static float halfToFloat(uint16_t value)
+{
+    const uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    const uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t significand = value & 0x3ff;
+
+    if (exponent == 0x1f)
+    {
+        return bitsFloat(sign | 0x7f800000 | (significand != 0 ? 0x400000 : 0) | (significand << 13));
+    }
+
+    if (exponent != 0)
+    {
+        return bitsFloat(sign | ((exponent + 112) << 23) | (significand << 13));
+    }
+
+    if (significand == 0)
+    {
+        return bitsFloat(sign);
+    }
+
+    // Subnormal half, normal as a float
+    uint32_t floatExponent = 113;
+    while ((significand & 0x400) == 0)
+    {
+        significand <<= 1;
+        floatExponent--;
+    }
+
+    return bitsFloat(sign | (floatExponent << 23) | ((significand & 0x3ff) << 13));
+}
+
+static uint16_t floatToBfloat16(float value)
+{
+    const uint32_t bits = floatBits(value);
+    if ((bits & 0x7fffffff) > 0x7f800000)
+    {
+        return (uint16_t)((bits >> 16) | 0x40);
+    }
+
+    return (uint16_t)((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+}
+
+static float bfloat16ToFloat(uint16_t value)
+{
+    return bitsFloat((uint32_t)value << 16);
+}
+
+static void toHalfScalar(const float* src, uint16_t* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = floatToHalf(src[i]);
+    }
+}
+
+static void fromHalfScalar(const uint16_t* src, float* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = halfToFloat(src[i]);
+    }
+}
+
+static void toBfloat16Scalar(const float* src, uint16_t* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = floatToBfloat16(src[i]);
+    }
+}
+
+static void fromBfloat16Scalar(const uint16_t* src, float* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = bfloat16ToFloat(src[i]);
+    }
+}
+
+#ifdef PRECISION_X86
+
+// Vector conversions, 8 elements per step and the scalar code for the tail.
+
+__attribute__((target("avx,f16c")))
+static void toHalfF16c(const float* src, uint16_t* dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        _mm_storeu_si128((__m128i*)(dst + i), _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+    toHalfScalar(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx,f16c")))
+static void fromHalfF16c(const uint16_t* src, float* dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+    }
+    fromHalfScalar(src + i, dst + i, count - i);
+}
+
+// The scalar rounding on 8 lanes, the results are left in the low 16 bits.
+__attribute__((target("avx2")))
+static __m256i bfloat16Bits(const float* src)
+{
+    const __m256i bits = _mm256_loadu_si256((const __m256i*)src);
+    const __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+    const __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(lsb, _mm256_set1_epi32(0x7fff))), 16);
+
+    const __m256i abs = _mm256_and_si256(bits, _mm256_set1_epi32(0x7fffffff));
+    const __m256i nan = _mm256_cmpgt_epi32(abs, _mm256_set1_epi32(0x7f800000));
+    const __m256i quiet = _mm256_or_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(0x40));
+
+    return _mm256_blendv_epi8(rounded, quiet, nan);
+}
+
+__attribute__((target("avx2")))
+static void toBfloat16Avx2(const float* src, uint16_t* dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        // packus works per 128 bit lane, the permute puts the halves back in order
+        const __m256i packed = _mm256_packus_epi32(bfloat16Bits(src + i), bfloat16Bits(src + i + 8));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute4x64_epi64(packed, 0xd8));
+    }
+    toBfloat16Scalar(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void fromBfloat16Avx2(const uint16_t* src, float* dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m256i bits = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_slli_epi32(bits, 16));
+    }
+    fromBfloat16Scalar(src + i, dst + i, count - i);
+}
+
+#endif // PRECISION_X86
+
+static Converters selectConverters(void)
+{
+    Converters converters = { toHalfScalar, fromHalfScalar, toBfloat16Scalar, fromBfloat16Scalar };
+#ifdef PRECISION_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c"))
+    {
+        converters.toHalf = toHalfF16c;
+        converters.fromHalf = fromHalfF16c;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+        converters.toBfloat16 = toBfloat16Avx2;
+        converters.fromBfloat16 = fromBfloat16Avx2;
+    }
+#endif
+    return converters;
+}
+
+static const Converters& converters(void)
+{
+    static const Converters selected = selectConverters();
+    return selected;
+}
+
+const char* storageFormatName(StorageFormat format)
+{
+    return format == STORAGE_BF16 ? "bf16" : "fp16";
+}
+
+void floatToStorage(StorageFormat format, const float* src, uint16_t* dst, size_t count)
+{
+    (format == STORAGE_BF16 ? converters().toBfloat16 : converters().toHalf)(src, dst, count);
+}
+
+void storageToFloat(StorageFormat format, const uint16_t* src, float* dst, size_t count)
+{
+    (format == STORAGE_BF16 ? converters().fromBfloat16 : converters().fromHalf)(src, dst, count);
+}
+
+float roundToStorage(StorageFormat format, float value)
+{
+    return format == STORAGE_BF16 ? bfloat16ToFloat(floatToBfloat16(value)) : halfToFloat(floatToHalf(value));
+}
@@ -0,0 +1,30 @@
+#ifndef _PRECISION_HPP
+#define _PRECISION_HPP
+
+#include <cstddef>
+#include <stdint.h>
+
+// 16 bit storage formats for matrices multiplied in mixed precision: the
+// elements are stored (and uploaded) in 16 bits, the products are
+// accumulated in fp32.
+//
+//  FP16: IEEE half, 11 bit significand, largest value 65504.
+//  BF16: the upper half of an fp32, 8 bit significand, the full fp32 range.
+enum StorageFormat
+{
+    STORAGE_FP16,
+    STORAGE_BF16
+};
+
+const char* storageFormatName(StorageFormat format);
+
+// Conversions of count elements. Rounding is to nearest even, fp16 overflows
+// to infinity and keeps subnormals, NaNs stay NaNs. The F16C / AVX2 paths
+// (picked at runtime) give the same bits as the scalar ones.
+void floatToStorage(StorageFormat format, const float* src, uint16_t* dst, size_t count);
+void storageToFloat(StorageFormat format, const uint16_t* src, float* dst, size_t count);
+
+// What a value becomes after a round trip through the format.
+float roundToStorage(StorageFormat format, float value);
+
+#endif // _PRECISION_HPP
@@ -0,0 +1,262 @@
+#include "profiler.hpp"
+
+#include <cstdio>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+static std::atomic<Profiler*> s_active(NULL);
+
+Profiler::Profiler(void)
+{
+}
+
+Profiler::~Profiler(void)
+{
+    for (size_t i = 0; i < m_pending.size(); i++)
+    {
+        clReleaseEvent(m_pending[i].event);
+    }
+}
+
+void Profiler::install(Profiler* profiler)
+{
+    s_active = profiler;
+}
+
+Profiler* Profiler::active(void)
+{
+    return s_active;
+}
+
+long long Profiler::now(void)
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void Profiler::addQueue(cl_command_queue queue, cl_device_id device, const std::string& deviceName, const std::string& queueName)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Queue& entry = m_queues[queue];
+    entry.device = device;
+    entry.deviceName = deviceName;
+    entry.name = queueName;
+}
+
+void Profiler::addEvent(const std::string& name, cl_command_queue queue, cl_event event)
+{
+    Pending pending;
+    pending.record.name = name;
+    pending.record.enqueued = now();
+    pending.record.queued = pending.record.submitted = pending.record.start = pending.record.end = 0;
+    pending.event = event;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<cl_command_queue, Queue>::const_iterator it = m_queues.find(queue);
+    pending.record.device = it != m_queues.end() ? it->second.device : NULL;
+    pending.record.process = it != m_queues.end() ? it->second.deviceName : "device";
+    pending.record.track = it != m_queues.end() ? it->second.name : "queue";
+
+    clRetainEvent(event);
+    m_pending.push_back(pending);
+}
+
+void Profiler::addHostSpan(const std::string& name, long long start, long long end)
+{
+    Record record;
+    record.name = name;
+    record.device = NULL;
+    record.process = "host";
+    record.enqueued = start;
+    record.queued = record.submitted = record.start = start;
+    record.end = end;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::map<std::thread::id, int>::iterator it = m_threads.find(std::this_thread::get_id());
+    if (it == m_threads.end())
+    {
+        it = m_threads.insert(std::make_pair(std::this_thread::get_id(), (int)m_threads.size())).first;
+    }
+    record.track = "thread " + std::to_string(it->second);
+
+    m_records.push_back(record);
+}
+
+void Profiler::resolve(void)
+{
+    for (size_t i = 0; i < m_pending.size(); i++)
+    {
+        Pending& pending = m_pending[i];
+        const cl_profiling_info params[] = {
+            CL_PROFILING_COMMAND_QUEUED, CL_PROFILING_COMMAND_SUBMIT, CL_PROFILING_COMMAND_START, CL_PROFILING_COMMAND_END
+        };
+        cl_ulong values[4];
+
+        // A command that failed or ran on a queue without profiling is dropped.
+        bool valid = clWaitForEvents(1, &pending.event) == CL_SUCCESS;
+        for (int p = 0; valid && p < 4; p++)
+        {
+            valid = clGetEventProfilingInfo(pending.event, params[p], sizeof(cl_ulong), &values[p], NULL) == CL_SUCCESS;
+        }
+        clReleaseEvent(pending.event);
+
+        if (valid)
+        {
+            pending.record.queued = (long long)values[0];
+            pending.record.submitted = (long long)values[1];
+            pending.record.start = (long long)values[2];
+            pending.record.end = (long long)values[3];
+            m_records.push_back(pending.record);
+        }
+    }
+
+    m_pending.clear();
+}
+
+std::vector<Profiler::Span> Profiler::spans(void)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    resolve();
+
+    // Device clock to host clock, per device.
+    std::map<cl_device_id, long long> offsets;
+    for (size_t i = 0; i < m_records.size(); i++)
+    {
+        const Record& record = m_records[i];
+        if (record.device == NULL)
+        {
+            continue;
+        }
+
+        const long long offset = record.enqueued - record.queued;
+        std::map<cl_device_id, long long>::iterator it = offsets.find(record.device);
+        if (it == offsets.end() || offset < it->second)
+        {
+            offsets[record.device] = offset;
+        }
+    }
+
+    std::vector<Span> spans(m_records.size());
+    for (size_t i = 0; i < m_records.size(); i++)
+    {
+        const Record& record = m_records[i];
+        const long long offset = record.device != NULL ? offsets[record.device] : 0;
+
+        spans[i].name = record.name;
+        spans[i].process = record.process;
+        spans[i].track = record.track;
+        spans[i].queued = record.queued + offset;
+        spans[i].submitted = record.submitted + offset;
+        spans[i].start = record.start + offset;
+        spans[i].end = record.end + offset;
+    }
+
+    std::stable_sort(spans.begin(), spans.end(), [](const Span& a, const Span& b) { return a.start < b.start; });
+    return spans;
+}
+
+std::map<std::string, double> Profiler::totals(void)
+{
+    const std::vector<Span> all = spans();
+
+    std::map<std::string, double> totals;
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        totals[all[i].name] += (all[i].end - all[i].start) * 1e-9;
+    }
+
+    return totals;
+}
+
+void Profiler::clear(void)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < m_pending.size(); i++)
+    {
+        clReleaseEvent(m_pending[i].event);
+    }
+    m_pending.clear();
+    m_records.clear();
+}
+
+static std::string jsonString(const std::string& text)
+{
+    std::string quoted = "\"";
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        if (text[i] == '"' || text[i] == '\\')
+        {
+            quoted += '\\';
+        }
+        quoted += text[i];
+    }
+
+    return quoted + "\"";
+}
+
+bool Profiler::writeChromeTrace(const std::string& filename)
+{
+    const std::vector<Span> all = spans();
+
+    FILE* file = fopen(filename.c_str(), "w");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    long long origin = 0;
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        origin = i == 0 ? all[i].queued : std::min(origin, all[i].queued);
+    }
+
+    // pid 1 is reserved for the host, every device gets the next free pid;
+    // one thread per queue or host thread.
+    std::map<std::string, int> pids;
+    std::map<std::pair<int, std::string>, int> tids;
+    pids["host"] = 1;
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fprintf(file, "{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": 1, \"args\": {\"name\": \"host\"}}%s\n",
+            all.empty() ? "" : ",");
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        const Span& span = all[i];
+
+        std::map<std::string, int>::iterator process = pids.find(span.process);
+        if (process == pids.end())
+        {
+            const int pid = (int)pids.size() + 1;
+            process = pids.insert(std::make_pair(span.process, pid)).first;
+            fprintf(file, "{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": %d, \"args\": {\"name\": %s}},\n",
+                    pid, jsonString(span.process).c_str());
+        }
+
+        const std::pair<int, std::string> trackKey(process->second, span.track);
+        std::map<std::pair<int, std::string>, int>::iterator track = tids.find(trackKey);
+        if (track == tids.end())
+        {
+            const int tid = (int)tids.size() + 1;
+            track = tids.insert(std::make_pair(trackKey, tid)).first;
+            fprintf(file, "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": %s}},\n",
+                    process->second, tid, jsonString(span.track).c_str());
+        }
+
+        fprintf(file, "{\"ph\": \"X\", \"cat\": %s, \"name\": %s, \"pid\": %d, \"tid\": %d, "
+                      "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"queued_us\": %.3f, \"submit_delay_us\": %.3f, \"launch_delay_us\": %.3f}}%s\n",
+                span.process == "host" ? "\"host\"" : "\"device\"",
+                jsonString(span.name).c_str(),
+                process->second,
+                track->second,
+                (span.start - origin) * 1e-3,
+                (span.end - span.start) * 1e-3,
+                (span.queued - origin) * 1e-3,
+                (span.submitted - span.queued) * 1e-3,
+                (span.start - span.submitted) * 1e-3,
+                i + 1 < all.size() ? "," : "");
+    }
+    fprintf(file, "]}\n");
+
+    return fclose(file) == 0;
+}
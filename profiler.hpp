@@ -0,0 +1,187 @@
+#ifndef _PROFILER_HPP
+#define _PROFILER_HPP
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mem.hpp"
+
+// Opt-in timeline of where the GPU engines spend a multiply.
+//
+// A profiler installed with install() is picked up by every GpuOperations
+// created afterwards: its queues are created with CL_QUEUE_PROFILING_ENABLE,
+// every enqueue (uploads, transpose and multiply kernels, readbacks) hands its
+// event to the profiler, and program builds and buffer allocations are
+// recorded as host spans. Engines created without one use plain queues and
+// pass no events, which leaves a NULL check per enqueue.
+//
+// Device timestamps are moved onto the host steady clock with one offset per
+// device, the smallest difference between an enqueue returning on the host
+// and the command being queued on the device.
+class Profiler
+{
+public:
+    struct Span
+    {
+        std::string name;
+        // "host" or the device name.
+        std::string process;
+        // The queue of a device command, "thread <n>" for host spans.
+        std::string track;
+        // Nanoseconds on the host steady clock, queued and submitted equal
+        // start for host spans.
+        long long queued;
+        long long submitted;
+        long long start;
+        long long end;
+    };
+
+    Profiler(void);
+    ~Profiler(void);
+
+    // The profiler engines created from now on report to, NULL (the default)
+    // disables profiling. It must outlive those engines.
+    static void install(Profiler* profiler);
+    static Profiler* active(void);
+
+    // Host steady clock in nanoseconds.
+    static long long now(void);
+
+    // Names a queue of the device for the trace.
+    void addQueue(cl_command_queue queue, cl_device_id device, const std::string& deviceName, const std::string& queueName);
+    // Records a command enqueued just now, the profiler keeps a reference to
+    // the event and reads its timestamps once it completed.
+    void addEvent(const std::string& name, cl_command_queue queue, cl_event event);
+    void addHostSpan(const std::string& name, long long start, long long end);
+
+    // Every span so far ordered by start, waits for the recorded commands.
+    std::vector<Span> spans(void);
+    // Seconds per span name, start to end.
+    std::map<std::string, double> totals(void);
+    void clear(void);
+
+    // Chrome trace-event JSON (chrome://tracing, Perfetto): a process for the
+    // host threads and one per device, with a thread per queue.
+    bool writeChromeTrace(const std::string& filename);
+
+private:
+    Profiler(const Profiler&);
+    Profiler& operator=(const Profiler&);
+
+    struct Queue
+    {
+        cl_device_id device;
+        std::string deviceName;
+        std::string name;
+    };
+
+    struct Record
+    {
+        std::string name;
+        std::string process;
+        std::string track;
+        // NULL for host spans.
+        cl_device_id device;
+        // Host time right after the enqueue returned.
+        long long enqueued;
+        // Device clock for commands.
+        long long queued;
+        long long submitted;
+        long long start;
+        long long end;
+    };
+
+    struct Pending
+    {
+        Record record;
+        cl_event event;
+    };
+
+    // Reads the timestamps of the pending events, m_mutex held.
+    void resolve(void);
+
+    std::mutex m_mutex;
+    std::map<cl_command_queue, Queue> m_queues;
+    std::map<std::thread::id, int> m_threads;
+    std::vector<Pending> m_pending;
+    std::vector<Record> m_records;
+};
+
+// Event argument of one enqueue: get() is NULL without a profiler, otherwise
+// the enqueue fills in an event for the profiler. Call enqueued() right after
+// the enqueue returns so the host timestamp the device clock is aligned with
+// is taken then; the destructor hands over an event enqueued() missed.
+class ProfiledEvent
+{
+public:
+    ProfiledEvent(Profiler* profiler, const char* name, cl_command_queue queue)
+        : m_profiler(profiler)
+        , m_name(name)
+        , m_queue(queue)
+        , m_event(NULL)
+    {}
+
+    ~ProfiledEvent(void)
+    {
+        enqueued();
+    }
+
+    cl_event* get(void) { return m_profiler != NULL ? &m_event : NULL; }
+
+    // Hands the event (if the enqueue filled it in) to the profiler, stamped now.
+    void enqueued(void)
+    {
+        if (m_event != NULL)
+        {
+            m_profiler->addEvent(m_name, m_queue, m_event);
+            clReleaseEvent(m_event);
+            m_event = NULL;
+        }
+    }
+
+private:
+    ProfiledEvent(const ProfiledEvent&);
+    ProfiledEvent& operator=(const ProfiledEvent&);
+
+    Profiler* m_profiler;
+    const char* m_name;
+    cl_command_queue m_queue;
+    cl_event m_event;
+};
+
+// Host span from construction to destruction, nothing without a profiler.
+class ProfiledSpan
+{
+public:
+    ProfiledSpan(Profiler* profiler, const char* name, const std::string& detail = std::string())
+        : m_profiler(profiler)
+        , m_start(0)
+    {
+        if (m_profiler != NULL)
+        {
+            m_name = detail.empty() ? name : std::string(name) + " " + detail;
+            m_start = Profiler::now();
+        }
+    }
+
+    ~ProfiledSpan(void)
+    {
+        if (m_profiler != NULL)
+        {
+            m_profiler->addHostSpan(m_name, m_start, Profiler::now());
+        }
+    }
+
+private:
+    ProfiledSpan(const ProfiledSpan&);
+    ProfiledSpan& operator=(const ProfiledSpan&);
+
+    Profiler* m_profiler;
+    std::string m_name;
+    long long m_start;
+};
+
+#endif // _PROFILER_HPP
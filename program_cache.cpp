@@ -0,0 +1,250 @@
+#include "program_cache.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char CACHE_MAGIC[8] = { 'O', 'C', 'L', 'M', 'M', 'B', 'I', 'N' };
+
+unsigned long long hashString(const std::string& text)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static std::string hexString(unsigned long long value)
+{
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", value);
+    return buffer;
+}
+
+static std::string deviceInfoString(cl_device_id device, cl_device_info param)
+{
+    size_t size = 0;
+    clGetDeviceInfo(device, param, 0, NULL, &size);
+
+    std::vector<char> value(size + 1, '\0');
+    if (size > 0)
+    {
+        clGetDeviceInfo(device, param, size, &value[0], NULL);
+    }
+
+    return std::string(&value[0]);
+}
+
+std::string defaultCacheDirectory(void)
+{
+    const char* directory = getenv("OPENCL_MATRIX_MUL_CACHE");
+    if (directory != NULL)
+    {
+        return directory;
+    }
+
+    const char* xdgCache = getenv("XDG_CACHE_HOME");
+    if (xdgCache != NULL && *xdgCache)
+    {
+        return std::string(xdgCache) + "/opencl_matrix_mul";
+    }
+
+    const char* home = getenv("HOME");
+    if (home != NULL && *home)
+    {
+        return std::string(home) + "/.cache/opencl_matrix_mul";
+    }
+
+    return "";
+}
+
+bool makeDirectories(const std::string& path)
+{
+    for (size_t pos = 1; pos <= path.size(); pos++)
+    {
+        if (pos == path.size() || path[pos] == '/')
+        {
+            std::string part = path.substr(0, pos);
+            if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool readBlock(FILE* fp, std::vector<unsigned char>* data)
+{
+    unsigned long long size = 0;
+    if (fread(&size, sizeof(size), 1, fp) != 1 || size > (1ULL << 31))
+    {
+        return false;
+    }
+
+    data->resize(size);
+    return size == 0 || fread(&(*data)[0], 1, size, fp) == size;
+}
+
+static bool writeBlock(FILE* fp, const void* data, unsigned long long size)
+{
+    return fwrite(&size, sizeof(size), 1, fp) == 1
+        && (size == 0 || fwrite(data, 1, size, fp) == size);
+}
+
+ProgramCache::ProgramCache(const std::string& directory)
+    : m_directory(directory)
+{
+}
+
+const ProgramCache& ProgramCache::instance(void)
+{
+    static const ProgramCache cache(defaultCacheDirectory());
+    return cache;
+}
+
+std::string ProgramCache::key(cl_device_id device, const std::string& source, const std::string& options) const
+{
+    return deviceInfoString(device, CL_DEVICE_NAME) + "\n"
+        + deviceInfoString(device, CL_DEVICE_VERSION) + "\n"
+        + deviceInfoString(device, CL_DRIVER_VERSION) + "\n"
+        + options + "\n"
+        + hexString(hashString(source));
+}
+
+std::string ProgramCache::path(const std::string& key) const
+{
+    return m_directory + "/" + hexString(hashString(key)) + ".bin";
+}
+
+cl_program ProgramCache::load(cl_context context, cl_device_id device, const std::string& source, const std::string& options) const
+{
+    if (!enabled())
+    {
+        return NULL;
+    }
+
+    const std::string entryKey = key(device, source, options);
+    FILE* fp = fopen(path(entryKey).c_str(), "rb");
+    if (!fp)
+    {
+        return NULL;
+    }
+
+    // The full key is stored next to the binary to rule out hash collisions.
+    char magic[sizeof(CACHE_MAGIC)];
+    std::vector<unsigned char> storedKey;
+    std::vector<unsigned char> binary;
+    bool valid = fread(magic, sizeof(magic), 1, fp) == 1
+        && memcmp(magic, CACHE_MAGIC, sizeof(magic)) == 0
+        && readBlock(fp, &storedKey)
+        && std::string(storedKey.begin(), storedKey.end()) == entryKey
+        && readBlock(fp, &binary)
+        && !binary.empty();
+    fclose(fp);
+
+    if (!valid)
+    {
+        return NULL;
+    }
+
+    const unsigned char* binaryPtr = &binary[0];
+    const size_t binarySize = binary.size();
+    cl_int binaryStatus;
+    cl_int error;
+    cl_program program = clCreateProgramWithBinary(context, 1, &device, &binarySize, &binaryPtr, &binaryStatus, &error);
+    if (!program || error != CL_SUCCESS || binaryStatus != CL_SUCCESS)
+    {
+        if (program)
+        {
+            clReleaseProgram(program);
+        }
+        return NULL;
+    }
+
+    // Binaries still have to be "built" before kernels can be created.
+    if (clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL) != CL_SUCCESS)
+    {
+        clReleaseProgram(program);
+        return NULL;
+    }
+
+    return program;
+}
+
+void ProgramCache::store(cl_program program, cl_device_id device, const std::string& source, const std::string& options) const
+{
+    if (!enabled())
+    {
+        return;
+    }
+
+    cl_uint deviceCount = 0;
+    if (clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(deviceCount), &deviceCount, NULL) != CL_SUCCESS || deviceCount == 0)
+    {
+        return;
+    }
+
+    std::vector<cl_device_id> devices(deviceCount);
+    std::vector<size_t> sizes(deviceCount);
+    clGetProgramInfo(program, CL_PROGRAM_DEVICES, sizeof(cl_device_id) * deviceCount, &devices[0], NULL);
+    clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t) * deviceCount, &sizes[0], NULL);
+
+    std::vector<std::vector<unsigned char> > binaries(deviceCount);
+    std::vector<unsigned char*> binaryPtrs(deviceCount);
+    for (cl_uint i = 0; i < deviceCount; i++)
+    {
+        binaries[i].resize(sizes[i] + 1);
+        binaryPtrs[i] = &binaries[i][0];
+    }
+
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char*) * deviceCount, &binaryPtrs[0], NULL) != CL_SUCCESS)
+    {
+        return;
+    }
+
+    for (cl_uint i = 0; i < deviceCount; i++)
+    {
+        if (devices[i] != device || sizes[i] == 0)
+        {
+            continue;
+        }
+
+        if (!makeDirectories(m_directory))
+        {
+            return;
+        }
+
+        // Write to a private file first so concurrent runs never see half an entry.
+        const std::string entryKey = key(device, source, options);
+        const std::string finalPath = path(entryKey);
+        const std::string tempPath = finalPath + ".tmp." + hexString(getpid());
+
+        FILE* fp = fopen(tempPath.c_str(), "wb");
+        if (!fp)
+        {
+            return;
+        }
+
+        bool written = fwrite(CACHE_MAGIC, sizeof(CACHE_MAGIC), 1, fp) == 1
+            && writeBlock(fp, entryKey.data(), entryKey.size())
+            && writeBlock(fp, binaryPtrs[i], sizes[i]);
+        written = (fclose(fp) == 0) && written;
+
+        if (!written || rename(tempPath.c_str(), finalPath.c_str()) != 0)
+        {
+            unlink(tempPath.c_str());
+        }
+        return;
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef _PROGRAM_CACHE_HPP
+#define _PROGRAM_CACHE_HPP
+
+#include <string>
+
+#include "mem.hpp"
+
+// On-disk cache of compiled program binaries (CL_PROGRAM_BINARIES).
+//
+// Entries are keyed by device name, device and driver version, build options
+// and a hash of the source, so a driver update or a kernel edit simply misses.
+// The directory is taken from $OPENCL_MATRIX_MUL_CACHE, then
+// $XDG_CACHE_HOME/opencl_matrix_mul, then ~/.cache/opencl_matrix_mul. Setting
+// OPENCL_MATRIX_MUL_CACHE to an empty string disables the cache.
+class ProgramCache
+{
+public:
+    explicit ProgramCache(const std::string& directory);
+
+    bool enabled(void) const { return !m_directory.empty(); }
+
+    // Built program for the device from a cached binary, NULL on a miss.
+    cl_program load(cl_context context, cl_device_id device, const std::string& source, const std::string& options) const;
+    // Stores the binary of a program built for the device.
+    void store(cl_program program, cl_device_id device, const std::string& source, const std::string& options) const;
+
+    // Cache in the default directory.
+    static const ProgramCache& instance(void);
+
+private:
+    std::string key(cl_device_id device, const std::string& source, const std::string& options) const;
+    std::string path(const std::string& key) const;
+
+    std::string m_directory;
+};
+
+// 64 bit FNV-1a hash.
+unsigned long long hashString(const std::string& text);
+
+// Per-user cache directory described above, empty when caching is disabled.
+std::string defaultCacheDirectory(void);
+// mkdir -p, true when the directory exists afterwards.
+bool makeDirectories(const std::string& path);
+
+#endif // _PROGRAM_CACHE_HPP
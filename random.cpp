@@ -0,0 +1,179 @@
+#include "random.hpp"
+
+#include <algorithm>
+
+#include "thread_pool.hpp"
+
+// Must match matrix_random.cl
+static const uint32_t PHILOX_M0 = 0xD2511F53;
+static const uint32_t PHILOX_M1 = 0xCD9E8D57;
+static const uint32_t PHILOX_W0 = 0x9E3779B9;
+static const uint32_t PHILOX_W1 = 0xBB67AE85;
+static const int NORMAL_TERMS = 12;
+
+// Below this many elements the threads cost more than they save.
+static const size_t PARALLEL_ELEMENTS = 1 << 16;
+
+RandomDistribution RandomDistribution::integer(int limit)
+{
+    if (limit <= 0 || limit > (1 << 24))
+    {
+        throw "random limit out of range";
+    }
+
+    RandomDistribution distribution = { RANDOM_INTEGER, (float)limit, 0.0f };
+    return distribution;
+}
+
+RandomDistribution RandomDistribution::uniform(float low, float high)
+{
+    RandomDistribution distribution = { RANDOM_UNIFORM, low, high };
+    return distribution;
+}
+
+RandomDistribution RandomDistribution::normal(float mean, float stddev)
+{
+    RandomDistribution distribution = { RANDOM_NORMAL, mean, stddev };
+    return distribution;
+}
+
+void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t result[4])
+{
+    uint32_t c0 = counter[0];
+    uint32_t c1 = counter[1];
+    uint32_t c2 = counter[2];
+    uint32_t c3 = counter[3];
+    uint32_t k0 = key[0];
+    uint32_t k1 = key[1];
+
+    for (int round = 0; round < 10; round++)
+    {
+        const uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        const uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+        c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        c1 = (uint32_t)p1;
+        c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c3 = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+
+    result[0] = c0;
+    result[1] = c1;
+    result[2] = c2;
+    result[3] = c3;
+}
+
+// Counters: RANDOM_INTEGER and RANDOM_UNIFORM take word index % 4 of block
+// (index / 4, 0), RANDOM_NORMAL sums the words of blocks (index, 1) to (index, 3).
+static void block(uint64_t seed, uint64_t high, uint64_t stream, uint32_t words[4])
+{
+    const uint32_t counter[4] = { (uint32_t)high, (uint32_t)(high >> 32), (uint32_t)stream, 0 };
+    const uint32_t key[2] = { (uint32_t)seed, (uint32_t)(seed >> 32) };
+    philox4x32(counter, key, words);
+}
+
+// fp-contract is off: in C++ mode GCC may fuse the multiply-add when the
+// target has fma, the device does not.
+__attribute__((optimize("fp-contract=off")))
+static float fromWord(uint32_t word, const RandomDistribution& distribution)
+{
+    if (distribution.kind == RANDOM_INTEGER)
+    {
+        return (float)(uint32_t)(((uint64_t)word * (uint32_t)distribution.a) >> 32);
+    }
+
+    const float u = (float)(word >> 8) * (1.0f / 16777216.0f);
+    return distribution.a + (distribution.b - distribution.a) * u;
+}
+
+__attribute__((optimize("fp-contract=off")))
+static float normalElement(uint64_t seed, uint64_t index, const RandomDistribution& distribution)
+{
+    // 12 values of 24 bits add up to less than 2^28, exact in integers.
+    int32_t sum = 0;
+    for (int stream = 1; stream <= NORMAL_TERMS / 4; stream++)
+    {
+        uint32_t words[4];
+        block(seed, index, stream, words);
+        for (int i = 0; i < 4; i++)
+        {
+            sum += (int32_t)(words[i] >> 8);
+        }
+    }
+
+    const float z = (float)(sum - (NORMAL_TERMS / 2 << 24)) * (1.0f / 16777216.0f);
+    return distribution.a + distribution.b * z;
+}
+
+float randomElement(uint64_t seed, uint64_t index, const RandomDistribution& distribution)
+{
+    if (distribution.kind == RANDOM_NORMAL)
+    {
+        return normalElement(seed, index, distribution);
+    }
+
+    uint32_t words[4];
+    block(seed, index / 4, 0, words);
+    return fromWord(words[index % 4], distribution);
+}
+
+// width elements starting at logical index first.
+static void fillRow(float* row, int width, uint64_t first, uint64_t seed, const RandomDistribution& distribution)
+{
+    if (distribution.kind == RANDOM_NORMAL)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            row[x] = normalElement(seed, first + x, distribution);
+        }
+        return;
+    }
+
+    // One block per four elements, the row may start and end inside a block.
+    int x = 0;
+    while (x < width)
+    {
+        const uint64_t index = first + x;
+        uint32_t words[4];
+        block(seed, index / 4, 0, words);
+        for (int lane = (int)(index % 4); lane < 4 && x < width; lane++, x++)
+        {
+            row[x] = fromWord(words[lane], distribution);
+        }
+    }
+}
+
+void fillRandom(const MatrixView& view, uint64_t seed, const RandomDistribution& distribution, int threads)
+{
+    const size_t elements = (size_t)view.width() * view.height();
+    if (elements < PARALLEL_ELEMENTS || threads == 1)
+    {
+        for (int y = 0; y < view.height(); y++)
+        {
+            fillRow(&view(0, y), view.width(), (uint64_t)y * view.width(), seed, distribution);
+        }
+        return;
+    }
+
+    // Tasks of whole rows, about PARALLEL_ELEMENTS each.
+    const int rowsPerTask = (int)std::max((size_t)1, PARALLEL_ELEMENTS / std::max(1, view.width()));
+    const int tasks = (view.height() + rowsPerTask - 1) / rowsPerTask;
+
+    ThreadPool pool(threads, false);
+    pool.run(tasks, [&](int task, int) {
+        const int end = std::min(view.height(), (task + 1) * rowsPerTask);
+        for (int y = task * rowsPerTask; y < end; y++)
+        {
+            fillRow(&view(0, y), view.width(), (uint64_t)y * view.width(), seed, distribution);
+        }
+    });
+}
+
+Matrix randomMatrix(int width, int height, uint64_t seed, const RandomDistribution& distribution, int threads)
+{
+    Matrix matrix = Matrix::uninitialized(width, height);
+    fillRandom(matrix.view(), seed, distribution, threads);
+
+    return matrix;
+}
@@ -0,0 +1,55 @@
+#ifndef _RANDOM_HPP
+#define _RANDOM_HPP
+
+#include <stdint.h>
+
+#include "matrix.hpp"
+
+// Counter based random matrices. Element i (row-major index in the logical
+// matrix, whatever the stride of the view) is a pure function of the seed and
+// i, computed with Philox4x32-10 (Salmon et al., "Parallel random numbers: as
+// easy as 1, 2, 3"). Any thread or work-item can generate any element without
+// shared state, a matrix is the same for every thread count, and
+// matrix_random.cl produces the same bits on a device.
+//
+// To keep host and device bit identical the float math only uses operations
+// OpenCL rounds correctly (int to float conversion, +, -, *), without fma
+// contraction:
+//
+//  RANDOM_INTEGER: floor(word * limit / 2^32), integers in [0, limit), limit
+//                  at most 2^24.
+//  RANDOM_UNIFORM: low + (high - low) * u, u the upper 24 bits of a word / 2^24.
+//  RANDOM_NORMAL:  mean + stddev * z, z the sum of 12 such u minus 6
+//                  (Irwin-Hall): mean 0, variance 1, cut off at +-6.
+enum RandomKind
+{
+    RANDOM_INTEGER,
+    RANDOM_UNIFORM,
+    RANDOM_NORMAL
+};
+
+struct RandomDistribution
+{
+    RandomKind kind;
+    // limit and unused, low and high, or mean and stddev.
+    float a;
+    float b;
+
+    static RandomDistribution integer(int limit);
+    static RandomDistribution uniform(float low, float high);
+    static RandomDistribution normal(float mean, float stddev);
+};
+
+// One Philox4x32-10 block.
+void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t result[4]);
+
+// Element index of every matrix generated from seed.
+float randomElement(uint64_t seed, uint64_t index, const RandomDistribution& distribution);
+
+// Fills the view, large views are split over threads (threads <= 0 uses one
+// per CPU). The result does not depend on the thread count.
+void fillRandom(const MatrixView& view, uint64_t seed, const RandomDistribution& distribution, int threads = 0);
+
+Matrix randomMatrix(int width, int height, uint64_t seed, const RandomDistribution& distribution, int threads = 0);
+
+#endif // _RANDOM_HPP
@@ -0,0 +1,223 @@
+#include "strassen_operations.hpp"
+
+#include <algorithm>
+
+// dst = x + y, dst may be x or y.
+static void add(const ConstMatrixView& x, const ConstMatrixView& y, const MatrixView& dst)
+{
+    for (int i = 0; i < dst.height(); i++)
+    {
+        const float* xRow = &x(0, i);
+        const float* yRow = &y(0, i);
+        float* dstRow = &dst(0, i);
+        for (int j = 0; j < dst.width(); j++)
+        {
+            dstRow[j] = xRow[j] + yRow[j];
+        }
+    }
+}
+
+// dst = x - y, dst may be x or y.
+static void subtract(const ConstMatrixView& x, const ConstMatrixView& y, const MatrixView& dst)
+{
+    for (int i = 0; i < dst.height(); i++)
+    {
+        const float* xRow = &x(0, i);
+        const float* yRow = &y(0, i);
+        float* dstRow = &dst(0, i);
+        for (int j = 0; j < dst.width(); j++)
+        {
+            dstRow[j] = xRow[j] - yRow[j];
+        }
+    }
+}
+
+StrassenOperations::StrassenOperations(const Operations& leaf, int cutoff)
+    : m_leaf(leaf)
+    , m_cutoff(std::max(1, cutoff))
+{
+}
+
+void StrassenOperations::setCutoff(int cutoff)
+{
+    m_cutoff = std::max(1, cutoff);
+}
+
+Matrix StrassenOperations::multiply(const Matrix& lhs, const Matrix& rhs) const
+{
+    Matrix result = Matrix::uninitialized(rhs.width(), lhs.height());
+    MatrixView view = result.view();
+    StrassenOperations::multiplyInto(lhs, rhs, view);
+
+    return result;
+}
+
+void StrassenOperations::multiplyInto(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView& result) const
+{
+    if (lhs.width() != rhs.height() || result.width() != rhs.width() || result.height() != lhs.height())
+    {
+        throw "shape mismatch";
+    }
+
+    reserve(lhs.width(), lhs.height(), rhs.width());
+    product(lhs, rhs, result, m_arena.data());
+}
+
+int StrassenOperations::levels(int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    int m = lhsHeight;
+    int n = rhsWidth;
+    int k = lhsWidth;
+    int levels = 0;
+    for (; recurses(m, n, k); levels++)
+    {
+        m /= 2;
+        n /= 2;
+        k /= 2;
+    }
+
+    return levels;
+}
+
+void StrassenOperations::reserve(int lhsWidth, int lhsHeight, int rhsWidth) const
+{
+    const size_t size = arenaSize(lhsHeight, rhsWidth, lhsWidth);
+    if (m_arena.size() < size)
+    {
+        m_arena.resize(size);
+    }
+}
+
+bool StrassenOperations::recurses(int m, int n, int k) const
+{
+    return m > m_cutoff && n > m_cutoff && k > m_cutoff;
+}
+
+size_t StrassenOperations::arenaSize(int m, int n, int k) const
+{
+    if (!recurses(m, n, k))
+    {
+        return 0;
+    }
+
+    const size_t hm = m / 2;
+    const size_t hn = n / 2;
+    const size_t hk = k / 2;
+    return hm * hk + hk * hn + hm * hn + arenaSize(m / 2, n / 2, k / 2);
+}
+
+void StrassenOperations::product(const ConstMatrixView& a, const ConstMatrixView& b, MatrixView& c, float* arena) const
+{
+    const int m = c.height();
+    const int n = c.width();
+    const int k = a.width();
+
+    if (!recurses(m, n, k))
+    {
+        m_leaf.multiplyInto(a, b, c);
+        return;
+    }
+
+    // Dynamic peeling: the even m2 x n2 x k2 part goes through the recursion,
+    // what an odd dimension leaves over is fixed up on the host, O(mn + mk + nk).
+    const int m2 = m & ~1;
+    const int n2 = n & ~1;
+    const int k2 = k & ~1;
+
+    MatrixView even = c.block(0, 0, n2, m2);
+    winograd(a.block(0, 0, k2, m2), b.block(0, 0, n2, k2), even, arena);
+
+    if (k2 != k)
+    {
+        // The last depth slice as a rank-1 update of the even part.
+        for (int i = 0; i < m2; i++)
+        {
+            const float lhs = a(k - 1, i);
+            const float* rhsRow = &b(0, k - 1);
+            float* row = &c(0, i);
+            for (int j = 0; j < n2; j++)
+            {
+                row[j] += lhs * rhsRow[j];
+            }
+        }
+    }
+
+    if (n2 != n)
+    {
+        for (int i = 0; i < m; i++)
+        {
+            float sum = 0.0f;
+            for (int p = 0; p < k; p++)
+            {
+                sum += a(p, i) * b(n - 1, p);
+            }
+            c(n - 1, i) = sum;
+        }
+    }
+
+    if (m2 != m)
+    {
+        float* row = &c(0, m - 1);
+        std::fill(row, row + n2, 0.0f);
+        for (int p = 0; p < k; p++)
+        {
+            const float lhs = a(p, m - 1);
+            const float* rhsRow = &b(0, p);
+            for (int j = 0; j < n2; j++)
+            {
+                row[j] += lhs * rhsRow[j];
+            }
+        }
+    }
+}
+
+// One level on even sizes, in the schedule of Douglas et al. (DGEFMM): the
+// quadrants of C hold intermediate sums, so only X (a quarter of A), Y (a
+// quarter of B) and Z (a quarter of C) are extra.
+void StrassenOperations::winograd(const ConstMatrixView& a, const ConstMatrixView& b, MatrixView& c, float* arena) const
+{
+    const int hm = c.height() / 2;
+    const int hn = c.width() / 2;
+    const int hk = a.width() / 2;
+
+    const ConstMatrixView a11 = a.block(0, 0, hk, hm);
+    const ConstMatrixView a12 = a.block(hk, 0, hk, hm);
+    const ConstMatrixView a21 = a.block(0, hm, hk, hm);
+    const ConstMatrixView a22 = a.block(hk, hm, hk, hm);
+    const ConstMatrixView b11 = b.block(0, 0, hn, hk);
+    const ConstMatrixView b12 = b.block(hn, 0, hn, hk);
+    const ConstMatrixView b21 = b.block(0, hk, hn, hk);
+    const ConstMatrixView b22 = b.block(hn, hk, hn, hk);
+    MatrixView c11 = c.block(0, 0, hn, hm);
+    MatrixView c12 = c.block(hn, 0, hn, hm);
+    MatrixView c21 = c.block(0, hm, hn, hm);
+    MatrixView c22 = c.block(hn, hm, hn, hm);
+
+    MatrixView x(arena, hk, hm, hk);
+    MatrixView y(x.data() + (size_t)hm * hk, hn, hk, hn);
+    MatrixView z(y.data() + (size_t)hk * hn, hn, hm, hn);
+    float* next = z.data() + (size_t)hm * hn;
+
+    subtract(a11, a21, x);           // S3 = A11 - A21
+    subtract(b22, b12, y);           // T3 = B22 - B12
+    product(x, y, c21, next);        // P7 = S3 * T3
+    add(a21, a22, x);                // S1 = A21 + A22
+    subtract(b12, b11, y);           // T1 = B12 - B11
+    product(x, y, c22, next);        // P5 = S1 * T1
+    subtract(x, a11, x);             // S2 = S1 - A11
+    subtract(b22, y, y);             // T2 = B22 - T1
+    product(x, y, c12, next);        // P6 = S2 * T2
+    subtract(a12, x, x);             // S4 = A12 - S2
+    product(x, b22, c11, next);      // P3 = S4 * B22
+    product(a11, b11, z, next);      // P1 = A11 * B11
+    add(z, c12, c12);                // U2 = P1 + P6
+    add(c12, c21, c21);              // U3 = U2 + P7
+    add(c12, c22, c12);              // U4 = U2 + P5
+    add(c21, c22, c22);              // U7 = U3 + P5 = C22
+    add(c12, c11, c12);              // U5 = U4 + P3 = C12
+    subtract(y, b21, y);             // T4 = T2 - B21
+    product(a22, y, c11, next);      // P4 = A22 * T4
+    subtract(c21, c11, c21);         // U6 = U3 - P4 = C21
+    product(a12, b21, c11, next);    // P2 = A12 * B21
+    add(c11, z, c11);                // U1 = P1 + P2 = C11
+}
@@ -0,0 +1,56 @@
+#ifndef _STRASSEN_OPERATIONS_HPP
+#define _STRASSEN_OPERATIONS_HPP
+
+#include <vector>
+
+#include "matrix.hpp"
+#include "operations.hpp"
+
+// Fast multiply for large matrices: Strassen-Winograd (7 half size products
+// and 15 additions per level) applied recursively until a dimension of the
+// product drops to the cutoff, the products at that size are handed to the
+// leaf engine (any CPU or GPU Operations).
+//
+// Every level needs three temporaries (a quarter of A, of B and of C), the
+// rest is computed in the quadrants of C. They are carved from one arena sized
+// for the whole recursion, which is kept and only grows when a larger shape
+// comes, so repeated calls allocate nothing. Odd sizes are peeled: the even
+// part goes through the recursion and the last row, column or depth slice is
+// added on the host.
+//
+// The result differs from the classical product by rounding, the error grows
+// with the number of levels. The arena makes one instance single threaded.
+class StrassenOperations : public Operations
+{
+public:
+    // The leaf engine is not owned and must outlive this object.
+    explicit StrassenOperations(const Operations& leaf, int cutoff = 512);
+
+    virtual Matrix multiply(const Matrix& lhs, const Matrix& rhs) const;
+    virtual void multiplyInto(const ConstMatrixView& lhs, const ConstMatrixView& rhs, MatrixView& result) const;
+
+    // Products with any dimension at or below the cutoff go to the leaf engine.
+    void setCutoff(int cutoff);
+    int cutoff(void) const { return m_cutoff; }
+
+    // Strassen levels applied to the shape, 0 when it goes to the leaf whole.
+    int levels(int lhsWidth, int lhsHeight, int rhsWidth) const;
+
+    // Grows the arena for the shape up front.
+    void reserve(int lhsWidth, int lhsHeight, int rhsWidth) const;
+
+private:
+    bool recurses(int m, int n, int k) const;
+    // Floats of temporaries needed by an m x n x k product and everything below it.
+    size_t arenaSize(int m, int n, int k) const;
+
+    // c = a * b, the temporaries of this level and below come from arena.
+    void product(const ConstMatrixView& a, const ConstMatrixView& b, MatrixView& c, float* arena) const;
+    void winograd(const ConstMatrixView& a, const ConstMatrixView& b, MatrixView& c, float* arena) const;
+
+    const Operations& m_leaf;
+    int m_cutoff;
+    mutable std::vector<float, AlignedAllocator<float> > m_arena;
+};
+
+#endif // _STRASSEN_OPERATIONS_HPP
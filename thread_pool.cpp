@@ -0,0 +1,218 @@
+#include "thread_pool.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// CPUs the process is allowed to run on, empty if unknown.
+static std::vector<int> availableCpus(void)
+{
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &set))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+    return cpus;
+}
+
+static void pinCurrentThread(int cpu)
+{
+#ifdef __linux__
+    if (cpu < 0)
+    {
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    // Pinning is only a hint for locality, a failure is not fatal.
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+int ThreadPool::hardwareThreads(void)
+{
+    std::vector<int> cpus = availableCpus();
+    if (!cpus.empty())
+    {
+        return (int)cpus.size();
+    }
+
+    unsigned count = std::thread::hardware_concurrency();
+    return count ? (int)count : 1;
+}
+
+ThreadPool::ThreadPool(int threadCount, bool pinThreads)
+    : m_task(NULL)
+    , m_generation(0)
+    , m_pending(0)
+    , m_stop(false)
+{
+    if (threadCount <= 0)
+    {
+        threadCount = hardwareThreads();
+    }
+
+    std::vector<int> cpus;
+    if (pinThreads)
+    {
+        cpus = availableCpus();
+    }
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        m_queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        m_threads.push_back(std::thread(&ThreadPool::workerLoop, this, i, cpu));
+    }
+}
+
+ThreadPool::~ThreadPool(void)
+{
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+
+    for (size_t i = 0; i < m_threads.size(); i++)
+    {
+        m_threads[i].join();
+    }
+}
+
+void ThreadPool::run(int count, const Task& task)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> runGuard(m_runLock);
+    std::unique_lock<std::mutex> guard(m_lock);
+
+    m_task = &task;
+    m_pending = count;
+
+    // Contiguous chunks keep neighbouring tasks (and the memory they touch) on one worker.
+    const int workers = size();
+    for (int w = 0; w < workers; w++)
+    {
+        const int begin = (int)((long long)count * w / workers);
+        const int end = (int)((long long)count * (w + 1) / workers);
+
+        std::lock_guard<std::mutex> queueGuard(m_queues[w]->lock);
+        for (int i = begin; i < end; i++)
+        {
+            m_queues[w]->tasks.push_back(i);
+        }
+    }
+
+    m_generation++;
+    m_wake.notify_all();
+    m_done.wait(guard, [this] { return m_pending == 0; });
+
+    m_task = NULL;
+    if (m_error)
+    {
+        std::exception_ptr error = m_error;
+        m_error = std::exception_ptr();
+        std::rethrow_exception(error);
+    }
+}
+
+bool ThreadPool::popTask(int worker, int* task)
+{
+    {
+        Queue& own = *m_queues[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty())
+        {
+            *task = own.tasks.back();
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    const int workers = size();
+    for (int i = 1; i < workers; i++)
+    {
+        Queue& victim = *m_queues[(worker + i) % workers];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty())
+        {
+            *task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::workerLoop(int worker, int cpu)
+{
+    pinCurrentThread(cpu);
+
+    unsigned seen = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> guard(m_lock);
+            m_wake.wait(guard, [&] { return m_stop || m_generation != seen; });
+            if (m_stop)
+            {
+                return;
+            }
+            seen = m_generation;
+        }
+
+        int index;
+        while (popTask(worker, &index))
+        {
+            // The run owning this index cannot finish before the task does, so m_task is valid.
+            const Task* task;
+            {
+                std::lock_guard<std::mutex> guard(m_lock);
+                task = m_task;
+            }
+
+            try
+            {
+                (*task)(index, worker);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> guard(m_lock);
+                if (!m_error)
+                {
+                    m_error = std::current_exception();
+                }
+            }
+
+            std::lock_guard<std::mutex> guard(m_lock);
+            if (--m_pending == 0)
+            {
+                m_done.notify_one();
+            }
+        }
+    }
+}
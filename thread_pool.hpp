@@ -0,0 +1,63 @@
+#ifndef _THREAD_POOL_HPP
+#define _THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size work-stealing thread pool.
+//
+// Every run() splits its task indices into contiguous chunks, one per worker
+// queue. A worker pops from the back of its own queue and, once that is empty,
+// steals from the front of the other queues. Workers are optionally pinned to
+// the CPUs the process may run on, so a worker keeps touching the same memory.
+class ThreadPool
+{
+public:
+    typedef std::function<void(int task, int worker)> Task;
+
+    // threadCount <= 0 selects one worker per available CPU.
+    ThreadPool(int threadCount = 0, bool pinThreads = true);
+    ~ThreadPool(void);
+
+    int size(void) const { return (int)m_threads.size(); }
+
+    // Runs task(index, worker) for every index in [0, count) and waits until all are done.
+    // The first exception thrown by a task is rethrown here.
+    void run(int count, const Task& task);
+
+    static int hardwareThreads(void);
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<int> tasks;
+    };
+
+    void workerLoop(int worker, int cpu);
+    bool popTask(int worker, int* task);
+
+    std::vector<std::thread> m_threads;
+    std::vector<std::unique_ptr<Queue> > m_queues;
+
+    std::mutex m_runLock;
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const Task* m_task;
+    unsigned m_generation;
+    int m_pending;
+    bool m_stop;
+    std::exception_ptr m_error;
+};
+
+#endif // _THREAD_POOL_HPP
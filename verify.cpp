@@ -0,0 +1,195 @@
+#include "verify.hpp"
+
+#include <cmath>
+#include <cstring>
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+
+template<typename T>
+double freivaldsError(const BasicMatrixView<const T>& lhs, const BasicMatrixView<const T>& rhs, const BasicMatrixView<const T>& result,
+                      int rounds, unsigned seed)
+{
+    if (lhs.width() != rhs.height() || result.width() != rhs.width() || result.height() != lhs.height())
+    {
+        throw "shape mismatch";
+    }
+
+    const int m = lhs.height();
+    const int n = rhs.width();
+    const int k = lhs.width();
+
+    // The row magnitudes |lhs| * (|rhs| * 1) / n do not depend on r.
+    std::vector<double> rhsAbs(k, 0.0);
+    for (int p = 0; p < k; p++)
+    {
+        const T* row = &rhs(0, p);
+        double sum = 0.0;
+        for (int j = 0; j < n; j++)
+        {
+            sum += fabs((double)row[j]);
+        }
+        rhsAbs[p] = sum;
+    }
+
+    std::vector<double> magnitude(m, 0.0);
+    for (int i = 0; i < m; i++)
+    {
+        const T* row = &lhs(0, i);
+        double sum = 0.0;
+        for (int p = 0; p < k; p++)
+        {
+            sum += fabs((double)row[p]) * rhsAbs[p];
+        }
+        magnitude[i] = sum / n;
+    }
+
+    std::mt19937 random(seed);
+    std::vector<double> r(n);
+    std::vector<double> rhsR(k);
+    double worst = 0.0;
+    for (int round = 0; round < rounds; round++)
+    {
+        for (int j = 0; j < n; j++)
+        {
+            r[j] = (random() & 1) ? 1.0 : -1.0;
+        }
+
+        for (int p = 0; p < k; p++)
+        {
+            const T* row = &rhs(0, p);
+            double sum = 0.0;
+            for (int j = 0; j < n; j++)
+            {
+                sum += row[j] * r[j];
+            }
+            rhsR[p] = sum;
+        }
+
+        for (int i = 0; i < m; i++)
+        {
+            const T* lhsRow = &lhs(0, i);
+            const T* resultRow = &result(0, i);
+            double expected = 0.0;
+            for (int p = 0; p < k; p++)
+            {
+                expected += lhsRow[p] * rhsR[p];
+            }
+            double actual = 0.0;
+            for (int j = 0; j < n; j++)
+            {
+                actual += resultRow[j] * r[j];
+            }
+
+            // A zero row of lhs must give an exactly zero row.
+            const double difference = fabs(expected - actual);
+            const double error = magnitude[i] > 0.0 ? difference / magnitude[i] : difference;
+            if (!std::isfinite(error))
+            {
+                return std::numeric_limits<double>::infinity();
+            }
+            worst = std::max(worst, error);
+        }
+    }
+
+    return worst;
+}
+
+template<typename T>
+bool freivaldsCheck(const BasicMatrixView<const T>& lhs, const BasicMatrixView<const T>& rhs, const BasicMatrixView<const T>& result,
+                    int rounds, double tolerance, unsigned seed)
+{
+    return freivaldsError(lhs, rhs, result, rounds, seed) <= tolerance;
+}
+
+template<typename T>
+double maxRelativeError(const BasicMatrixView<const T>& result, const BasicMatrixView<const T>& reference)
+{
+    if (result.width() != reference.width() || result.height() != reference.height())
+    {
+        throw "shape mismatch";
+    }
+
+    double referenceMax = 0.0;
+    double maxError = 0.0;
+    for (int y = 0; y < reference.height(); y++)
+    {
+        const T* resultRow = &result(0, y);
+        const T* referenceRow = &reference(0, y);
+        for (int x = 0; x < reference.width(); x++)
+        {
+            const double error = fabs((double)resultRow[x] - referenceRow[x]);
+            if (std::isnan(error))
+            {
+                return std::numeric_limits<double>::infinity();
+            }
+            referenceMax = std::max(referenceMax, fabs((double)referenceRow[x]));
+            maxError = std::max(maxError, error);
+        }
+    }
+
+    return referenceMax > 0.0 ? maxError / referenceMax : maxError;
+}
+
+// Sign-magnitude bits mapped to a scale on which neighbouring values differ
+// by one, -0 and +0 both at 0.
+static int64_t orderedBits(float value)
+{
+    int32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits < 0 ? -(int64_t)(bits & 0x7fffffff) : bits;
+}
+
+static int64_t orderedBits(double value)
+{
+    int64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits < 0 ? -(bits & 0x7fffffffffffffffLL) : bits;
+}
+
+template<typename T>
+uint64_t maxUlpDistance(const BasicMatrixView<const T>& result, const BasicMatrixView<const T>& reference)
+{
+    if (result.width() != reference.width() || result.height() != reference.height())
+    {
+        throw "shape mismatch";
+    }
+
+    uint64_t maxDistance = 0;
+    for (int y = 0; y < reference.height(); y++)
+    {
+        const T* resultRow = &result(0, y);
+        const T* referenceRow = &reference(0, y);
+        for (int x = 0; x < reference.width(); x++)
+        {
+            const bool resultNan = std::isnan(resultRow[x]);
+            if (resultNan != std::isnan(referenceRow[x]))
+            {
+                return UINT64_MAX;
+            }
+            if (resultNan)
+            {
+                continue;
+            }
+
+            // Unsigned, the distance of the double extremes does not fit an int64_t.
+            const int64_t a = orderedBits(resultRow[x]);
+            const int64_t b = orderedBits(referenceRow[x]);
+            const uint64_t distance = a > b ? (uint64_t)a - (uint64_t)b : (uint64_t)b - (uint64_t)a;
+            maxDistance = std::max(maxDistance, distance);
+        }
+    }
+
+    return maxDistance;
+}
+
+template double freivaldsError(const BasicMatrixView<const float>&, const BasicMatrixView<const float>&, const BasicMatrixView<const float>&, int, unsigned);
+template double freivaldsError(const BasicMatrixView<const double>&, const BasicMatrixView<const double>&, const BasicMatrixView<const double>&, int, unsigned);
+template bool freivaldsCheck(const BasicMatrixView<const float>&, const BasicMatrixView<const float>&, const BasicMatrixView<const float>&, int, double, unsigned);
+template bool freivaldsCheck(const BasicMatrixView<const double>&, const BasicMatrixView<const double>&, const BasicMatrixView<const double>&, int, double, unsigned);
+template double maxRelativeError(const BasicMatrixView<const float>&, const BasicMatrixView<const float>&);
+template double maxRelativeError(const BasicMatrixView<const double>&, const BasicMatrixView<const double>&);
+template uint64_t maxUlpDistance(const BasicMatrixView<const float>&, const BasicMatrixView<const float>&);
+template uint64_t maxUlpDistance(const BasicMatrixView<const double>&, const BasicMatrixView<const double>&);
@@ -0,0 +1,50 @@
+#ifndef _VERIFY_HPP
+#define _VERIFY_HPP
+
+#include <stdint.h>
+
+#include "matrix.hpp"
+
+// Checks of a computed product that tolerate reordered sums.
+//
+// Freivalds' check needs no reference product: for a random vector r of +-1
+// entries, lhs * (rhs * r) is compared with result * r, which costs
+// O(mk + kn + mn) per round instead of the O(mnk) of a CPU multiply. A single
+// wrong element is caught in every round; errors that cancel out in result * r
+// survive a round with probability at most 1/2, so every round halves the
+// chance of a wrong product passing. The sums are taken in double.
+//
+// The error of row i is |lhs * (rhs * r) - result * r| relative to the mean
+// over j of the sum of |lhs(p, i)| * |rhs(j, p)| over p, the magnitude of the
+// terms behind an element of that row. So a single wrong element shows its
+// own relative error, independent of the size of the values. The rounding
+// errors of the correct elements add up over the row with random signs, for
+// fp32 kernels that is around sqrt(n * k) * FLT_EPSILON, exact inputs (small
+// integers) give exactly 0.
+//
+// The full comparators need a reference, for a kernel being developed or a
+// result read back in another precision.
+
+// The largest row error of any round, infinity when a NaN or an infinity
+// shows up in the sums. The same seed gives the same vectors.
+template<typename T>
+double freivaldsError(const BasicMatrixView<const T>& lhs, const BasicMatrixView<const T>& rhs, const BasicMatrixView<const T>& result,
+                      int rounds, unsigned seed = 1);
+
+// freivaldsError() is at most tolerance.
+template<typename T>
+bool freivaldsCheck(const BasicMatrixView<const T>& lhs, const BasicMatrixView<const T>& rhs, const BasicMatrixView<const T>& result,
+                    int rounds, double tolerance, unsigned seed = 1);
+
+// Largest |result - reference| relative to the largest |reference|, the
+// absolute error when reference is all zeros, infinity for a NaN.
+template<typename T>
+double maxRelativeError(const BasicMatrixView<const T>& result, const BasicMatrixView<const T>& reference);
+
+// Largest distance of corresponding elements in units in the last place,
+// the number of representable values between them: 0 for equal elements
+// (+0 and -0 too, and two NaNs), UINT64_MAX when only one is a NaN.
+template<typename T>
+uint64_t maxUlpDistance(const BasicMatrixView<const T>& result, const BasicMatrixView<const T>& reference);
+
+#endif // _VERIFY_HPP